@@ -18,6 +18,7 @@
 #include "log.h"
 #include "hsfs.h"
 #include "hsx_fuse.h"
+#include "hsfs_buf.h"
 #include "xcommon.h"
 #include "nls.h"
 #include "utils/mount/parse_dev.h"
@@ -25,7 +26,7 @@
 #include "fstab.h"
 #include "nfs_mntent.h"
 
-int __INIT_DEBUG = 0;
+__thread int __INIT_DEBUG = 0;
 
 char *progname = NULL;
 int verbose = 0;
@@ -87,6 +88,7 @@ static inline int hsi_fuse_add_opt(struct fuse_args *args, const char *opt)
 
 static struct fuse_lowlevel_ops hsfs_oper = {
 	.init = hsx_fuse_init,
+	.destroy = hsx_fuse_destroy,
 	.getattr = hsx_fuse_getattr,
 	.statfs = hsx_fuse_statfs,
 	.lookup = hsx_fuse_lookup,
@@ -95,8 +97,10 @@ static struct fuse_lowlevel_ops hsfs_oper = {
 	.release = hsx_fuse_release,
 	.read = hsx_fuse_read,
 	.write = hsx_fuse_write,
+	.write_buf = hsx_fuse_write_buf,
 	.setattr = hsx_fuse_setattr,
 	.forget = hsx_fuse_forget,
+	.forget_multi = hsx_fuse_forget_multi,
 	.rmdir = hsx_fuse_rmdir,
 	.unlink = hsx_fuse_unlink,
 	.readlink = hsx_fuse_readlink,
@@ -111,6 +115,7 @@ static struct fuse_lowlevel_ops hsfs_oper = {
 	.getxattr = hsx_fuse_getxattr,
 	.setxattr = hsx_fuse_setxattr,
 	.readdirplus = hsx_fuse_readdir_plus,
+	.ioctl = hsx_fuse_ioctl,
 };
 
 /*
@@ -467,6 +472,29 @@ out:
 	return ret;
 }
 
+/* Ask libfuse for its io_uring queues, which it binds one per CPU. */
+static int hsfs_fuse_uring(_U_ struct fuse_args *args, struct hsfs_super *sb)
+{
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 18)
+	char opt[64];
+	int ret;
+
+	if (!sb->io_uring)
+		return 0;
+	ret = fuse_opt_add_arg(args, "-oio_uring");
+	if (ret == 0 && sb->io_uring_depth) {
+		snprintf(opt, sizeof(opt), "-oio_uring_q_depth=%u",
+			 sb->io_uring_depth);
+		ret = fuse_opt_add_arg(args, opt);
+	}
+	return ret;
+#else
+	if (sb->io_uring)
+		WARNING("io_uring needs libfuse 3.18 or later, ignored.");
+	return 0;
+#endif
+}
+
 int main(int argc, char **argv)
 {
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
@@ -492,13 +520,23 @@ int main(int argc, char **argv)
 	err = hsfs_do_mount(&hsfs_opts, &super);
 	if (err)
 		goto out;
+	err = hsfs_buf_init(super.bufflags);
+	if (err)
+		goto err_out1;
 	if (hsfs_opts.fake)
 		goto err_out1;
 
+	err = hsfs_fuse_uring(&args, &super);
+	if (err)
+		goto err_out1;
+
 	err = -1;
-	se = fuse_session_new(&args, &hsfs_oper, sizeof(hsfs_oper), &super);
+	se = fuse_session_new(&args, super.tenant_ops || super.tenant_bw ?
+			      hsx_fuse_tenant_oper(&hsfs_oper) : &hsfs_oper,
+			      sizeof(hsfs_oper), &super);
 	if (se == NULL)
 		goto err_out1;
+	super.se = se;
 	if (fuse_set_signal_handlers(se) != 0)
 	    goto err_out2;
 	if (fuse_session_mount(se, fuse_opts.mountpoint) != 0)
@@ -507,6 +545,8 @@ int main(int argc, char **argv)
 
 	if (fuse_opts.singlethread)
 			err = fuse_session_loop(se);
+	else if ((super.percpu || super.reactor) && !super.io_uring)
+		err = hsx_fuse_loop_percpu(se, super.reactor);
 	else {
 		struct fuse_loop_config config = {
 			.clone_fd = fuse_opts.clone_fd,
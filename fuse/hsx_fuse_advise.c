@@ -0,0 +1,348 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Prefetch asked by applications (HSFS_IOC_PREFETCH).
+ *
+ * fadvise() never reaches FUSE, so an application which knows what it
+ * will read next asks through an ioctl instead. Each ask is a job queued
+ * to a thread of its own, running at the lowest priority: it reads the
+ * range from the server an rsize at a time, and stores it into the kernel
+ * page cache as readahead does. One READ at a time, so the foreground
+ * traffic keeps the server. Jobs hold their inode (i_count) until done,
+ * and are cancelled between two READs.
+ *
+ * A job belongs to the uid which queued it: the others can neither see
+ * nor cancel it, but root. At most HSX_ADVISE_MAX_JOBS are queued.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "hsx_fuse.h"
+#include "hsi_nfs3.h"
+#include "hsfs_buf.h"
+#include "hsfs_ioctl.h"
+
+#define HSX_ADVISE_MAX_JOBS	1024
+
+struct hsx_advise_job {
+	struct hsx_advise_job *next;
+	uint64_t id;
+	uid_t uid;		/* Who queued it */
+	struct hsfs_inode *inode;
+	off_t off;		/* Next to read */
+	off_t end;
+	uint64_t done;
+	uint64_t total;
+	int cancel;
+};
+
+struct hsx_advise {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct hsx_advise_job *head, **tail;	/* head is the one running */
+	unsigned int jobs;
+	uint64_t next_id;
+	uint64_t done;		/* Of all jobs since mount */
+	int stop;
+	pthread_t thread;
+};
+
+/* May uid see and cancel the job? */
+static int hsx_advise_mine(struct hsx_advise_job *job, uid_t uid)
+{
+	return uid == 0 || job->uid == uid;
+}
+
+/* Called with adv->lock held, job is off the queue: freed. */
+static void hsx_advise_end(struct hsx_advise *adv, struct hsx_advise_job *job)
+{
+	adv->jobs--;
+	DEBUG("Prefetch %llu of ino %lu %s, %llu of %llu bytes.",
+	      (unsigned long long)job->id, job->inode->ino,
+	      job->cancel ? "cancelled" : "done",
+	      (unsigned long long)job->done, (unsigned long long)job->total);
+	hsfs_iput(job->inode);
+	free(job);
+}
+
+/* Returns with the job done or cancelled. */
+static void hsx_advise_run(struct hsfs_super *sb, struct hsx_advise *adv,
+			   struct hsx_advise_job *job, char *buf)
+{
+	struct hsfs_rw_info rinfo;
+	size_t len;
+
+	memset(&rinfo, 0, sizeof(rinfo));
+	rinfo.inode = job->inode;
+	while (job->off < job->end) {
+		if (job->cancel || adv->stop)
+			break;
+		len = min((size_t)(job->end - job->off), (size_t)sb->rsize);
+		rinfo.rw_off = job->off;
+		rinfo.rw_size = len;
+		rinfo.data.data_val = buf;
+		rinfo.data.data_len = len;
+		if (hsi_nfs3_read(&rinfo) || !rinfo.ret_count)
+			break;
+		if (hsx_fuse_notify_store(sb, job->inode, job->off, buf,
+					  rinfo.ret_count))
+			break;
+
+		pthread_mutex_lock(&adv->lock);
+		job->off += rinfo.ret_count;
+		job->done += rinfo.ret_count;
+		adv->done += rinfo.ret_count;
+		pthread_mutex_unlock(&adv->lock);
+		if (rinfo.eof)
+			break;
+	}
+}
+
+static void *hsx_advise_thread(void *arg)
+{
+	struct hsfs_super *sb = arg;
+	struct hsx_advise *adv = sb->advise;
+	struct hsx_advise_job *job;
+	char *buf;
+
+	/* Behind everything else on this host. */
+	if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19))
+		WARNING("Failed to lower the priority of prefetch: %d.", errno);
+	buf = hsfs_buf_get(sb->rsize);
+	if (buf == NULL)
+		ERR("No buffer to prefetch into, prefetch disabled.");
+
+	pthread_mutex_lock(&adv->lock);
+	for (;;) {
+		while (!adv->stop && adv->head == NULL)
+			pthread_cond_wait(&adv->cond, &adv->lock);
+		if (adv->stop)
+			break;
+		job = adv->head;
+		pthread_mutex_unlock(&adv->lock);
+
+		if (buf)
+			hsx_advise_run(sb, adv, job, buf);
+
+		pthread_mutex_lock(&adv->lock);
+		adv->head = job->next;
+		if (adv->head == NULL)
+			adv->tail = &adv->head;
+		hsx_advise_end(adv, job);
+	}
+	pthread_mutex_unlock(&adv->lock);
+	hsfs_buf_put(buf, sb->rsize);
+
+	return NULL;
+}
+
+int hsx_fuse_advise_init(struct hsfs_super *sb)
+{
+	struct hsx_advise *adv;
+	int err;
+
+	adv = calloc(1, sizeof(*adv));
+	if (adv == NULL)
+		return ENOMEM;
+	pthread_mutex_init(&adv->lock, NULL);
+	pthread_cond_init(&adv->cond, NULL);
+	adv->tail = &adv->head;
+	adv->next_id = 1;
+	sb->advise = adv;
+
+	err = pthread_create(&adv->thread, NULL, hsx_advise_thread, sb);
+	if (err) {
+		sb->advise = NULL;
+		pthread_cond_destroy(&adv->cond);
+		pthread_mutex_destroy(&adv->lock);
+		free(adv);
+	}
+
+	return err;
+}
+
+void hsx_fuse_advise_fini(struct hsfs_super *sb)
+{
+	struct hsx_advise *adv = sb->advise;
+	struct hsx_advise_job *job;
+
+	if (adv == NULL)
+		return;
+
+	pthread_mutex_lock(&adv->lock);
+	adv->stop = 1;
+	pthread_cond_signal(&adv->cond);
+	pthread_mutex_unlock(&adv->lock);
+	pthread_join(adv->thread, NULL);
+	sb->advise = NULL;
+
+	INFO("%llu bytes prefetched on demand.",
+	     (unsigned long long)adv->done);
+	while ((job = adv->head)) {
+		adv->head = job->next;
+		job->cancel = 1;
+		hsx_advise_end(adv, job);
+	}
+	pthread_cond_destroy(&adv->cond);
+	pthread_mutex_destroy(&adv->lock);
+	free(adv);
+}
+
+int hsx_fuse_advise_prefetch(struct hsfs_super *sb, struct hsfs_inode *inode,
+			     uid_t uid, struct hsfs_prefetch_args *args)
+{
+	struct hsx_advise *adv = sb->advise;
+	struct hsx_advise_job *job;
+	struct stat st;
+	off_t end;
+	int err;
+
+	if (adv == NULL)
+		return ENOTSUP;
+	if (!S_ISREG(inode->i_mode))
+		return EINVAL;
+	if (args->off > (uint64_t)LLONG_MAX || args->len > (uint64_t)LLONG_MAX)
+		return EINVAL;
+
+	/* The kernel won't store pages past the size it knows. */
+	err = hsi_nfs3_getattr(inode, &st);
+	if (err)
+		return err;
+	end = st.st_size;
+	if (args->len && (off_t)args->len < end - (off_t)args->off)
+		end = args->off + args->len;
+	args->id = 0;
+	if ((off_t)args->off >= end)
+		return 0;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return ENOMEM;
+	job->inode = hsfs_iget(sb, inode->ino);
+	if (job->inode == NULL) {
+		free(job);
+		return ESTALE;
+	}
+	job->uid = uid;
+	job->off = args->off;
+	job->end = end;
+	job->total = end - args->off;
+
+	pthread_mutex_lock(&adv->lock);
+	if (adv->jobs >= HSX_ADVISE_MAX_JOBS) {
+		pthread_mutex_unlock(&adv->lock);
+		hsfs_iput(job->inode);
+		free(job);
+		return EAGAIN;
+	}
+	job->id = adv->next_id++;
+	*adv->tail = job;
+	adv->tail = &job->next;
+	adv->jobs++;
+	pthread_cond_signal(&adv->cond);
+	pthread_mutex_unlock(&adv->lock);
+
+	args->id = job->id;
+	DEBUG("Prefetch %llu of ino %lu [0x%llx, 0x%llx) queued.",
+	      (unsigned long long)job->id, inode->ino,
+	      (unsigned long long)args->off, (unsigned long long)end);
+
+	return 0;
+}
+
+int hsx_fuse_advise_status(struct hsfs_super *sb, uid_t uid,
+			   struct hsfs_prefetch_status *status)
+{
+	struct hsx_advise *adv = sb->advise;
+	struct hsx_advise_job *job;
+	int err = status->id ? ENOENT : 0;
+
+	if (adv == NULL)
+		return ENOTSUP;
+
+	status->jobs = 0;
+	status->done = 0;
+	status->total = 0;
+	pthread_mutex_lock(&adv->lock);
+	for (job = adv->head; job; job = job->next) {
+		if (status->id && job->id != status->id)
+			continue;
+		if (!hsx_advise_mine(job, uid)) {
+			if (status->id)
+				err = EPERM;
+			continue;
+		}
+		status->jobs++;
+		status->done += job->done;
+		status->total += job->total;
+		err = 0;
+	}
+	pthread_mutex_unlock(&adv->lock);
+
+	return err;
+}
+
+int hsx_fuse_advise_cancel(struct hsfs_super *sb, uid_t uid, uint64_t id)
+{
+	struct hsx_advise *adv = sb->advise;
+	struct hsx_advise_job *job, **pp;
+	int err = id ? ENOENT : 0;
+
+	if (adv == NULL)
+		return ENOTSUP;
+
+	pthread_mutex_lock(&adv->lock);
+	/* The one running is left to the thread, it sees the flag. */
+	job = adv->head;
+	if (job && (!id || job->id == id)) {
+		if (hsx_advise_mine(job, uid)) {
+			job->cancel = 1;
+			err = 0;
+		} else if (id) {
+			err = EPERM;
+		}
+	}
+	for (pp = adv->head ? &adv->head->next : &adv->head; (job = *pp);) {
+		if (id && job->id != id) {
+			pp = &job->next;
+			continue;
+		}
+		if (!hsx_advise_mine(job, uid)) {
+			if (id)
+				err = EPERM;
+			pp = &job->next;
+			continue;
+		}
+		*pp = job->next;
+		if (adv->tail == &job->next)
+			adv->tail = pp;
+		job->cancel = 1;
+		hsx_advise_end(adv, job);
+		err = 0;
+	}
+	pthread_mutex_unlock(&adv->lock);
+
+	return err;
+}
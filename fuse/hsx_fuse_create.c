@@ -36,6 +36,7 @@ void hsx_fuse_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 		goto out;
 	}
 
+	hsfs_dir_lock(hi);
 	hi->i_uid = fc->uid;
 	hi->i_gid = fc->gid;
 	mymode = (mode & S_IRWXO) | ((mode & S_IRWXG)) 
@@ -49,7 +50,10 @@ void hsx_fuse_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 	}
 
 	err = hsi_nfs3_create(hi, &newhi, name, mymode);
+	hsfs_dir_unlock(hi);
 	if (err) {
+		/* Created, but its exclusive mode could not be set. */
+		hsfs_iput(newhi);
 		fuse_reply_err(req, err);
 		goto out;
 	}
@@ -63,8 +67,12 @@ void hsx_fuse_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 	ref = hsx_fuse_ref_xchg(newhi, 1);
 	FUSE_ASSERT(ref == 0);	/* Should be a new one... */
 
+	hsfs_iname(newhi, hi, name);
 	hsx_fuse_fill_reply(newhi, &e);
+	/* Not fatal: a file without state just won't be prefetched. */
+	fi->fh = (uintptr_t)hsx_fuse_file_alloc();
 	fuse_reply_create(req, &e, fi);
+	hsfs_iput(newhi);
 
 out:
 	DEBUG_OUT("Out of hsx_fuse_create, With ERRNO = %d", err);
@@ -18,8 +18,8 @@ void hsx_fuse_fill_reply (struct hsfs_inode *inode, struct fuse_entry_param *e)
 
 	e->ino = inode->ino;
 	e->generation = 0;
-	e->attr_timeout = inode->sb->acdirmin;
-	e->entry_timeout = inode->sb->acregmin;
+	e->attr_timeout = hsx_fuse_attr_timeout(inode);
+	e->entry_timeout = hsx_fuse_entry_timeout(inode->sb);
 	
 	DEBUG("FUSE Entry INO(%lu), Attr_Timeo(%f), Entry_Timeo(%f)",
 	      e->ino, e->attr_timeout, e->entry_timeout);
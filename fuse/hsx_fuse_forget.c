@@ -33,11 +33,29 @@ void hsx_fuse_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
 	hsfs_node = hsfs_ilookup(sb, ino);
 	assert(hsfs_node != NULL);
 
-	ilookup = hsx_fuse_ref_dec(hsfs_node, nlookup);
-
-	if(!ilookup)
-		hsfs_iput(hsfs_node);
+	ilookup = hsfs_iforget(hsfs_node, nlookup);
 
 	DEBUG_OUT("rest lookup %lu", ilookup);
 	fuse_reply_none(req);
 }
+
+void hsx_fuse_forget_multi(fuse_req_t req, size_t count,
+			   struct fuse_forget_data *forgets)
+{
+	struct hsfs_super *sb = fuse_req_userdata(req);
+	struct hsfs_inode *inode;
+	size_t i;
+
+	DEBUG_IN("(%p, %zu)", req, count);
+	for (i = 0; i < count; i++) {
+		inode = hsfs_ilookup(sb, forgets[i].ino);
+		if (inode == NULL) {
+			WARNING("Forget of unknown ino %lu.",
+				(unsigned long)forgets[i].ino);
+			continue;
+		}
+		hsfs_iforget(inode, forgets[i].nlookup);
+	}
+	DEBUG_OUT("(%zu)", count);
+	fuse_reply_none(req);
+}
@@ -25,6 +25,10 @@ void hsx_fuse_getattr(fuse_req_t req, fuse_ino_t ino,
 		ERR("ino :%lu is invalid.\n", ino);
 		goto out;
 	}
+	if (hsx_fuse_reactor_getattr(req, inode)) {
+		DEBUG_OUT("ino : %lu, continued by the reactor.\n", ino);
+		return;
+	}
 	memset(&st, 0, sizeof(st));
 	err = hsi_nfs3_getattr(inode, &st);
 	if(err)
@@ -34,7 +38,7 @@ void hsx_fuse_getattr(fuse_req_t req, fuse_ino_t ino,
 	if (err)
 		fuse_reply_err(req, err);
 	else {
-		to = S_ISDIR(inode->i_mode) ? sb->acdirmin : sb->acregmin;
+		to = hsx_fuse_attr_timeout(inode);
 		fuse_reply_attr(req, &st, to);
 	}
 }
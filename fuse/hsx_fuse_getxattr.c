@@ -2,6 +2,7 @@
 #include "hsi_nfs3.h"
 #include "hsx_fuse.h"
 #include "acl.h"
+#include "hsfs_arena.h"
 void hsx_fuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
 {
 	struct hsfs_inode *hsfs_node;
@@ -9,10 +10,12 @@ void hsx_fuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t
 	int mask = 0;
 	struct posix_acl *acl = NULL;
 	char *buf = NULL;
+	struct hsfs_arena_mark mark;
 
 	int  type,real_size = 0,err = 0;
 
 	DEBUG_IN("The inode number : ino = %lu,name : %s",ino,name);
+	hsfs_arena_mark(&mark);
 	if (strcmp(name, POSIX_ACL_XATTR_ACCESS) == 0)
 		type = ACL_TYPE_ACCESS;
 	else if (strcmp(name, POSIX_ACL_XATTR_DEFAULT) == 0)
@@ -43,7 +46,7 @@ void hsx_fuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t
 		goto out ;
 	}
 		
-	buf = (char *)calloc(1,size);
+	buf = size ? hsfs_arena_alloc(size) : NULL;
 	if(buf == NULL && size)
 	{
 		err = ENOMEM;	
@@ -64,21 +67,19 @@ void hsx_fuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t
 	if(real_size == ERANGE)
 	{
 		err = ERANGE;
-		free(buf);
 		free(acl);
-		buf = NULL;
 		acl = NULL;
 		goto out;
 	}
 	fuse_reply_buf(req,buf,real_size);
-	free(buf);
 	free(acl);
-	buf = NULL;
 	acl = NULL;
+	hsfs_arena_release(&mark);
 	DEBUG_OUT("%s","success exit");
 	return ;
 
 out :
 	fuse_reply_err(req,err);
+	hsfs_arena_release(&mark);
 	DEBUG_OUT("failed,with errno %d",err);
 }
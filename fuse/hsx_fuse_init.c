@@ -45,6 +45,28 @@ static void hsx_fuse_init_cap(struct hsfs_super *sb, struct fuse_conn_info *conn
 #ifdef FUSE_CAP_READDIR_PLUS
 	CHECK_CAP(FUSE_CAP_READDIR_PLUS);
 #endif
+#ifdef FUSE_CAP_PARALLEL_DIROPS
+	/* Lookups in a directory need not queue, see hsfs_dir_lock(). */
+	CHECK_CAP(FUSE_CAP_PARALLEL_DIROPS);
+#endif
+#ifdef FUSE_CAP_IOCTL_DIR
+	/* HSFS_IOC_BSTAT is issued on directories. */
+	CHECK_CAP(FUSE_CAP_IOCTL_DIR);
+#endif
+#ifdef FUSE_CAP_SPLICE_READ
+	/*
+	 * Request and reply data go through pipes. Replies are still copied
+	 * into the pipe from our buffers, SPLICE_MOVE doesn't take them.
+	 */
+	if (sb->splice) {
+		CHECK_CAP(FUSE_CAP_SPLICE_WRITE);
+		CHECK_CAP(FUSE_CAP_SPLICE_MOVE);
+		CHECK_CAP(FUSE_CAP_SPLICE_READ);
+	} else {
+		/* Offered for write_buf, a plain read is as good without it. */
+		conn->want &= ~FUSE_CAP_SPLICE_READ;
+	}
+#endif
 	
 	len = strlen(unsupported);
 	if (len){
@@ -77,6 +99,36 @@ void hsx_fuse_init(void *userdata, struct fuse_conn_info *conn)
 	FUSE_ASSERT(ref == 0);
 
 	hsx_fuse_init_cap(sb, conn);
+	if (hsx_fuse_tenant_init(sb))
+		WARNING("No memory for tenant rate limits, running without.");
+	if (hsx_fuse_notify_init(sb))
+		WARNING("Failed to start the notifier, the kernel will cache "
+			"no listings and kcache is ignored.");
+	else
+		sb->changed = hsx_fuse_changed;
+	if (hsx_fuse_ra_init(sb)) {
+		WARNING("Failed to start the readahead threads, "
+			"readahead disabled.");
+		sb->readahead = 0;
+	}
+	if (hsx_fuse_advise_init(sb))
+		WARNING("Failed to start the prefetch thread, "
+			"HSFS_IOC_PREFETCH disabled.");
 
 	DEBUG_OUT("Success conn at %p", conn);
 }
+
+void hsx_fuse_destroy(void *userdata)
+{
+	struct hsfs_super *sb = (struct hsfs_super *)userdata;
+
+	DEBUG_IN("SB(%p)", sb);
+
+	hsx_fuse_advise_fini(sb);
+	hsx_fuse_ra_fini(sb);
+	sb->changed = NULL;
+	hsx_fuse_notify_fini(sb);
+	hsx_fuse_tenant_fini(sb);
+
+	DEBUG_OUT("SB(%p)", sb);
+}
@@ -0,0 +1,351 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ioctls on the files and directories of the mount, see hsfs_ioctl.h.
+ *
+ * HSFS_IOC_BSTAT looks a batch of names up with LOOKUPs issued from
+ * HSX_BSTAT_THREADS threads at once, pipelined over the transport, and
+ * stats them from the attributes the LOOKUPs return: one round trip per
+ * path component instead of a LOOKUP and a GETATTR, each behind its own
+ * system call. The inodes it looks up are not known to the kernel, it
+ * only references them (i_count) while it uses them.
+ *
+ * The LOOKUPs go out with the daemon's credentials, so the caller's
+ * search permission is checked here, on every directory of the path, as
+ * the kernel would have. The credentials of the transports are shared
+ * by all requests, an ACCESS of the caller can't be sent on them. The
+ * mode bits are the ones cached or just returned by the LOOKUP. A parent
+ * handle is only taken when the names it was looked up by lead back to
+ * the directory of the ioctl, through directories the caller may search
+ * as well: one that bstat or a lookup of the caller resolved from there.
+ *
+ * The HSFS_IOC_PREFETCH ones are served in hsx_fuse_advise.c.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hsx_fuse.h"
+#include "hsi_nfs3.h"
+#include "hsfs_ioctl.h"
+
+#define HSX_BSTAT_THREADS	16
+/* Supplementary groups of the caller we look at */
+#define HSX_BSTAT_GROUPS	256
+/* Directories between a parent handle and the ioctl one, at most */
+#define HSX_BSTAT_DEPTH		(PATH_MAX / 2)
+
+struct hsx_bstat {
+	struct hsfs_super *sb;
+	struct hsfs_inode *dir;
+	uid_t uid;
+	gid_t gid;
+	int ngroups;
+	gid_t groups[HSX_BSTAT_GROUPS];
+	const uint64_t *parent;
+	const char *name[HSFS_BSTAT_MAX];
+	unsigned int count;
+	unsigned int next;	/* Name to take, atomically */
+	struct hsfs_bstat out[HSFS_BSTAT_MAX];
+};
+
+/* May the caller look names up in dir? */
+static int hsx_bstat_search(struct hsx_bstat *bs, struct hsfs_inode *dir)
+{
+	mode_t mode = dir->i_mode;
+	int i;
+
+	if (!S_ISDIR(mode))
+		return ENOTDIR;
+	if (bs->uid == 0)
+		return mode & (S_IXUSR | S_IXGRP | S_IXOTH) ? 0 : EACCES;
+	if (bs->uid == dir->i_uid)
+		return mode & S_IXUSR ? 0 : EACCES;
+	if (bs->gid == dir->i_gid)
+		return mode & S_IXGRP ? 0 : EACCES;
+	for (i = 0; i < bs->ngroups; i++)
+		if (bs->groups[i] == dir->i_gid)
+			return mode & S_IXGRP ? 0 : EACCES;
+
+	return mode & S_IXOTH ? 0 : EACCES;
+}
+
+/*
+ * Referenced, the kernel may have forgotten the handle we were given.
+ * Only a descendant of the ioctl directory the caller may reach.
+ */
+static int hsx_bstat_get(struct hsx_bstat *bs, uint64_t ino,
+			 struct hsfs_inode **inode)
+{
+	struct hsfs_inode *up;
+	unsigned int depth;
+	int err = 0;
+
+	*inode = hsfs_iget(bs->sb, ino ? ino : bs->dir->ino);
+	if (*inode == NULL)
+		return ESTALE;
+
+	up = hsfs_iget(bs->sb, (*inode)->ino);
+	for (depth = 0; up && up->ino != bs->dir->ino; depth++) {
+		ino = hsfs_iparent(up);
+		hsfs_iput(up);
+		up = NULL;
+		if (ino == 0 || depth == HSX_BSTAT_DEPTH) {
+			err = EPERM;
+			break;
+		}
+		up = hsfs_iget(bs->sb, ino);
+		if (up == NULL) {
+			err = EPERM;
+			break;
+		}
+		err = hsx_bstat_search(bs, up);
+		if (err)
+			break;
+	}
+	hsfs_iput(up);
+	if (err) {
+		hsfs_iput(*inode);
+		*inode = NULL;
+	}
+
+	return err;
+}
+
+static void hsx_bstat_put(struct hsfs_inode *inode)
+{
+	hsfs_iput(inode);
+}
+
+static int hsx_bstat_one(struct hsx_bstat *bs, unsigned int i)
+{
+	struct hsfs_bstat *out = &bs->out[i];
+	struct hsfs_inode *parent, *child = NULL;
+	char path[PATH_MAX], *comp, *save;
+	struct stat st;
+	int err = 0;
+
+	if (strlen(bs->name[i]) >= sizeof(path))
+		return ENAMETOOLONG;
+	strcpy(path, bs->name[i]);
+
+	err = hsx_bstat_get(bs, bs->parent[i], &parent);
+	if (err)
+		return err;
+	for (comp = strtok_r(path, "/", &save); comp;
+	     comp = strtok_r(NULL, "/", &save)) {
+		if (!strcmp(comp, "."))
+			continue;
+		/* Would leave the tree the handles are checked against. */
+		if (!strcmp(comp, "..")) {
+			err = EINVAL;
+			goto out;
+		}
+		err = hsx_bstat_search(bs, parent);
+		if (err)
+			goto out;
+		hsfs_dir_lock_shared(parent);
+		err = hsi_nfs3_lookup(parent, &child, comp);
+		hsfs_dir_unlock(parent);
+		if (!err && IS_ERR(child))
+			err = -PTR_ERR(child);
+		else if (!err && child == NULL)
+			err = ENOMEM;
+		if (err)
+			goto out;
+		/* Its handle may be passed back as a parent. */
+		hsfs_iname(child, parent, comp);
+		hsx_bstat_put(parent);
+		parent = child;
+	}
+
+	hsfs_generic_fillattr(parent, &st);
+	out->mode = st.st_mode;
+	out->handle = parent->ino;
+	out->ino = st.st_ino;
+	out->size = st.st_size;
+	out->blocks = st.st_blocks;
+	out->nlink = st.st_nlink;
+	out->uid = st.st_uid;
+	out->gid = st.st_gid;
+	out->blksize = st.st_blksize;
+	out->rdev = st.st_rdev;
+	out->atime = parent->i_atime.tv_sec;
+	out->atime_ns = parent->i_atime.tv_nsec;
+	out->mtime = parent->i_mtime.tv_sec;
+	out->mtime_ns = parent->i_mtime.tv_nsec;
+	out->ctime = parent->i_ctime.tv_sec;
+	out->ctime_ns = parent->i_ctime.tv_nsec;
+out:
+	hsx_bstat_put(parent);
+
+	return err;
+}
+
+static void *hsx_bstat_worker(void *arg)
+{
+	struct hsx_bstat *bs = arg;
+	unsigned int i;
+
+	while ((i = __sync_fetch_and_add(&bs->next, 1)) < bs->count)
+		bs->out[i].err = hsx_bstat_one(bs, i);
+
+	return NULL;
+}
+
+static int hsx_fuse_bstat(fuse_req_t req, struct hsfs_super *sb,
+			  struct hsfs_inode *dir, struct hsfs_bstat_args *args)
+{
+	const struct fuse_ctx *ctx = fuse_req_ctx(req);
+	pthread_t thread[HSX_BSTAT_THREADS];
+	struct hsx_bstat *bs;
+	const char *name, *end;
+	int i, n;
+
+	if (args->flags || args->count > HSFS_BSTAT_MAX)
+		return EINVAL;
+	bs = calloc(1, sizeof(*bs));
+	if (bs == NULL)
+		return ENOMEM;
+	bs->sb = sb;
+	bs->dir = dir;
+	bs->uid = ctx->uid;
+	bs->gid = ctx->gid;
+	/* Unknown groups only deny, past the ones we keep as well. */
+	n = fuse_req_getgroups(req, HSX_BSTAT_GROUPS, bs->groups);
+	bs->ngroups = n < 0 ? 0 : min(n, HSX_BSTAT_GROUPS);
+	bs->parent = args->u.in.parent;
+	bs->count = args->count;
+
+	name = args->u.in.names;
+	end = name + sizeof(args->u.in.names);
+	for (i = 0; i < (int)args->count; i++) {
+		bs->name[i] = name;
+		name = memchr(name, '\0', end - name);
+		if (name == NULL) {
+			free(bs);
+			return EINVAL;
+		}
+		name++;
+	}
+
+	/* This thread takes its share too. */
+	n = min(bs->count, HSX_BSTAT_THREADS) - 1;
+	for (i = 0; i < n; i++)
+		if (pthread_create(&thread[i], NULL, hsx_bstat_worker, bs))
+			break;
+	n = i;
+	hsx_bstat_worker(bs);
+	for (i = 0; i < n; i++)
+		pthread_join(thread[i], NULL);
+
+	/* The names are gone past this point, they share the buffer. */
+	memcpy(args->u.out, bs->out, bs->count * sizeof(bs->out[0]));
+	free(bs);
+
+	return 0;
+}
+
+void hsx_fuse_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
+		    struct fuse_file_info *fi, unsigned flags,
+		    const void *in_buf, size_t in_bufsz, size_t out_bufsz)
+{
+	struct hsfs_super *sb = fuse_req_userdata(req);
+	struct hsfs_bstat_args *args = NULL;
+	struct hsfs_prefetch_args pargs;
+	struct hsfs_prefetch_status status;
+	struct hsfs_inode *inode;
+	int err = 0;
+
+	DEBUG_IN("(%lu, 0x%x, %zu, %zu)", ino, (unsigned int)cmd, in_bufsz,
+		 out_bufsz);
+	(void)arg;
+	(void)fi;
+
+	inode = hsfs_ilookup(sb, ino);
+	if (inode == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	switch ((unsigned int)cmd) {
+	case HSFS_IOC_BSTAT:
+		if (!(flags & FUSE_IOCTL_DIR) || !S_ISDIR(inode->i_mode)) {
+			err = ENOTDIR;
+			break;
+		}
+		if (in_bufsz != sizeof(*args) || out_bufsz != sizeof(*args)) {
+			err = EINVAL;
+			break;
+		}
+		args = malloc(sizeof(*args));
+		if (args == NULL) {
+			err = ENOMEM;
+			break;
+		}
+		memcpy(args, in_buf, sizeof(*args));
+		err = hsx_fuse_bstat(req, sb, inode, args);
+		if (!err)
+			fuse_reply_ioctl(req, 0, args, sizeof(*args));
+		break;
+	case HSFS_IOC_PREFETCH:
+		if (in_bufsz != sizeof(pargs) || out_bufsz != sizeof(pargs)) {
+			err = EINVAL;
+			break;
+		}
+		memcpy(&pargs, in_buf, sizeof(pargs));
+		err = hsx_fuse_advise_prefetch(sb, inode, fuse_req_ctx(req)->uid,
+					       &pargs);
+		if (!err)
+			fuse_reply_ioctl(req, 0, &pargs, sizeof(pargs));
+		break;
+	case HSFS_IOC_PREFETCH_STATUS:
+		if (in_bufsz != sizeof(status) || out_bufsz != sizeof(status)) {
+			err = EINVAL;
+			break;
+		}
+		memcpy(&status, in_buf, sizeof(status));
+		err = hsx_fuse_advise_status(sb, fuse_req_ctx(req)->uid,
+					     &status);
+		if (!err)
+			fuse_reply_ioctl(req, 0, &status, sizeof(status));
+		break;
+	case HSFS_IOC_PREFETCH_CANCEL:
+		if (in_bufsz != sizeof(uint64_t)) {
+			err = EINVAL;
+			break;
+		}
+		err = hsx_fuse_advise_cancel(sb, fuse_req_ctx(req)->uid,
+					     *(const uint64_t *)in_buf);
+		if (!err)
+			fuse_reply_ioctl(req, 0, NULL, 0);
+		break;
+	default:
+		err = ENOTTY;
+		break;
+	}
+
+out:
+	if (err)
+		fuse_reply_err(req, err);
+	free(args);
+	DEBUG_OUT("with %d", err);
+}
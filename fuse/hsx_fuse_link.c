@@ -9,7 +9,7 @@ hsx_fuse_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
 {
 	DEBUG_IN("name to link %s",newname);
 	int err=0;
-	struct fuse_entry_param *e=NULL;
+	struct fuse_entry_param e;
 	// to get the super block
 	struct hsfs_super *hsfs_sb=fuse_req_userdata(req);
 	
@@ -27,22 +27,15 @@ hsx_fuse_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
 		goto out;
 	}
 
+	hsfs_dir_lock(parent);
 	err= hsi_nfs3_link(inop, parent, newname);
+	hsfs_dir_unlock(parent);
 
 	if(!err){
-		e=(struct fuse_entry_param *)malloc(sizeof(struct 
-                                               fuse_entry_param));
-		if(!e){
-			err=ENOMEM;
-			fuse_reply_err(req,err);
-			goto out;
-		}
-		else{
-			hsx_fuse_fill_reply(inop,e);
-			fuse_reply_entry(req, e);
-			free(e);
-			goto out;
-		}
+		hsfs_iname(inop, parent, newname);
+		hsx_fuse_fill_reply(inop,&e);
+		fuse_reply_entry(req, &e);
+		goto out;
 	}
 	else
 		fuse_reply_err(req,err);
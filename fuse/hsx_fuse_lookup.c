@@ -19,7 +19,9 @@ void  hsx_fuse_lookup(fuse_req_t req, fuse_ino_t ino, const char *name)
 		goto out;
 	}
 
+	hsfs_dir_lock_shared(parent);
 	err = hsi_nfs3_lookup(parent,&child,name);
+	hsfs_dir_unlock(parent);
 
 	if (err)
 		goto out;
@@ -29,10 +31,12 @@ void  hsx_fuse_lookup(fuse_req_t req, fuse_ino_t ino, const char *name)
 	}
 
 	hsx_fuse_ref_inc(child, 1);
+	hsfs_iname(child, parent, name);
 	hsx_fuse_fill_reply(child, &e);
 
 	fuse_reply_entry(req, &e);
 	DEBUG_OUT("with new Inode(%p:%lu)", child, child->ino);
+	hsfs_iput(child);
 	return ;
 out:
 	fuse_reply_err(req,err);
@@ -0,0 +1,176 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Session loop with one worker bound to each CPU.
+ *
+ * libfuse's multi-threaded loop starts and stops workers as the load
+ * goes and lets the scheduler move them around, so a request is often
+ * received on one CPU and answered from another, and the per-thread
+ * caches (I/O buffers, arenas) follow the thread across NUMA nodes. Here
+ * each CPU the process may run on gets a worker bound to it for the life
+ * of the mount: a request stays on the CPU which received it, the
+ * buffers of the worker come from the depot of its node, and its NFS
+ * calls prefer the transport of its CPU.
+ *
+ * The workers read the session's /dev/fuse fd: a cloned fd per worker
+ * would need libfuse's private channel API to send the replies through.
+ * They block in each request, or run as reactors (hsx_fuse_reactor.c).
+ * The pool does not grow: blocking workers wait on the server for at most
+ * as many requests as there are CPUs, however many the kernel has queued.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdlib.h>
+
+#include "hsx_fuse.h"
+#include "hsi_nfs3.h"
+
+struct hsx_loop_worker {
+	pthread_t thread;
+	int cpu;
+	struct hsx_loop *loop;
+};
+
+struct hsx_loop {
+	struct fuse_session *se;
+	sem_t finish;
+	int reactor;
+	int err;
+	int nworkers;
+	struct hsx_loop_worker worker[];
+};
+
+/* The worker may be cancelled while waiting in fuse_session_receive_buf(). */
+static void hsx_loop_free_buf(void *arg)
+{
+	struct fuse_buf *fbuf = arg;
+
+	free(fbuf->mem);
+}
+
+static void *hsx_loop_worker(void *arg)
+{
+	struct hsx_loop_worker *w = arg;
+	struct hsx_loop *loop = w->loop;
+	struct fuse_buf fbuf = { .mem = NULL, };
+	int res;
+
+	hsi_nfs3_conn_home(w->cpu);
+	if (loop->reactor) {
+		res = hsx_fuse_reactor_serve(loop->se);
+		if (res)
+			loop->err = res;
+		goto out;
+	}
+	pthread_cleanup_push(hsx_loop_free_buf, &fbuf);
+	while (!fuse_session_exited(loop->se)) {
+		res = fuse_session_receive_buf(loop->se, &fbuf);
+		if (res == -EINTR)
+			continue;
+		if (res <= 0) {
+			if (res < 0) {
+				loop->err = -res;
+				fuse_session_exit(loop->se);
+			}
+			break;
+		}
+		/* A request is finished once started, see hsx_fuse_loop_percpu(). */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		fuse_session_process_buf(loop->se, &fbuf);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+	}
+	pthread_cleanup_pop(1);
+out:
+	/* The first worker to leave means the session is over. */
+	fuse_session_exit(loop->se);
+	sem_post(&loop->finish);
+
+	return NULL;
+}
+
+int hsx_fuse_loop_percpu(struct fuse_session *se, int reactor)
+{
+	struct hsx_loop *loop;
+	pthread_attr_t attr;
+	cpu_set_t allowed, one;
+	sigset_t all, saved;
+	int cpu, i, n, err = 0;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return errno;
+	n = CPU_COUNT(&allowed);
+
+	loop = calloc(1, sizeof(*loop) + n * sizeof(loop->worker[0]));
+	if (loop == NULL)
+		return ENOMEM;
+	loop->se = se;
+	loop->reactor = reactor;
+	sem_init(&loop->finish, 0, 0);
+
+	/*
+	 * Like libfuse, leave the signals to this thread: the handlers set by
+	 * fuse_set_signal_handlers() exit the session and interrupt the wait
+	 * below, while the workers are still blocked reading /dev/fuse.
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &saved);
+	pthread_attr_init(&attr);
+	for (cpu = 0, i = 0; cpu < CPU_SETSIZE && i < n; cpu++) {
+		struct hsx_loop_worker *w = &loop->worker[i];
+
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		/* Bound before it runs, so its caches are set up there. */
+		CPU_ZERO(&one);
+		CPU_SET(cpu, &one);
+		pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+		w->cpu = cpu;
+		w->loop = loop;
+		err = pthread_create(&w->thread, &attr, hsx_loop_worker, w);
+		if (err) {
+			ERR("Failed to start the worker of CPU %d: %d.", cpu, err);
+			fuse_session_exit(se);
+			break;
+		}
+		i++;
+	}
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	loop->nworkers = i;
+	INFO("Serving requests with %d %s bound to CPUs.", i,
+	     reactor ? "reactors" : "workers");
+
+	while (!fuse_session_exited(se))
+		sem_wait(&loop->finish);
+	for (i = 0; i < loop->nworkers; i++)
+		pthread_cancel(loop->worker[i].thread);
+	for (i = 0; i < loop->nworkers; i++)
+		pthread_join(loop->worker[i].thread, NULL);
+
+	if (!err)
+		err = loop->err;
+	fuse_session_reset(se);
+	sem_destroy(&loop->finish);
+	free(loop);
+
+	return err;
+}
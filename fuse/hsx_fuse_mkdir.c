@@ -31,7 +31,9 @@ void hsx_fuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
 	}
 
 	
+	hsfs_dir_lock(hi_parent);
 	err = hsi_nfs3_mkdir(hi_parent, &new, dirname, mode);
+	hsfs_dir_unlock(hi_parent);
 	if(0 != err ) {
 		fuse_reply_err(req, err);
 		goto out;
@@ -46,8 +48,10 @@ void hsx_fuse_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
 	ref = hsx_fuse_ref_xchg(new, 1);
 	FUSE_ASSERT(ref == 0);	/* Should be a new one... */
 	
+	hsfs_iname(new, hi_parent, dirname);
 	hsx_fuse_fill_reply(new, &e);
 	fuse_reply_entry(req, &e);
+	hsfs_iput(new);
 out:
 	DEBUG_OUT(" out errno is: %d\n", err);
 	return;
@@ -21,7 +21,9 @@ hsx_fuse_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
 		goto out;	
 	}
 	struct hsfs_inode *newinode=NULL;
+	hsfs_dir_lock(parentp);
 	err=hsi_nfs3_mknod(parentp,&newinode,name,mode,rdev);
+	hsfs_dir_unlock(parentp);
 
 	if (err)
 		goto out;
@@ -34,10 +36,12 @@ hsx_fuse_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
 	ref = hsx_fuse_ref_xchg(newinode, 1);
 	FUSE_ASSERT(ref == 0);	/* Should be a new one... */
 
+	hsfs_iname(newinode, parentp, name);
 	hsx_fuse_fill_reply(newinode, &e);
 	fuse_reply_entry(req, &e);
 
 	DEBUG_OUT("New indoe at %p", newinode);
+	hsfs_iput(newinode);
 	return;
 
 out:
@@ -0,0 +1,265 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Kernel cache invalidations.
+ *
+ * Changes are mostly seen from within a request, where telling the kernel
+ * right away may deadlock: it may be waiting for that very request with
+ * the inode or directory locked. They are queued by inode number instead,
+ * and a thread of its own sends them.
+ *
+ * With kcache, the kernel keeps attributes and entries for that long and
+ * these notifications are what keeps it right: an inode whose attributes
+ * changed loses its attributes and pages, a changed directory the entries
+ * last looked up in it as well (see hsfs_iname()). A change made by
+ * another client is still only seen once this one asks the server.
+ * Changes made by our own calls are not notified: the kernel made them,
+ * and their wcc data tells them apart (see hsi_nfs3_wcc_update()).
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hsx_fuse.h"
+
+enum {
+	HSX_NOTIFY_INODE,	/* Attributes and data, or listing */
+	HSX_NOTIFY_ENTRY,	/* One name in a directory */
+	HSX_NOTIFY_CHILDREN,	/* Every name known in a directory */
+};
+
+struct hsx_notify_item {
+	struct hsx_notify_item *next;
+	int what;
+	fuse_ino_t ino;
+	char name[];
+};
+
+struct hsx_notify {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct hsx_notify_item *head, **tail;
+	int stop;
+	int nosys;		/* Kernel can't be told */
+	pthread_t thread;
+	unsigned long sent;
+};
+
+static struct hsx_notify_item *hsx_notify_item(int what, fuse_ino_t ino,
+					       const char *name)
+{
+	struct hsx_notify_item *n;
+	size_t len = name ? strlen(name) + 1 : 0;
+
+	n = malloc(sizeof(*n) + len);
+	if (n == NULL)
+		return NULL;
+	n->next = NULL;
+	n->what = what;
+	n->ino = ino;
+	if (name)
+		memcpy(n->name, name, len);
+
+	return n;
+}
+
+static void hsx_notify_queue(struct hsfs_super *sb, int what, fuse_ino_t ino,
+			     const char *name)
+{
+	struct hsx_notify *nt = sb->notify;
+	struct hsx_notify_item *n;
+
+	if (nt == NULL || nt->nosys)
+		return;
+	n = hsx_notify_item(what, ino, name);
+	if (n == NULL) {
+		WARNING("No memory to invalidate the kernel cache of %lu.",
+			(unsigned long)ino);
+		return;
+	}
+
+	pthread_mutex_lock(&nt->lock);
+	*nt->tail = n;
+	nt->tail = &n->next;
+	pthread_cond_signal(&nt->cond);
+	pthread_mutex_unlock(&nt->lock);
+}
+
+struct hsx_notify_children {
+	fuse_ino_t dir;
+	struct hsx_notify_item *list;
+};
+
+/* With the names locked: only collect. */
+static void hsx_notify_child(void *arg, const char *name)
+{
+	struct hsx_notify_children *c = arg;
+	struct hsx_notify_item *n;
+
+	n = hsx_notify_item(HSX_NOTIFY_ENTRY, c->dir, name);
+	if (n == NULL)
+		return;
+	n->next = c->list;
+	c->list = n;
+}
+
+static int hsx_notify_send(struct hsfs_super *sb, struct hsx_notify_item *n)
+{
+	struct hsx_notify_children c;
+	struct hsx_notify_item *e;
+	int err = 0;
+
+	switch (n->what) {
+	case HSX_NOTIFY_INODE:
+		err = fuse_lowlevel_notify_inval_inode(sb->se, n->ino, 0, 0);
+		break;
+	case HSX_NOTIFY_ENTRY:
+		err = fuse_lowlevel_notify_inval_entry(sb->se, n->ino, n->name,
+						       strlen(n->name));
+		break;
+	case HSX_NOTIFY_CHILDREN:
+		c.dir = n->ino;
+		c.list = NULL;
+		hsfs_ichildren(sb, n->ino, hsx_notify_child, &c);
+		while ((e = c.list)) {
+			c.list = e->next;
+			if (!err || err == -ENOENT)
+				err = hsx_notify_send(sb, e);
+			free(e);
+		}
+		break;
+	}
+	/* The kernel already forgot about it. */
+	if (err == -ENOENT)
+		err = 0;
+
+	return err;
+}
+
+static void *hsx_notify_thread(void *arg)
+{
+	struct hsfs_super *sb = arg;
+	struct hsx_notify *nt = sb->notify;
+	struct hsx_notify_item *n;
+	int err;
+
+	pthread_mutex_lock(&nt->lock);
+	for (;;) {
+		while (!nt->stop && nt->head == NULL)
+			pthread_cond_wait(&nt->cond, &nt->lock);
+		if (nt->stop)
+			break;
+		n = nt->head;
+		nt->head = n->next;
+		if (nt->head == NULL)
+			nt->tail = &nt->head;
+		pthread_mutex_unlock(&nt->lock);
+
+		err = hsx_notify_send(sb, n);
+		if (err == -ENOSYS && !nt->nosys) {
+			WARNING("Kernel doesn't support cache invalidations.");
+			nt->nosys = 1;
+		} else if (err) {
+			DEBUG("Invalidation %d of %lu failed: %d", n->what,
+			      (unsigned long)n->ino, err);
+		}
+		free(n);
+
+		pthread_mutex_lock(&nt->lock);
+		nt->sent++;
+	}
+	pthread_mutex_unlock(&nt->lock);
+
+	return NULL;
+}
+
+int hsx_fuse_notify_init(struct hsfs_super *sb)
+{
+	struct hsx_notify *nt;
+	int err;
+
+	nt = calloc(1, sizeof(*nt));
+	if (nt == NULL)
+		return ENOMEM;
+	pthread_mutex_init(&nt->lock, NULL);
+	pthread_cond_init(&nt->cond, NULL);
+	nt->tail = &nt->head;
+	sb->notify = nt;
+
+	err = pthread_create(&nt->thread, NULL, hsx_notify_thread, sb);
+	if (err) {
+		sb->notify = NULL;
+		pthread_cond_destroy(&nt->cond);
+		pthread_mutex_destroy(&nt->lock);
+		free(nt);
+	}
+
+	return err;
+}
+
+void hsx_fuse_notify_fini(struct hsfs_super *sb)
+{
+	struct hsx_notify *nt = sb->notify;
+	struct hsx_notify_item *n;
+
+	if (nt == NULL)
+		return;
+
+	pthread_mutex_lock(&nt->lock);
+	nt->stop = 1;
+	pthread_cond_signal(&nt->cond);
+	pthread_mutex_unlock(&nt->lock);
+	pthread_join(nt->thread, NULL);
+	sb->notify = NULL;
+
+	INFO("%lu kernel cache invalidations sent.", nt->sent);
+	while ((n = nt->head)) {
+		nt->head = n->next;
+		free(n);
+	}
+	pthread_cond_destroy(&nt->cond);
+	pthread_mutex_destroy(&nt->lock);
+	free(nt);
+}
+
+void hsx_fuse_notify_inval(struct hsfs_super *sb, struct hsfs_inode *inode)
+{
+	hsx_notify_queue(sb, HSX_NOTIFY_INODE, inode->ino, NULL);
+}
+
+void hsx_fuse_notify_inval_entry(struct hsfs_super *sb,
+				 struct hsfs_inode *dir, const char *name)
+{
+	hsx_notify_queue(sb, HSX_NOTIFY_ENTRY, dir->ino, name);
+}
+
+void hsx_fuse_changed(struct hsfs_inode *inode)
+{
+	struct hsfs_super *sb = inode->sb;
+	int listed = 0;
+
+	/* Notified once per listing the kernel may have cached. */
+	if (S_ISDIR(inode->i_mode))
+		listed = __sync_lock_test_and_set(&inode->i_listed, 0);
+	if (listed || sb->kcache)
+		hsx_notify_queue(sb, HSX_NOTIFY_INODE, inode->ino, NULL);
+	if (sb->kcache && S_ISDIR(inode->i_mode))
+		hsx_notify_queue(sb, HSX_NOTIFY_CHILDREN, inode->ino, NULL);
+}
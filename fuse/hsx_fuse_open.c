@@ -7,23 +7,30 @@
 #include "hsi_nfs3.h"
 #include "log.h"
 
-#define FI_FH_LEN    10
-
-void hsx_fuse_open (fuse_req_t req, fuse_ino_t ino _U_, struct fuse_file_info *fi)
+void hsx_fuse_open (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	int err=0;
-	uint64_t fh =(uint64_t) malloc (FI_FH_LEN);
+	struct hsfs_super *sb = fuse_req_userdata(req);
+	struct hsx_fuse_file *hf = hsx_fuse_file_alloc();
+	struct hsfs_inode *inode = NULL;
+	int fill = 0;
 	DEBUG_IN ("ino : (%lu)  fi->flags:%d",ino, fi->flags);
-	if (!fh){
+	if (!hf){
 		err = ENOMEM;
 		ERR ("malloc failed:%d\n",err);
 		fuse_reply_err(req, err);
 
 	}
 	else {
-		fi->fh = fh;
+		fi->fh = (uintptr_t)hf;
+		inode = hsfs_ilookup(sb, ino);
+		if (inode)
+			fill = hsx_fuse_smallfile_begin(sb, inode, hf, fi->flags);
 		fuse_reply_open(req, fi);
+		/* Reads of this file wait on hf->lock until the data is in. */
+		if (fill)
+			hsx_fuse_smallfile_fill(inode, hf);
 	}
-	DEBUG_OUT(" fh:%lu",fh);	
+	DEBUG_OUT(" fh:%p",hf);	
 }
 
@@ -9,6 +9,7 @@ void hsx_fuse_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
 	struct hsfs_super *sb = NULL;
 	struct hsfs_inode *parent = NULL;
+	struct stat st;
 	int err = 0;
 
 	DEBUG_IN("%s.","hsx_fuse_opendir");
@@ -26,6 +27,20 @@ void hsx_fuse_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 		goto out;
 	}
 
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 5)
+	/*
+	 * Let the kernel cache the listing, and keep the one it has if the
+	 * directory is unchanged since. Changes seen later are notified by
+	 * hsx_fuse_changed().
+	 */
+	if (sb->changed && !hsi_nfs3_getattr(parent, &st)) {
+		fi->cache_readdir = 1;
+		if (__sync_fetch_and_add(&parent->i_listed, 0))
+			fi->keep_cache = 1;
+	}
+#else
+	(void)st;
+#endif
 	fuse_reply_open(req, fi);
 
 out:	
@@ -0,0 +1,407 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Data prefetch: the daemon reads ahead of the application and stores the
+ * result into the kernel page cache with fuse_lowlevel_notify_store(), so
+ * the next read is served by the kernel without a FUSE round trip.
+ *
+ * A readahead window is a batch of synchronous READs. The request which
+ * found the stream sequential only queues it: HSX_RA_THREADS threads of
+ * our own read the windows, holding their inode (i_count) meanwhile.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "hsx_fuse.h"
+#include "hsi_nfs3.h"
+#include "hsfs_buf.h"
+
+/* Sequential reads in a row before we start reading ahead */
+#define HSX_RA_MIN_SEQ	2
+/* Threads reading the windows, and windows waiting for them at most */
+#define HSX_RA_THREADS	4
+#define HSX_RA_QUEUE	64
+
+struct hsx_ra_window {
+	struct hsx_ra_window *next;
+	struct hsfs_inode *inode;
+	off_t off;
+	off_t end;
+};
+
+struct hsx_ra {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct hsx_ra_window *head, **tail;
+	unsigned int queued;
+	int stop;
+	int nthreads;
+	pthread_t thread[HSX_RA_THREADS];
+};
+
+struct hsx_fuse_file *hsx_fuse_file_alloc(void)
+{
+	struct hsx_fuse_file *hf;
+
+	hf = calloc(1, sizeof(*hf));
+	if (hf)
+		pthread_mutex_init(&hf->lock, NULL);
+	return hf;
+}
+
+void hsx_fuse_file_free(struct hsx_fuse_file *hf)
+{
+	if (!hf)
+		return;
+	/* A release can race with the small file fill started by open. */
+	pthread_mutex_lock(&hf->lock);
+	pthread_mutex_unlock(&hf->lock);
+	hsfs_buf_put(hf->data, hf->data_size);
+	pthread_mutex_destroy(&hf->lock);
+	free(hf);
+}
+
+int hsx_fuse_smallfile_begin(struct hsfs_super *sb, struct hsfs_inode *inode,
+			     struct hsx_fuse_file *hf, int flags)
+{
+	off_t isize = i_size_read(inode);
+
+	if (!hf || !sb->smallfile || !S_ISREG(inode->i_mode))
+		return 0;
+	if ((flags & O_ACCMODE) == O_WRONLY || (flags & O_TRUNC))
+		return 0;
+	if (isize <= 0 || isize > (off_t)sb->smallfile)
+		return 0;
+
+	pthread_mutex_lock(&hf->lock);
+	hf->small = 1;
+	hf->data_size = isize;
+	hf->data_mtime = inode->i_mtime;
+	return 1;
+}
+
+void hsx_fuse_smallfile_fill(struct hsfs_inode *inode, struct hsx_fuse_file *hf)
+{
+	struct hsfs_rw_info rinfo;
+	char *buf;
+
+	buf = hsfs_buf_get(hf->data_size);
+	if (!buf)
+		goto out;
+
+	memset(&rinfo, 0, sizeof(rinfo));
+	rinfo.inode = inode;
+	rinfo.rw_off = 0;
+	rinfo.rw_size = hf->data_size;
+	rinfo.data.data_val = buf;
+	rinfo.data.data_len = hf->data_size;
+	if (hsi_nfs3_read(&rinfo) ||
+	    (rinfo.ret_count != (size_t)hf->data_size && !rinfo.eof)) {
+		/* Short or failed, let the reads go to the server. */
+		hsfs_buf_put(buf, hf->data_size);
+		hf->small = 0;
+		goto out;
+	}
+
+	DEBUG("Cached %zu bytes of ino %lu", rinfo.ret_count, inode->ino);
+	hf->data = buf;
+	hf->data_len = rinfo.ret_count;
+out:
+	pthread_mutex_unlock(&hf->lock);
+}
+
+/* Caller holds hf->lock */
+static void __smallfile_drop(struct hsx_fuse_file *hf)
+{
+	hsfs_buf_put(hf->data, hf->data_size);
+	hf->data = NULL;
+	hf->data_len = 0;
+	hf->small = 0;
+}
+
+int hsx_fuse_smallfile_read(fuse_req_t req, struct hsfs_inode *inode,
+			    struct hsx_fuse_file *hf, size_t size, off_t off)
+{
+	size_t cnt = 0;
+
+	/* Set before open was replied, so no lock needed to test it. */
+	if (!hf || !hf->small)
+		return 0;
+
+	pthread_mutex_lock(&hf->lock);
+	if (!hf->data) {
+		pthread_mutex_unlock(&hf->lock);
+		return 0;
+	}
+	/* Changed behind us (attributes refreshed by someone else)? */
+	if (i_size_read(inode) != hf->data_size ||
+	    inode->i_mtime.tv_sec != hf->data_mtime.tv_sec ||
+	    inode->i_mtime.tv_nsec != hf->data_mtime.tv_nsec) {
+		__smallfile_drop(hf);
+		pthread_mutex_unlock(&hf->lock);
+		return 0;
+	}
+
+	if (off < (off_t)hf->data_len)
+		cnt = min(size, hf->data_len - (size_t)off);
+	hsx_fuse_reply_read(req, hf->data + (cnt ? off : 0), cnt);
+	pthread_mutex_unlock(&hf->lock);
+
+	return 1;
+}
+
+void hsx_fuse_smallfile_drop(struct hsx_fuse_file *hf)
+{
+	if (!hf || !hf->small)
+		return;
+
+	pthread_mutex_lock(&hf->lock);
+	__smallfile_drop(hf);
+	pthread_mutex_unlock(&hf->lock);
+}
+
+int hsx_fuse_notify_store(struct hsfs_super *sb, struct hsfs_inode *inode,
+			  off_t off, const char *buf, size_t len)
+{
+	struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(len);
+	int err;
+
+	if (!sb->se || !len)
+		return 0;
+
+	bufv.buf[0].mem = (void *)buf;
+	err = fuse_lowlevel_notify_store(sb->se, inode->ino, off, &bufv, 0);
+	if (err == -ENOSYS) {
+		/* Kernel too old, don't try again. */
+		WARNING("Kernel doesn't support notify_store, readahead disabled.");
+		sb->readahead = 0;
+	} else if (err && err != -ENOENT) {
+		DEBUG("notify_store(%lu, 0x%llx, %zu) failed: %d", inode->ino,
+		      (unsigned long long)off, len, err);
+	}
+
+	return -err;
+}
+
+/* Read [off, end) from the server and hand it to the kernel, rsize at a time. */
+static void hsx_fuse_prefetch(struct hsfs_super *sb, struct hsfs_inode *inode,
+			      off_t off, off_t end)
+{
+	struct hsfs_rw_info rinfo;
+	char *buf;
+
+	buf = hsfs_buf_get(sb->rsize);
+	if (!buf)
+		return;
+
+	memset(&rinfo, 0, sizeof(rinfo));
+	rinfo.inode = inode;
+	while (off < end && sb->readahead) {
+		size_t len = min((size_t)(end - off), (size_t)sb->rsize);
+
+		rinfo.rw_off = off;
+		rinfo.rw_size = len;
+		rinfo.data.data_val = buf;
+		rinfo.data.data_len = len;
+		if (hsi_nfs3_read(&rinfo) || !rinfo.ret_count)
+			break;
+		if (hsx_fuse_notify_store(sb, inode, off, buf, rinfo.ret_count))
+			break;
+		off += rinfo.ret_count;
+		if (rinfo.eof)
+			break;
+	}
+
+	hsfs_buf_put(buf, sb->rsize);
+}
+
+static void *hsx_ra_thread(void *arg)
+{
+	struct hsfs_super *sb = arg;
+	struct hsx_ra *ra = sb->ra;
+	struct hsx_ra_window *w;
+
+	pthread_mutex_lock(&ra->lock);
+	for (;;) {
+		while (!ra->stop && ra->head == NULL)
+			pthread_cond_wait(&ra->cond, &ra->lock);
+		if (ra->stop)
+			break;
+		w = ra->head;
+		ra->head = w->next;
+		if (ra->head == NULL)
+			ra->tail = &ra->head;
+		ra->queued--;
+		pthread_mutex_unlock(&ra->lock);
+
+		DEBUG("Readahead ino %lu [0x%llx, 0x%llx)", w->inode->ino,
+		      (unsigned long long)w->off, (unsigned long long)w->end);
+		hsx_fuse_prefetch(sb, w->inode, w->off, w->end);
+		hsfs_iput(w->inode);
+		free(w);
+
+		pthread_mutex_lock(&ra->lock);
+	}
+	pthread_mutex_unlock(&ra->lock);
+
+	return NULL;
+}
+
+int hsx_fuse_ra_init(struct hsfs_super *sb)
+{
+	struct hsx_ra *ra;
+	int err = 0;
+
+	if (!sb->readahead)
+		return 0;
+	ra = calloc(1, sizeof(*ra));
+	if (ra == NULL)
+		return ENOMEM;
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+	ra->tail = &ra->head;
+	sb->ra = ra;
+
+	for (ra->nthreads = 0; ra->nthreads < HSX_RA_THREADS; ra->nthreads++) {
+		err = pthread_create(&ra->thread[ra->nthreads], NULL,
+				     hsx_ra_thread, sb);
+		if (err)
+			break;
+	}
+	/* Fewer threads do, none doesn't. */
+	if (ra->nthreads == 0) {
+		sb->ra = NULL;
+		pthread_cond_destroy(&ra->cond);
+		pthread_mutex_destroy(&ra->lock);
+		free(ra);
+		return err;
+	}
+
+	return 0;
+}
+
+void hsx_fuse_ra_fini(struct hsfs_super *sb)
+{
+	struct hsx_ra *ra = sb->ra;
+	struct hsx_ra_window *w;
+	int i;
+
+	if (ra == NULL)
+		return;
+
+	pthread_mutex_lock(&ra->lock);
+	ra->stop = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+	for (i = 0; i < ra->nthreads; i++)
+		pthread_join(ra->thread[i], NULL);
+	sb->ra = NULL;
+
+	while ((w = ra->head)) {
+		ra->head = w->next;
+		hsfs_iput(w->inode);
+		free(w);
+	}
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->lock);
+	free(ra);
+}
+
+/* Hand [off, end) to the readahead threads, 0 if queued. */
+static int hsx_ra_queue(struct hsfs_super *sb, struct hsfs_inode *inode,
+			off_t off, off_t end)
+{
+	struct hsx_ra *ra = sb->ra;
+	struct hsx_ra_window *w;
+
+	if (ra == NULL || ra->queued >= HSX_RA_QUEUE)
+		return EAGAIN;
+	w = malloc(sizeof(*w));
+	if (w == NULL)
+		return ENOMEM;
+	/* The kernel may forget the inode before the window is read. */
+	w->inode = hsfs_iget(sb, inode->ino);
+	if (w->inode == NULL) {
+		free(w);
+		return ESTALE;
+	}
+	w->next = NULL;
+	w->off = off;
+	w->end = end;
+
+	pthread_mutex_lock(&ra->lock);
+	if (ra->stop || ra->queued >= HSX_RA_QUEUE) {
+		pthread_mutex_unlock(&ra->lock);
+		hsfs_iput(w->inode);
+		free(w);
+		return EAGAIN;
+	}
+	*ra->tail = w;
+	ra->tail = &w->next;
+	ra->queued++;
+	pthread_cond_signal(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+
+	return 0;
+}
+
+void hsx_fuse_readahead(struct hsfs_super *sb, struct hsfs_inode *inode,
+			struct hsx_fuse_file *hf, off_t off, size_t cnt)
+{
+	off_t start, end, isize;
+
+	if (!hf || !sb->readahead || !cnt)
+		return;
+
+	pthread_mutex_lock(&hf->lock);
+	/*
+	 * The reads in the window are served by the kernel, the next one
+	 * we see is at its end or before.
+	 */
+	if (off >= hf->next_off &&
+	    off <= (hf->ra_end > hf->next_off ? hf->ra_end : hf->next_off)) {
+		hf->seq++;
+	} else {
+		/* Random access, drop the window and start over. */
+		hf->seq = 0;
+		hf->ra_end = 0;
+	}
+	hf->next_off = off + cnt;
+
+	start = hf->next_off > hf->ra_end ? hf->next_off : hf->ra_end;
+	end = hf->next_off + sb->readahead;
+	isize = i_size_read(inode);
+	if (end > isize)
+		end = isize;
+
+	/*
+	 * Only refill once the reader has consumed half of the window, so
+	 * each prefetch is a reasonably large batch of READs.
+	 */
+	if (hf->seq < HSX_RA_MIN_SEQ || end <= start ||
+	    hf->ra_end - hf->next_off > (off_t)(sb->readahead / 2)) {
+		pthread_mutex_unlock(&hf->lock);
+		return;
+	}
+	if (!hsx_ra_queue(sb, inode, start, end))
+		hf->ra_end = end;
+	pthread_mutex_unlock(&hf->lock);
+}
@@ -0,0 +1,346 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Event driven workers for the per-CPU loop (see hsx_fuse_loop.c).
+ *
+ * Each worker is a reactor: it waits in epoll for either a request on
+ * /dev/fuse or the completion of one of its NFS calls. GETATTR and READ
+ * of up to rsize are not made blocking: the handler submits the call
+ * (hsi_nfs3_clnt_submit()) and returns, the reply reader of the transport
+ * decodes the reply and pushes the request back to the reactor which
+ * submitted it, and the reactor continues it from there and replies. A
+ * CPU can thus keep many of them in flight with a single thread.
+ *
+ * The completed requests of a reactor are a lock-free stack: the reply
+ * readers push, the reactor takes them all at once, and an eventfd wakes
+ * it when the stack goes from empty to not. A call which could not be
+ * submitted, or which failed on the wire, is made the blocking way from
+ * the reactor, so that retransmissions and replays stay where they are.
+ * Other requests are served as in the blocking loop.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "hsx_fuse.h"
+#include "hsi_nfs3.h"
+#include "hsfs_buf.h"
+
+#define HSX_REACTOR_EVENTS	8
+
+struct hsx_reactor {
+	struct hsx_reactor_op *done;	/* Completed, pushed by the readers */
+	int efd;
+	int epfd;
+	int inflight;			/* Submitted, not continued yet */
+	struct fuse_buf fbuf;
+};
+
+/* A request waiting for its NFS reply */
+struct hsx_reactor_op {
+	struct hsx_reactor_op *next;
+	struct hsx_reactor *home;
+	void (*cont)(struct hsx_reactor_op *op);
+	enum clnt_stat st;
+	fuse_req_t req;
+	struct hsfs_inode *inode;
+	union {
+		struct {
+			nfs_fh3 fh;
+			getattr3res res;
+		} getattr;
+		struct {
+			struct hsfs_rw_info rinfo;
+			struct hsx_fuse_file *hf;
+			read3args args;
+			read3res res;
+			char *buf;
+			size_t size;
+			off_t off;
+		} read;
+	} u;
+};
+
+/* The reactor of this thread, NULL out of the reactor mode */
+static __thread struct hsx_reactor *hsx_reactor_self;
+
+/* From the reply reader of the transport: give op back to its reactor. */
+static void hsx_reactor_done(void *priv, enum clnt_stat st)
+{
+	struct hsx_reactor_op *op = priv, *head;
+	struct hsx_reactor *r = op->home;
+	uint64_t one = 1;
+
+	op->st = st;
+	do {
+		head = r->done;
+		op->next = head;
+	} while (!__sync_bool_compare_and_swap(&r->done, head, op));
+	if (head == NULL && write(r->efd, &one, sizeof(one)) < 0)
+		ERR("Failed to wake up a reactor: %d.", errno);
+}
+
+/* Continue the completed requests, oldest first. */
+static void hsx_reactor_run(struct hsx_reactor *r)
+{
+	struct hsx_reactor_op *op, *next, *list = NULL;
+	uint64_t cnt;
+
+	/* Cleared first, a push after the swap below wakes us again. */
+	if (read(r->efd, &cnt, sizeof(cnt)) < 0)
+		return;
+	op = __sync_lock_test_and_set(&r->done, NULL);
+	for (; op; op = next) {
+		next = op->next;
+		op->next = list;
+		list = op;
+	}
+	while ((op = list)) {
+		list = op->next;
+		r->inflight--;
+		op->cont(op);
+	}
+}
+
+static struct hsx_reactor_op *hsx_reactor_op_alloc(fuse_req_t req,
+		struct hsfs_inode *inode, void (*cont)(struct hsx_reactor_op *))
+{
+	struct hsx_reactor_op *op;
+
+	if (hsx_reactor_self == NULL)
+		return NULL;
+	op = calloc(1, sizeof(*op));
+	if (op == NULL)
+		return NULL;
+	op->home = hsx_reactor_self;
+	op->cont = cont;
+	op->req = req;
+	op->inode = inode;
+
+	return op;
+}
+
+/* Returns 1 if submitted, else op is freed and the caller blocks. */
+static int hsx_reactor_submit(struct hsx_reactor_op *op, unsigned long proc,
+			      xdrproc_t xargs, void *args, xdrproc_t xres,
+			      void *res)
+{
+	struct hsfs_super *sb = op->inode->sb;
+
+	op->home->inflight++;
+	if (hsi_nfs3_clnt_submit(sb, sb->clntp, proc, xargs, args, xres, res,
+				 hsx_reactor_done, op) == 0)
+		return 1;
+	op->home->inflight--;
+	free(op);
+
+	return 0;
+}
+
+static void hsx_reactor_getattr_cont(struct hsx_reactor_op *op)
+{
+	struct stat st;
+	int err;
+
+	memset(&st, 0, sizeof(st));
+	if (op->st == RPC_SUCCESS)
+		err = hsi_nfs3_getattr_finish(op->inode, &op->u.getattr.res,
+					      &st);
+	else
+		err = hsi_nfs3_getattr(op->inode, &st);
+	if (err)
+		fuse_reply_err(op->req, err);
+	else
+		fuse_reply_attr(op->req, &st, hsx_fuse_attr_timeout(op->inode));
+	free(op);
+}
+
+int hsx_fuse_reactor_getattr(fuse_req_t req, struct hsfs_inode *inode)
+{
+	struct hsx_reactor_op *op;
+
+	op = hsx_reactor_op_alloc(req, inode, hsx_reactor_getattr_cont);
+	if (op == NULL)
+		return 0;
+	hsi_nfs3_getfh3(inode, &op->u.getattr.fh);
+
+	return hsx_reactor_submit(op, NFSPROC3_GETATTR,
+				  (xdrproc_t)xdr_nfs_fh3, &op->u.getattr.fh,
+				  (xdrproc_t)hsi_xdr_getattr3res,
+				  &op->u.getattr.res);
+}
+
+static void hsx_reactor_read_cont(struct hsx_reactor_op *op)
+{
+	struct hsfs_rw_info *rinfo = &op->u.read.rinfo;
+	size_t size = op->u.read.size, cnt = 0;
+	off_t off = op->u.read.off;
+	int err = 0, eof = 0;
+
+	if (op->st == RPC_SUCCESS) {
+		err = hsi_nfs3_read_finish(rinfo, &op->u.read.res);
+		if (!err) {
+			cnt = rinfo->ret_count;
+			eof = rinfo->eof;
+		}
+	}
+	/* A failed call or a short read is finished the blocking way. */
+	while (!err && !eof && cnt < size) {
+		rinfo->rw_size = size - cnt;
+		rinfo->rw_off = off + cnt;
+		rinfo->data.data_val = op->u.read.buf + cnt;
+		rinfo->data.data_len = size - cnt;
+		err = hsi_nfs3_read(rinfo);
+		if (!err) {
+			cnt += rinfo->ret_count;
+			eof = rinfo->eof;
+		}
+	}
+
+	if (err) {
+		fuse_reply_err(op->req, err);
+	} else {
+		hsx_fuse_reply_read(op->req, op->u.read.buf, cnt);
+		hsx_fuse_readahead(op->inode->sb, op->inode, op->u.read.hf,
+				   off, cnt);
+	}
+	hsfs_buf_put(op->u.read.buf, size);
+	free(op);
+}
+
+int hsx_fuse_reactor_read(fuse_req_t req, struct hsfs_inode *inode,
+			  struct hsx_fuse_file *hf, char *buf, size_t size,
+			  off_t off)
+{
+	struct hsx_reactor_op *op;
+	struct hsfs_rw_info *rinfo;
+
+	if (size > inode->sb->rsize)
+		return 0;
+	op = hsx_reactor_op_alloc(req, inode, hsx_reactor_read_cont);
+	if (op == NULL)
+		return 0;
+	op->u.read.hf = hf;
+	op->u.read.buf = buf;
+	op->u.read.size = size;
+	op->u.read.off = off;
+	rinfo = &op->u.read.rinfo;
+	rinfo->inode = inode;
+	rinfo->rw_size = size;
+	rinfo->rw_off = off;
+	rinfo->data.data_val = buf;
+	rinfo->data.data_len = size;
+	hsi_nfs3_read_prepare(rinfo, &op->u.read.args, &op->u.read.res);
+
+	return hsx_reactor_submit(op, NFSPROC3_READ,
+				  (xdrproc_t)hsi_xdr_read3args,
+				  &op->u.read.args,
+				  (xdrproc_t)hsi_xdr_read3res,
+				  &op->u.read.res);
+}
+
+/* On the way out, cancelled or not: the calls in flight point to r. */
+static void hsx_reactor_stop(void *arg)
+{
+	struct hsx_reactor *r = arg;
+
+	while (r->inflight)
+		hsx_reactor_run(r);
+	hsx_reactor_self = NULL;
+	free(r->fbuf.mem);
+	close(r->epfd);
+	close(r->efd);
+}
+
+int hsx_fuse_reactor_serve(struct fuse_session *se)
+{
+	struct epoll_event ev[HSX_REACTOR_EVENTS];
+	struct hsx_reactor r;
+	int fd = fuse_session_fd(se);
+	int i, n, res, err = 0;
+
+	memset(&r, 0, sizeof(r));
+	r.efd = eventfd(0, EFD_CLOEXEC);
+	r.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (r.efd < 0 || r.epfd < 0) {
+		err = errno;
+		goto out_close;
+	}
+	/* The fd is shared by the reactors, one is woken per request. */
+	ev[0].events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev[0].data.ptr = NULL;
+	ev[1].events = EPOLLIN;
+	ev[1].data.ptr = &r;
+	if (epoll_ctl(r.epfd, EPOLL_CTL_ADD, fd, &ev[0]) ||
+	    epoll_ctl(r.epfd, EPOLL_CTL_ADD, r.efd, &ev[1]) ||
+	    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK)) {
+		err = errno;
+		goto out_close;
+	}
+
+	hsx_reactor_self = &r;
+	/* Only cancelled while idle, see hsx_fuse_loop_percpu(). */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_cleanup_push(hsx_reactor_stop, &r);
+	while (!fuse_session_exited(se)) {
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		n = epoll_wait(r.epfd, ev, HSX_REACTOR_EVENTS, -1);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			err = errno;
+			fuse_session_exit(se);
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (ev[i].data.ptr) {
+				hsx_reactor_run(&r);
+				continue;
+			}
+			res = fuse_session_receive_buf(se, &r.fbuf);
+			if (res == -EINTR || res == -EAGAIN)
+				continue;
+			if (res <= 0) {
+				if (res < 0)
+					err = -res;
+				fuse_session_exit(se);
+				break;
+			}
+			fuse_session_process_buf(se, &r.fbuf);
+		}
+	}
+	pthread_cleanup_pop(1);
+
+	return err;
+
+out_close:
+	ERR("Failed to set up a reactor: %d.", err);
+	if (r.epfd >= 0)
+		close(r.epfd);
+	if (r.efd >= 0)
+		close(r.efd);
+	return err;
+}
@@ -3,9 +3,19 @@
 #include <errno.h>
 #include <hsx_fuse.h>
 #include "hsi_nfs3.h"
+#include "hsfs_buf.h"
+
+void hsx_fuse_reply_read(fuse_req_t req, const char *buf, size_t size)
+{
+	struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
+
+	bufv.buf[0].mem = (void *)buf;
+	/* Written as fuse_reply_buf() does unless splicing was agreed. */
+	fuse_reply_data(req, &bufv, FUSE_BUF_SPLICE_MOVE);
+}
 
 void hsx_fuse_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
-		    struct fuse_file_info *fi __attribute__((unused)))
+		    struct fuse_file_info *fi)
 {
 	struct hsfs_rw_info rinfo;
 	struct hsfs_super * sb = (struct hsfs_super *)fuse_req_userdata(req);
@@ -14,7 +24,7 @@ void hsx_fuse_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 	char * buf = NULL;
 	
 	DEBUG_IN("offset 0x%x size 0x%x", (unsigned int)off, (unsigned int)size);
-	buf = (char *) malloc(size);
+	buf = hsfs_buf_get(size);
 	if( NULL == buf){
 		err = ENOMEM;
 		fuse_reply_err(req, err);
@@ -28,6 +38,14 @@ void hsx_fuse_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 		goto out;
 	}
 	DEBUG("ino %lu", rinfo.inode->ino);
+	if (hsx_fuse_smallfile_read(req, rinfo.inode, hsx_fuse_file(fi),
+				    size, off))
+		goto out;
+	if (hsx_fuse_reactor_read(req, rinfo.inode, hsx_fuse_file(fi), buf,
+				  size, off)) {
+		buf = NULL;	/* The reactor's now */
+		goto out;
+	}
 	while(cnt < size){
 		size_t tmp_size = min(size - cnt, sb->rsize);
 		
@@ -48,10 +66,10 @@ void hsx_fuse_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 			break;
 	}
 
-	fuse_reply_buf(req, buf, cnt);
+	hsx_fuse_reply_read(req, buf, cnt);
+	hsx_fuse_readahead(sb, rinfo.inode, hsx_fuse_file(fi), off, cnt);
 out:	
-	if(NULL != buf)
-		free(buf);
+	hsfs_buf_put(buf, size);
 		
 	DEBUG_OUT("err %d", err);
 	return;
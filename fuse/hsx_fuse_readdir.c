@@ -19,33 +19,19 @@
 #include <hsx_fuse.h>
 
 #include <errno.h>
+#include <string.h>
 #include "hsi_nfs3.h"
+#include "hsfs_arena.h"
+#include "hsfs_buf.h"
 
-static void __free_ctx(struct hsfs_readdir_ctx *ctx,
-		       struct hsfs_readdir_ctx *free_inode_after)
+/* Drop the references of hsi_nfs_fhget(), replied entries have the kernel's. */
+static void __free_ctx(struct hsfs_readdir_ctx *ctx)
 {
-	struct hsfs_readdir_ctx *saved_ctx;
-	int free_inode;
-
-	if ((free_inode_after != NULL) && (free_inode_after == ctx))
-		free_inode = 1;
-	else
-		free_inode = 0;
-
 	while(ctx != NULL){
-		if (!free_inode && free_inode_after != NULL){
-			if (ctx == free_inode_after)
-				free_inode = 1;
-		}
-		if (free_inode && (ctx->inode != NULL)){
-			if (!hsx_fuse_ref_dec(ctx->inode, 1))
-				hsfs_iput(ctx->inode);
-		}
-		if (ctx->name)
-			free(ctx->name);
-		saved_ctx = ctx->next;
-		free(ctx);
-		ctx = saved_ctx;
+		if (ctx->inode != NULL)
+			hsfs_iput(ctx->inode);
+		/* ctx and its name live in the request arena */
+		ctx = ctx->next;
 	}
 
 }
@@ -58,23 +44,30 @@ void hsx_fuse_readdir_plus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t of
 	struct hsfs_super *sb;
 	size_t res, len = 0;
 	char * buf;
+	struct hsfs_arena_mark mark;
 	int err, count = 0;
 
 	DEBUG_IN("P_I(%lu), Size(%lld), Off(0x%llx)", ino, size, off);
 
 	(void)fi;
+	hsfs_arena_mark(&mark);
 	sb = fuse_req_userdata(req);
 	FUSE_ASSERT(sb != NULL);
 
 	parent = hsfs_ilookup(sb, ino);
 	FUSE_ASSERT(parent != NULL);
 
+	hsfs_dir_lock_shared(parent);
 	err = hsi_nfs3_readdir_plus(parent, size, off, &ctx, size);
+	/* Refreshed by the call: what the kernel may now cache. */
+	if (!err && !off)
+		__sync_lock_test_and_set(&parent->i_listed, 1);
+	hsfs_dir_unlock(parent);
 	if(err)
 		goto out1;
 	saved_ctx = ctx;
 
-	buf = (char *) malloc(size);
+	buf = hsfs_buf_get(size);
 	if( NULL == buf){
 		err = ENOMEM;
 		goto out2;
@@ -93,6 +86,8 @@ void hsx_fuse_readdir_plus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t of
 		}
 		count++;
 	       	hsx_fuse_ref_inc(ctx->inode, 1);
+		if (strcmp(ctx->name, ".") && strcmp(ctx->name, ".."))
+			hsfs_iname(ctx->inode, parent, ctx->name);
 		len += res;
 		ctx = ctx->next;
 	}
@@ -100,12 +95,13 @@ void hsx_fuse_readdir_plus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t of
 	if (!err)
 		fuse_reply_buf(req, buf, len);
 	
-	free(buf);
+	hsfs_buf_put(buf, size);
 out2:
-	__free_ctx(saved_ctx, 0);
+	__free_ctx(saved_ctx);
 out1:
 	if(err)
 		fuse_reply_err(req, err);
+	hsfs_arena_release(&mark);
 
 	DEBUG_OUT("with %d, %d entries returned", err, count);
 	return;
@@ -119,23 +115,30 @@ void hsx_fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 	struct hsfs_super *sb;
 	size_t res, len = 0;
 	char * buf;
+	struct hsfs_arena_mark mark;
 	int err, count = 0;
 
 	DEBUG_IN("P_I(%lu), Size(%lld), Off(0x%llx)", ino, size, off);
 
 	(void)fi;
+	hsfs_arena_mark(&mark);
 	sb = fuse_req_userdata(req);
 	FUSE_ASSERT(sb != NULL);
 
 	parent = hsfs_ilookup(sb, ino);
 	FUSE_ASSERT(parent != NULL);
 
+	hsfs_dir_lock_shared(parent);
 	err = hsi_nfs3_readdir(parent, size, off, &ctx);
+	/* Refreshed by the call: what the kernel may now cache. */
+	if (!err && !off)
+		__sync_lock_test_and_set(&parent->i_listed, 1);
+	hsfs_dir_unlock(parent);
 	if(err)
 		goto out1;
 	saved_ctx = ctx;
 
-	buf = (char *) malloc(size);
+	buf = hsfs_buf_get(size);
 	if( NULL == buf){
 		err = ENOMEM;
 		goto out2;
@@ -155,12 +158,13 @@ void hsx_fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 	if (!err)
 		fuse_reply_buf(req, buf, len);
 	
-	free(buf);
+	hsfs_buf_put(buf, size);
 out2:
-	__free_ctx(saved_ctx, 0);
+	__free_ctx(saved_ctx);
 out1:
 	if(err)
 		fuse_reply_err(req, err);
+	hsfs_arena_release(&mark);
 
 	DEBUG_OUT("with %d, %d entries returned.", err, count);
 }
@@ -6,6 +6,7 @@
 #include "hsi_nfs3.h"
 #include "hsx_fuse.h"
 #include "log.h"
+#include "hsfs_arena.h"
 #include <errno.h>
 
 void hsx_fuse_readlink(fuse_req_t req, fuse_ino_t ino)
@@ -15,7 +16,9 @@ void hsx_fuse_readlink(fuse_req_t req, fuse_ino_t ino)
 	struct hsfs_inode *hi = NULL;
 	struct hsfs_super *hi_sb = NULL;
 	char *link = NULL;
+	struct hsfs_arena_mark mark;
 	DEBUG_IN("%s\n","THE HSX_FUSE_READLINK.");
+	hsfs_arena_mark(&mark);
 
 	hi_sb = fuse_req_userdata(req);
 	if(!hi_sb){
@@ -37,12 +40,10 @@ void hsx_fuse_readlink(fuse_req_t req, fuse_ino_t ino)
 	fuse_reply_readlink(req, link);
 
 out:
-	if(link != NULL){
-		free(link);
-	}
 	if(st != 0){
 		fuse_reply_err(req, err);
 	}
+	hsfs_arena_release(&mark);
 	DEBUG_OUT(" WITH ERRNO %d\n", err);
 	return;
 }
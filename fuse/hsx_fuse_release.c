@@ -10,9 +10,7 @@
 void hsx_fuse_release (fuse_req_t req, fuse_ino_t ino _U_, struct fuse_file_info *fi)
 {
 	DEBUG_IN ("ino (%lu) , fi->flags:%d",ino, fi->flags);
-	if (fi->fh != 0){
-		free ((void *)fi->fh);
-	}
+	hsx_fuse_file_free(hsx_fuse_file(fi));
 	fuse_reply_err(req, 0);
 	DEBUG_OUT(" fi->flags:%d",fi->flags);
 }
@@ -65,9 +65,12 @@ void hsx_fuse_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
 		goto out;
 	}
 
-	if ((err = hsi_nfs3_rename(hi, name, newhi, newname))) {
-		goto out;
-	}
+	hsfs_dir_lock2(hi, newhi);
+	err = hsi_nfs3_rename(hi, name, newhi, newname);
+	hsfs_dir_unlock2(hi, newhi);
+	/* Looked up again, so that the moved inode is known by its name. */
+	if (!err && sb->kcache)
+		hsx_fuse_notify_inval_entry(sb, newhi, newname);
 out:
 	fuse_reply_err(req, err);
 	DEBUG_OUT(" %s to %s errno:%d", name, newname, err);
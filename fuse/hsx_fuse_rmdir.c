@@ -19,7 +19,9 @@ void hsx_fuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 		return;
 	}
 	
+	hsfs_dir_lock(hi_parent);
 	err = hsi_nfs3_rmdir(hi_parent, dirname);
+	hsfs_dir_unlock(hi_parent);
 	fuse_reply_err(req, err);
 	DEBUG_OUT(" out, errno: %d.", err);
 	return;
@@ -58,7 +58,7 @@ void hsx_fuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
 	if (err)
 		fuse_reply_err(req, err);	
 	else {
-		to = S_ISDIR(inode->i_mode) ? sb->acdirmin : sb->acregmin;
+		to = hsx_fuse_attr_timeout(inode);
 		fuse_reply_attr(req, &st, to);
 	}
 }
@@ -36,7 +36,9 @@ void hsx_fuse_symlink(fuse_req_t req, const char *link,
 		goto out;
 	}
 
+	hsfs_dir_lock(nfs_parent);
 	err = hsi_nfs3_symlink(nfs_parent, &new, link, name);
+	hsfs_dir_unlock(nfs_parent);
 	if(err != 0)
 		goto out;
 
@@ -48,8 +50,10 @@ void hsx_fuse_symlink(fuse_req_t req, const char *link,
 	ref = hsx_fuse_ref_xchg(new, 1);
 	FUSE_ASSERT(ref == 0);	/* Should be a new one... */
 
+	hsfs_iname(new, nfs_parent, name);
 	hsx_fuse_fill_reply(new, &e);
 	fuse_reply_entry(req, &e);
+	hsfs_iput(new);
 out:
 	if(err != 0){
 		fuse_reply_err(req, err);
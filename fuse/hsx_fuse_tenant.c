@@ -0,0 +1,996 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per tenant rate limits.
+ *
+ * A tenant is the uid, or the pid with tenant=pid, of the process behind
+ * a request. Each one has two token buckets, requests and bytes per
+ * second, holding at most one second worth of tokens. A request takes
+ * its tokens up front, possibly driving a bucket below zero, and is then
+ * due when the bucket would have refilled.
+ *
+ * The limits are applied by wrapping the handlers of the requests that
+ * go to the server, see hsx_fuse_tenant_oper(). A request already due is
+ * served on the spot. Any other is copied, arguments and data, into a
+ * queue sorted by due time and the FUSE worker goes back to the kernel:
+ * HSX_TENANT_THREADS threads of our own serve the queue as requests fall
+ * due. Since a throttled tenant stays below zero until its last request
+ * is due, its requests leave the queue in the order they came, and the
+ * requests of other tenants neither wait for them nor for a worker.
+ *
+ * Tenants are never freed before unmount; past HSX_TENANT_MAX of them
+ * the newcomers share one bucket.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hsx_fuse.h"
+
+#define HSX_TENANT_BUCKETS	64
+#define HSX_TENANT_MAX		4096
+/* Key of the tenant shared by everyone past HSX_TENANT_MAX */
+#define HSX_TENANT_OVERFLOW	((unsigned long)-1)
+/* Threads serving the throttled requests */
+#define HSX_TENANT_THREADS	4
+
+struct hsx_tenant {
+	struct hsx_tenant *next;
+	unsigned long key;
+	double ops;		/* Tokens, may go negative */
+	double bytes;
+	long stamp;		/* Last refill, in usec */
+	unsigned long nops;	/* Counters */
+	unsigned long long nbytes;
+	unsigned long throttled;
+	unsigned long long waited_us;
+};
+
+enum {
+	HSX_TENANT_ACCESS,
+	HSX_TENANT_CREATE,
+	HSX_TENANT_GETATTR,
+	HSX_TENANT_GETXATTR,
+	HSX_TENANT_IOCTL,
+	HSX_TENANT_LINK,
+	HSX_TENANT_LOOKUP,
+	HSX_TENANT_MKDIR,
+	HSX_TENANT_MKNOD,
+	HSX_TENANT_OPEN,
+	HSX_TENANT_OPENDIR,
+	HSX_TENANT_READ,
+	HSX_TENANT_READDIR,
+	HSX_TENANT_READDIRPLUS,
+	HSX_TENANT_READLINK,
+	HSX_TENANT_RENAME,
+	HSX_TENANT_RMDIR,
+	HSX_TENANT_SETATTR,
+	HSX_TENANT_SETXATTR,
+	HSX_TENANT_STATFS,
+	HSX_TENANT_SYMLINK,
+	HSX_TENANT_UNLINK,
+	HSX_TENANT_WRITE,
+};
+
+/* A throttled request, with copies of everything its handler needs */
+struct hsx_tenant_call {
+	struct hsx_tenant_call *next;
+	long due;		/* In usec */
+	fuse_req_t req;
+	int op;			/* HSX_TENANT_* */
+	fuse_ino_t ino;		/* Or the parent */
+	fuse_ino_t ino2;	/* New parent of link and rename */
+	const char *name;
+	const char *name2;	/* New name, symlink target */
+	const void *buf;	/* Written data, xattr value, ioctl input */
+	size_t size;
+	size_t size2;		/* ioctl output size */
+	off_t off;
+	int arg;		/* mask, mode, to_set, cmd or xattr flags */
+	unsigned int uarg;	/* rename and ioctl flags */
+	dev_t rdev;
+	void *ptr;		/* ioctl argument */
+	struct stat attr;
+	struct fuse_file_info fi;
+	int has_fi;
+	char *end;		/* End of the copies in data */
+	char data[];
+};
+
+struct hsx_tenants {
+	pthread_mutex_t lock;
+	double ops_rate;	/* Per second, 0 for no limit */
+	double bytes_rate;
+	int key;
+	unsigned int count;
+	struct hsx_tenant *table[HSX_TENANT_BUCKETS];
+	/* Throttled requests, by due time */
+	struct hsx_tenant_call *queue;
+	pthread_cond_t cond;
+	int stop;
+	int nthreads;
+	pthread_t threads[HSX_TENANT_THREADS];
+};
+
+/* The handlers being wrapped, and the wrapped table */
+static struct fuse_lowlevel_ops hsx_tenant_base;
+static struct fuse_lowlevel_ops hsx_tenant_oper;
+
+static long __now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void *hsx_tenant_dispatch(void *arg);
+
+int hsx_fuse_tenant_init(struct hsfs_super *sb)
+{
+	struct hsx_tenants *tt;
+	pthread_condattr_t attr;
+
+	if (!sb->tenant_ops && !sb->tenant_bw)
+		return 0;
+
+	tt = calloc(1, sizeof(*tt));
+	if (tt == NULL)
+		return ENOMEM;
+	pthread_mutex_init(&tt->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&tt->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	tt->ops_rate = sb->tenant_ops;
+	tt->bytes_rate = (double)sb->tenant_bw * 1024;
+	tt->key = sb->tenant_key;
+
+	for (; tt->nthreads < HSX_TENANT_THREADS; tt->nthreads++)
+		if (pthread_create(&tt->threads[tt->nthreads], NULL,
+				   hsx_tenant_dispatch, tt))
+			break;
+	if (tt->nthreads == 0) {
+		pthread_cond_destroy(&tt->cond);
+		pthread_mutex_destroy(&tt->lock);
+		free(tt);
+		return EAGAIN;
+	}
+	sb->tenants = tt;
+
+	return 0;
+}
+
+void hsx_fuse_tenant_report(struct hsfs_super *sb)
+{
+	struct hsx_tenants *tt = sb->tenants;
+	struct hsx_tenant *t;
+	int i;
+
+	if (tt == NULL)
+		return;
+
+	pthread_mutex_lock(&tt->lock);
+	for (i = 0; i < HSX_TENANT_BUCKETS; i++) {
+		for (t = tt->table[i]; t; t = t->next) {
+			INFO("%s %ld: %lu requests, %llu bytes, "
+			     "%lu throttled for %llu ms.",
+			     tt->key == HSX_TENANT_PID ? "pid" : "uid",
+			     t->key == HSX_TENANT_OVERFLOW ? -1L : (long)t->key,
+			     t->nops, t->nbytes, t->throttled,
+			     t->waited_us / 1000);
+		}
+	}
+	pthread_mutex_unlock(&tt->lock);
+}
+
+void hsx_fuse_tenant_fini(struct hsfs_super *sb)
+{
+	struct hsx_tenants *tt = sb->tenants;
+	struct hsx_tenant_call *c;
+	struct hsx_tenant *t;
+	int i;
+
+	if (tt == NULL)
+		return;
+
+	pthread_mutex_lock(&tt->lock);
+	tt->stop = 1;
+	pthread_cond_broadcast(&tt->cond);
+	pthread_mutex_unlock(&tt->lock);
+	for (i = 0; i < tt->nthreads; i++)
+		pthread_join(tt->threads[i], NULL);
+	/* The session is over, nobody waits for these any more */
+	while ((c = tt->queue)) {
+		tt->queue = c->next;
+		fuse_reply_err(c->req, EINTR);
+		free(c);
+	}
+
+	hsx_fuse_tenant_report(sb);
+	for (i = 0; i < HSX_TENANT_BUCKETS; i++) {
+		while ((t = tt->table[i])) {
+			tt->table[i] = t->next;
+			free(t);
+		}
+	}
+	pthread_cond_destroy(&tt->cond);
+	pthread_mutex_destroy(&tt->lock);
+	free(tt);
+	sb->tenants = NULL;
+}
+
+/* Called with tt->lock held */
+static struct hsx_tenant *hsx_tenant_get(struct hsx_tenants *tt,
+					 unsigned long key, long now)
+{
+	struct hsx_tenant *t;
+	unsigned int b;
+
+	if (tt->count >= HSX_TENANT_MAX)
+		key = HSX_TENANT_OVERFLOW;
+lookup:
+	b = key % HSX_TENANT_BUCKETS;
+	for (t = tt->table[b]; t; t = t->next)
+		if (t->key == key)
+			return t;
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL) {
+		if (key == HSX_TENANT_OVERFLOW)
+			return NULL;
+		key = HSX_TENANT_OVERFLOW;
+		goto lookup;
+	}
+	t->key = key;
+	t->ops = tt->ops_rate;
+	t->bytes = tt->bytes_rate;
+	t->stamp = now;
+	t->next = tt->table[b];
+	tt->table[b] = t;
+	tt->count++;
+
+	return t;
+}
+
+/* Take tokens, returns how long until they are there in usec */
+static long hsx_tenant_take(double *tokens, double rate, double want,
+			    long elapsed)
+{
+	if (rate <= 0)
+		return 0;
+
+	*tokens += rate * elapsed / 1000000;
+	if (*tokens > rate)
+		*tokens = rate;
+	*tokens -= want;
+
+	return *tokens < 0 ? (long)(-*tokens * 1000000 / rate) : 0;
+}
+
+/* Charge a request to its tenant, returns how long it must wait in usec */
+static long hsx_tenant_charge(struct hsx_tenants *tt, fuse_req_t req,
+			      size_t bytes)
+{
+	const struct fuse_ctx *ctx = fuse_req_ctx(req);
+	struct hsx_tenant *t;
+	long now, wait, w;
+
+	now = __now_us();
+
+	pthread_mutex_lock(&tt->lock);
+	t = hsx_tenant_get(tt, tt->key == HSX_TENANT_PID ?
+			   (unsigned long)ctx->pid : (unsigned long)ctx->uid,
+			   now);
+	if (t == NULL) {
+		pthread_mutex_unlock(&tt->lock);
+		return 0;
+	}
+	wait = hsx_tenant_take(&t->ops, tt->ops_rate, 1, now - t->stamp);
+	w = hsx_tenant_take(&t->bytes, tt->bytes_rate, bytes, now - t->stamp);
+	t->stamp = now;
+	if (w > wait)
+		wait = w;
+	t->nops++;
+	t->nbytes += bytes;
+	if (wait) {
+		t->throttled++;
+		t->waited_us += wait;
+		DEBUG("Tenant %lu throttled for %ldus.", t->key, wait);
+	}
+	pthread_mutex_unlock(&tt->lock);
+
+	return wait;
+}
+
+/*
+ * Charge a request, returns NULL if it is to be served now. Otherwise
+ * returns a call with room for extra bytes of copies, for the caller to
+ * fill and hand to hsx_tenant_queue().
+ */
+static struct hsx_tenant_call *hsx_tenant_defer(fuse_req_t req, size_t bytes,
+						 size_t extra)
+{
+	struct hsfs_super *sb = (struct hsfs_super *)fuse_req_userdata(req);
+	struct hsx_tenants *tt = sb->tenants;
+	struct hsx_tenant_call *c;
+	long wait;
+
+	if (tt == NULL)
+		return NULL;
+	wait = hsx_tenant_charge(tt, req, bytes);
+	if (wait == 0)
+		return NULL;
+
+	/* Room to align each of up to two copies */
+	c = malloc(sizeof(*c) + extra + 2 * sizeof(long));
+	if (c == NULL) {
+		WARNING("No memory to queue a throttled request, serving it.");
+		return NULL;
+	}
+	memset(c, 0, sizeof(*c));
+	c->due = __now_us() + wait;
+	c->req = req;
+	c->end = c->data;
+
+	return c;
+}
+
+static const void *hsx_tenant_save(struct hsx_tenant_call *c, const void *p,
+				   size_t len)
+{
+	char *to = c->data + (c->end - c->data + sizeof(long) - 1) /
+		   sizeof(long) * sizeof(long);
+
+	memcpy(to, p, len);
+	c->end = to + len;
+
+	return to;
+}
+
+static void hsx_tenant_save_fi(struct hsx_tenant_call *c,
+			       struct fuse_file_info *fi)
+{
+	if (fi == NULL)
+		return;
+	c->fi = *fi;
+	c->has_fi = 1;
+}
+
+static void hsx_tenant_queue(struct hsx_tenant_call *c)
+{
+	struct hsfs_super *sb = (struct hsfs_super *)fuse_req_userdata(c->req);
+	struct hsx_tenants *tt = sb->tenants;
+	struct hsx_tenant_call **pos;
+
+	pthread_mutex_lock(&tt->lock);
+	for (pos = &tt->queue; *pos && (*pos)->due <= c->due;
+	     pos = &(*pos)->next)
+		;
+	c->next = *pos;
+	*pos = c;
+	/* A new head, the sleeping dispatcher may now wait less */
+	if (pos == &tt->queue)
+		pthread_cond_signal(&tt->cond);
+	pthread_mutex_unlock(&tt->lock);
+}
+
+static void hsx_tenant_run(struct hsx_tenant_call *c)
+{
+	struct fuse_lowlevel_ops *op = &hsx_tenant_base;
+	struct fuse_file_info *fi = c->has_fi ? &c->fi : NULL;
+
+	switch (c->op) {
+	case HSX_TENANT_ACCESS:
+		op->access(c->req, c->ino, c->arg);
+		break;
+	case HSX_TENANT_CREATE:
+		op->create(c->req, c->ino, c->name, c->arg, fi);
+		break;
+	case HSX_TENANT_GETATTR:
+		op->getattr(c->req, c->ino, fi);
+		break;
+	case HSX_TENANT_GETXATTR:
+		op->getxattr(c->req, c->ino, c->name, c->size);
+		break;
+	case HSX_TENANT_IOCTL:
+		op->ioctl(c->req, c->ino, c->arg, c->ptr, fi, c->uarg,
+			  c->buf, c->size, c->size2);
+		break;
+	case HSX_TENANT_LINK:
+		op->link(c->req, c->ino, c->ino2, c->name2);
+		break;
+	case HSX_TENANT_LOOKUP:
+		op->lookup(c->req, c->ino, c->name);
+		break;
+	case HSX_TENANT_MKDIR:
+		op->mkdir(c->req, c->ino, c->name, c->arg);
+		break;
+	case HSX_TENANT_MKNOD:
+		op->mknod(c->req, c->ino, c->name, c->arg, c->rdev);
+		break;
+	case HSX_TENANT_OPEN:
+		op->open(c->req, c->ino, fi);
+		break;
+	case HSX_TENANT_OPENDIR:
+		op->opendir(c->req, c->ino, fi);
+		break;
+	case HSX_TENANT_READ:
+		op->read(c->req, c->ino, c->size, c->off, fi);
+		break;
+	case HSX_TENANT_READDIR:
+		op->readdir(c->req, c->ino, c->size, c->off, fi);
+		break;
+	case HSX_TENANT_READDIRPLUS:
+		op->readdirplus(c->req, c->ino, c->size, c->off, fi);
+		break;
+	case HSX_TENANT_READLINK:
+		op->readlink(c->req, c->ino);
+		break;
+	case HSX_TENANT_RENAME:
+		op->rename(c->req, c->ino, c->name, c->ino2, c->name2,
+			   c->uarg);
+		break;
+	case HSX_TENANT_RMDIR:
+		op->rmdir(c->req, c->ino, c->name);
+		break;
+	case HSX_TENANT_SETATTR:
+		op->setattr(c->req, c->ino, &c->attr, c->arg, fi);
+		break;
+	case HSX_TENANT_SETXATTR:
+		op->setxattr(c->req, c->ino, c->name, c->buf, c->size,
+			     c->arg);
+		break;
+	case HSX_TENANT_STATFS:
+		op->statfs(c->req, c->ino);
+		break;
+	case HSX_TENANT_SYMLINK:
+		op->symlink(c->req, c->name2, c->ino, c->name);
+		break;
+	case HSX_TENANT_UNLINK:
+		op->unlink(c->req, c->ino, c->name);
+		break;
+	case HSX_TENANT_WRITE:
+		op->write(c->req, c->ino, c->buf, c->size, c->off, fi);
+		break;
+	default:
+		ERR("Unknown throttled request %d.", c->op);
+		fuse_reply_err(c->req, ENOSYS);
+	}
+}
+
+static void *hsx_tenant_dispatch(void *arg)
+{
+	struct hsx_tenants *tt = arg;
+	struct hsx_tenant_call *c;
+	struct timespec ts;
+
+	pthread_mutex_lock(&tt->lock);
+	while (!tt->stop) {
+		c = tt->queue;
+		if (c == NULL) {
+			pthread_cond_wait(&tt->cond, &tt->lock);
+			continue;
+		}
+		if (c->due > __now_us()) {
+			ts.tv_sec = c->due / 1000000;
+			ts.tv_nsec = c->due % 1000000 * 1000;
+			pthread_cond_timedwait(&tt->cond, &tt->lock, &ts);
+			continue;
+		}
+		tt->queue = c->next;
+		/* Someone else may take the next one meanwhile */
+		if (tt->queue)
+			pthread_cond_signal(&tt->cond);
+		pthread_mutex_unlock(&tt->lock);
+
+		hsx_tenant_run(c);
+		free(c);
+
+		pthread_mutex_lock(&tt->lock);
+	}
+	pthread_mutex_unlock(&tt->lock);
+
+	return NULL;
+}
+
+static void hsx_tenant_access(fuse_req_t req, fuse_ino_t ino, int mask)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.access(req, ino, mask);
+		return;
+	}
+	c->op = HSX_TENANT_ACCESS;
+	c->ino = ino;
+	c->arg = mask;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_create(fuse_req_t req, fuse_ino_t parent,
+			      const char *name, mode_t mode,
+			      struct fuse_file_info *fi)
+{
+	size_t len = strlen(name) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len)) == NULL) {
+		hsx_tenant_base.create(req, parent, name, mode, fi);
+		return;
+	}
+	c->op = HSX_TENANT_CREATE;
+	c->ino = parent;
+	c->name = hsx_tenant_save(c, name, len);
+	c->arg = mode;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_getattr(fuse_req_t req, fuse_ino_t ino,
+			       struct fuse_file_info *fi)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.getattr(req, ino, fi);
+		return;
+	}
+	c->op = HSX_TENANT_GETATTR;
+	c->ino = ino;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_getxattr(fuse_req_t req, fuse_ino_t ino,
+				const char *name, size_t size)
+{
+	size_t len = strlen(name) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len)) == NULL) {
+		hsx_tenant_base.getxattr(req, ino, name, size);
+		return;
+	}
+	c->op = HSX_TENANT_GETXATTR;
+	c->ino = ino;
+	c->name = hsx_tenant_save(c, name, len);
+	c->size = size;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd,
+			     void *arg, struct fuse_file_info *fi,
+			     unsigned flags, const void *in_buf,
+			     size_t in_bufsz, size_t out_bufsz)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, in_bufsz)) == NULL) {
+		hsx_tenant_base.ioctl(req, ino, cmd, arg, fi, flags, in_buf,
+				      in_bufsz, out_bufsz);
+		return;
+	}
+	c->op = HSX_TENANT_IOCTL;
+	c->ino = ino;
+	c->arg = cmd;
+	c->ptr = arg;
+	hsx_tenant_save_fi(c, fi);
+	c->uarg = flags;
+	if (in_bufsz)
+		c->buf = hsx_tenant_save(c, in_buf, in_bufsz);
+	c->size = in_bufsz;
+	c->size2 = out_bufsz;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_link(fuse_req_t req, fuse_ino_t ino,
+			    fuse_ino_t newparent, const char *newname)
+{
+	size_t len = strlen(newname) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len)) == NULL) {
+		hsx_tenant_base.link(req, ino, newparent, newname);
+		return;
+	}
+	c->op = HSX_TENANT_LINK;
+	c->ino = ino;
+	c->ino2 = newparent;
+	c->name2 = hsx_tenant_save(c, newname, len);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_lookup(fuse_req_t req, fuse_ino_t parent,
+			      const char *name)
+{
+	size_t len = strlen(name) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len)) == NULL) {
+		hsx_tenant_base.lookup(req, parent, name);
+		return;
+	}
+	c->op = HSX_TENANT_LOOKUP;
+	c->ino = parent;
+	c->name = hsx_tenant_save(c, name, len);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_mkdir(fuse_req_t req, fuse_ino_t parent,
+			     const char *name, mode_t mode)
+{
+	size_t len = strlen(name) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len)) == NULL) {
+		hsx_tenant_base.mkdir(req, parent, name, mode);
+		return;
+	}
+	c->op = HSX_TENANT_MKDIR;
+	c->ino = parent;
+	c->name = hsx_tenant_save(c, name, len);
+	c->arg = mode;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_mknod(fuse_req_t req, fuse_ino_t parent,
+			     const char *name, mode_t mode, dev_t rdev)
+{
+	size_t len = strlen(name) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len)) == NULL) {
+		hsx_tenant_base.mknod(req, parent, name, mode, rdev);
+		return;
+	}
+	c->op = HSX_TENANT_MKNOD;
+	c->ino = parent;
+	c->name = hsx_tenant_save(c, name, len);
+	c->arg = mode;
+	c->rdev = rdev;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_open(fuse_req_t req, fuse_ino_t ino,
+			    struct fuse_file_info *fi)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.open(req, ino, fi);
+		return;
+	}
+	c->op = HSX_TENANT_OPEN;
+	c->ino = ino;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_opendir(fuse_req_t req, fuse_ino_t ino,
+			       struct fuse_file_info *fi)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.opendir(req, ino, fi);
+		return;
+	}
+	c->op = HSX_TENANT_OPENDIR;
+	c->ino = ino;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+			    off_t off, struct fuse_file_info *fi)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, size, 0)) == NULL) {
+		hsx_tenant_base.read(req, ino, size, off, fi);
+		return;
+	}
+	c->op = HSX_TENANT_READ;
+	c->ino = ino;
+	c->size = size;
+	c->off = off;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+			       off_t off, struct fuse_file_info *fi)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.readdir(req, ino, size, off, fi);
+		return;
+	}
+	c->op = HSX_TENANT_READDIR;
+	c->ino = ino;
+	c->size = size;
+	c->off = off;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_readdirplus(fuse_req_t req, fuse_ino_t ino,
+				   size_t size, off_t off,
+				   struct fuse_file_info *fi)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.readdirplus(req, ino, size, off, fi);
+		return;
+	}
+	c->op = HSX_TENANT_READDIRPLUS;
+	c->ino = ino;
+	c->size = size;
+	c->off = off;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.readlink(req, ino);
+		return;
+	}
+	c->op = HSX_TENANT_READLINK;
+	c->ino = ino;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_rename(fuse_req_t req, fuse_ino_t parent,
+			      const char *name, fuse_ino_t newparent,
+			      const char *newname, unsigned int flags)
+{
+	size_t len = strlen(name) + 1, newlen = strlen(newname) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len + newlen)) == NULL) {
+		hsx_tenant_base.rename(req, parent, name, newparent, newname,
+				       flags);
+		return;
+	}
+	c->op = HSX_TENANT_RENAME;
+	c->ino = parent;
+	c->name = hsx_tenant_save(c, name, len);
+	c->ino2 = newparent;
+	c->name2 = hsx_tenant_save(c, newname, newlen);
+	c->uarg = flags;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_rmdir(fuse_req_t req, fuse_ino_t parent,
+			     const char *name)
+{
+	size_t len = strlen(name) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len)) == NULL) {
+		hsx_tenant_base.rmdir(req, parent, name);
+		return;
+	}
+	c->op = HSX_TENANT_RMDIR;
+	c->ino = parent;
+	c->name = hsx_tenant_save(c, name, len);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_setattr(fuse_req_t req, fuse_ino_t ino,
+			       struct stat *attr, int to_set,
+			       struct fuse_file_info *fi)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.setattr(req, ino, attr, to_set, fi);
+		return;
+	}
+	c->op = HSX_TENANT_SETATTR;
+	c->ino = ino;
+	c->attr = *attr;
+	c->arg = to_set;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_setxattr(fuse_req_t req, fuse_ino_t ino,
+				const char *name, const char *value,
+				size_t size, int flags)
+{
+	size_t len = strlen(name) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len + size)) == NULL) {
+		hsx_tenant_base.setxattr(req, ino, name, value, size, flags);
+		return;
+	}
+	c->op = HSX_TENANT_SETXATTR;
+	c->ino = ino;
+	c->name = hsx_tenant_save(c, name, len);
+	c->buf = hsx_tenant_save(c, value, size);
+	c->size = size;
+	c->arg = flags;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, 0)) == NULL) {
+		hsx_tenant_base.statfs(req, ino);
+		return;
+	}
+	c->op = HSX_TENANT_STATFS;
+	c->ino = ino;
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_symlink(fuse_req_t req, const char *link,
+			       fuse_ino_t parent, const char *name)
+{
+	size_t len = strlen(name) + 1, linklen = strlen(link) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len + linklen)) == NULL) {
+		hsx_tenant_base.symlink(req, link, parent, name);
+		return;
+	}
+	c->op = HSX_TENANT_SYMLINK;
+	c->ino = parent;
+	c->name = hsx_tenant_save(c, name, len);
+	c->name2 = hsx_tenant_save(c, link, linklen);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_unlink(fuse_req_t req, fuse_ino_t parent,
+			      const char *name)
+{
+	size_t len = strlen(name) + 1;
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, 0, len)) == NULL) {
+		hsx_tenant_base.unlink(req, parent, name);
+		return;
+	}
+	c->op = HSX_TENANT_UNLINK;
+	c->ino = parent;
+	c->name = hsx_tenant_save(c, name, len);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+			     size_t size, off_t off,
+			     struct fuse_file_info *fi)
+{
+	struct hsx_tenant_call *c;
+
+	if ((c = hsx_tenant_defer(req, size, size)) == NULL) {
+		hsx_tenant_base.write(req, ino, buf, size, off, fi);
+		return;
+	}
+	c->op = HSX_TENANT_WRITE;
+	c->ino = ino;
+	c->buf = hsx_tenant_save(c, buf, size);
+	c->size = size;
+	c->off = off;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+static void hsx_tenant_write_buf(fuse_req_t req, fuse_ino_t ino,
+				 struct fuse_bufvec *bufv, off_t off,
+				 struct fuse_file_info *fi)
+{
+	size_t size = fuse_buf_size(bufv);
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	struct hsx_tenant_call *c;
+	ssize_t res;
+
+	if ((c = hsx_tenant_defer(req, size, size)) == NULL) {
+		hsx_tenant_base.write_buf(req, ino, bufv, off, fi);
+		return;
+	}
+	/* The data may be in a pipe of this worker, take it out now */
+	dst.buf[0].mem = c->data;
+	res = fuse_buf_copy(&dst, bufv, 0);
+	if (res < 0) {
+		fuse_reply_err(req, -res);
+		free(c);
+		return;
+	}
+	c->op = HSX_TENANT_WRITE;
+	c->ino = ino;
+	c->buf = c->data;
+	c->size = res;
+	c->off = off;
+	hsx_tenant_save_fi(c, fi);
+	hsx_tenant_queue(c);
+}
+
+const struct fuse_lowlevel_ops *
+hsx_fuse_tenant_oper(const struct fuse_lowlevel_ops *base)
+{
+	struct fuse_lowlevel_ops *op = &hsx_tenant_oper;
+
+	hsx_tenant_base = *base;
+	*op = *base;
+	if (base->access)
+		op->access = hsx_tenant_access;
+	if (base->create)
+		op->create = hsx_tenant_create;
+	if (base->getattr)
+		op->getattr = hsx_tenant_getattr;
+	if (base->getxattr)
+		op->getxattr = hsx_tenant_getxattr;
+	if (base->ioctl)
+		op->ioctl = hsx_tenant_ioctl;
+	if (base->link)
+		op->link = hsx_tenant_link;
+	if (base->lookup)
+		op->lookup = hsx_tenant_lookup;
+	if (base->mkdir)
+		op->mkdir = hsx_tenant_mkdir;
+	if (base->mknod)
+		op->mknod = hsx_tenant_mknod;
+	if (base->open)
+		op->open = hsx_tenant_open;
+	if (base->opendir)
+		op->opendir = hsx_tenant_opendir;
+	if (base->read)
+		op->read = hsx_tenant_read;
+	if (base->readdir)
+		op->readdir = hsx_tenant_readdir;
+	if (base->readdirplus)
+		op->readdirplus = hsx_tenant_readdirplus;
+	if (base->readlink)
+		op->readlink = hsx_tenant_readlink;
+	if (base->rename)
+		op->rename = hsx_tenant_rename;
+	if (base->rmdir)
+		op->rmdir = hsx_tenant_rmdir;
+	if (base->setattr)
+		op->setattr = hsx_tenant_setattr;
+	if (base->setxattr)
+		op->setxattr = hsx_tenant_setxattr;
+	if (base->statfs)
+		op->statfs = hsx_tenant_statfs;
+	if (base->symlink)
+		op->symlink = hsx_tenant_symlink;
+	if (base->unlink)
+		op->unlink = hsx_tenant_unlink;
+	/* A throttled write_buf is resumed as a write */
+	if (base->write && base->write_buf)
+		op->write_buf = hsx_tenant_write_buf;
+	if (base->write)
+		op->write = hsx_tenant_write;
+
+	return op;
+}
@@ -38,9 +38,9 @@ void hsx_fuse_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
 		goto out;
 	}
 
-	if ((err = hsi_nfs3_unlink(hi, name))) {
-		goto out;
-	}
+	hsfs_dir_lock(hi);
+	err = hsi_nfs3_unlink(hi, name);
+	hsfs_dir_unlock(hi);
 out:
 	fuse_reply_err(req, err);
 	DEBUG_OUT(" %s errno:%d", name, err);
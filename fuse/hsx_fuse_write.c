@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <hsx_fuse.h>
 #include "hsi_nfs3.h"
+#include "hsfs_buf.h"
 
 void hsx_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
                           size_t size, off_t off, struct fuse_file_info *fi)
@@ -11,15 +12,8 @@ void hsx_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 	struct hsfs_super * sb = (struct hsfs_super *)fuse_req_userdata(req);
 	size_t cnt = 0;
 	int err = 0;
-	char * buffer = NULL;
 	
 	DEBUG_IN("offset 0x%x size 0x%x", (unsigned int)off, (unsigned int)size);
-	buffer = (char *) malloc(sb->wsize);
-	if( NULL == buffer){
-		err = ENOMEM;
-		fuse_reply_err(req, err);
-		goto out;
-	}
 	
 	memset(&winfo, 0, sizeof(struct hsfs_rw_info));
 	if(fi->direct_io)
@@ -32,14 +26,15 @@ void hsx_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 		goto out;
 	}
 	DEBUG("ino %lu", winfo.inode->ino);	
+	hsx_fuse_smallfile_drop(hsx_fuse_file(fi));
 	while(cnt < size){
 		size_t tmp_size = min(size - cnt, sb->wsize);
 		
 		winfo.rw_size = tmp_size;
 		winfo.rw_off = off + cnt;
-		memcpy(buffer, buf + cnt, tmp_size);
+		/* Only encoded from, the request's buffer will do. */
 		winfo.data.data_len = tmp_size;
-		winfo.data.data_val = buffer;
+		winfo.data.data_val = (char *)buf + cnt;
 		err = hsi_nfs3_write(&winfo);
 		
 		if(err){
@@ -52,11 +47,40 @@ void hsx_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 
 	fuse_reply_write(req, cnt);
 out:	
-	if(NULL != buffer)
-		free(buffer);
-	
 	DEBUG_OUT("err %d", err);		
 	return;
 
 }
 
+void hsx_fuse_write_buf(fuse_req_t req, fuse_ino_t ino,
+			struct fuse_bufvec *bufv, off_t off,
+			struct fuse_file_info *fi)
+{
+	struct fuse_buf *src = &bufv->buf[bufv->idx];
+	size_t size = fuse_buf_size(bufv);
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+	ssize_t res;
+	char *buffer;
+
+	/* Read from /dev/fuse, the data is in memory already. */
+	if (bufv->count - bufv->idx == 1 && !(src->flags & FUSE_BUF_IS_FD)) {
+		hsx_fuse_write(req, ino, (char *)src->mem + bufv->off,
+			       size, off, fi);
+		return;
+	}
+
+	/* Spliced, copy it out of the pipe once, into a pooled buffer. */
+	buffer = hsfs_buf_get(size);
+	if (buffer == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	dst.buf[0].mem = buffer;
+	res = fuse_buf_copy(&dst, bufv, 0);
+	if (res < 0)
+		fuse_reply_err(req, -res);
+	else
+		hsx_fuse_write(req, ino, buffer, res, off, fi);
+	hsfs_buf_put(buffer, size);
+}
+
@@ -21,6 +21,7 @@
 
 #include <hsfs/types.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <sys/statvfs.h>
 #include <sys/stat.h>
@@ -82,6 +83,16 @@ extern unsigned int HSFS_PAGE_SIZE;
 #define HSFS_DEF_FILE_IO_SIZE	(4096U)
 #define HSFS_MIN_FILE_IO_SIZE	(1024U)
 
+/* Server addresses of the addrs= and multipath mount options */
+#define HSFS_MAX_PATHS	16
+
+/* What the tenant= mount option keys rate limits by */
+#define HSX_TENANT_UID	0
+#define HSX_TENANT_PID	1
+
+/* Upper bound of the readahead= mount option */
+#define HSFS_MAX_READAHEAD	(32U * HSFS_MAX_FILE_IO_SIZE)
+
 /*
  * Maximum number of pages that readdir can use for creating
  * a vmapped array of pages.
@@ -127,6 +138,13 @@ struct hsfs_inode
 	uint64_t          ino;
 	dev_t i_rdev;
 	unsigned long     generation;
+	unsigned long fh_key;		/* Of fh_hash */
+	struct hsfs_inode *reclaim_next;	/* While I_RECLAIM */
+	pthread_rwlock_t i_dirlock;	/* See hsfs_dir_lock() */
+	int i_listed;			/* Listing the kernel may cache, atomic */
+	uint64_t i_parent;		/* Last looked up in, see hsfs_iname() */
+	char *i_name;
+	struct hlist_node name_hash;	/* By i_parent, once named */
   
 };
 
@@ -145,6 +163,8 @@ static inline off_t i_size_read(const struct hsfs_inode *inode)
 }
 
 #define I_NEW (1UL << 3)
+/* Forgotten by the kernel, on its way to the reclaimer */
+#define I_RECLAIM (1UL << 4)
 
 /**
  *is_bad_inode - is an inode errored
@@ -158,6 +178,47 @@ static inline int is_bad_inode(struct hsfs_inode *inode)
 	return (inode->ino == 0);
 }
 
+/*
+ * The kernel lets lookups and readdirs of a directory run in parallel
+ * (FUSE_CAP_PARALLEL_DIROPS): they take its i_dirlock shared, while the
+ * operations changing the entries of the directory take it exclusive.
+ */
+static inline void hsfs_dir_lock_shared(struct hsfs_inode *dir)
+{
+	pthread_rwlock_rdlock(&dir->i_dirlock);
+}
+
+static inline void hsfs_dir_lock(struct hsfs_inode *dir)
+{
+	pthread_rwlock_wrlock(&dir->i_dirlock);
+}
+
+static inline void hsfs_dir_unlock(struct hsfs_inode *dir)
+{
+	pthread_rwlock_unlock(&dir->i_dirlock);
+}
+
+/* Both directories of a rename, always in the same order. */
+static inline void hsfs_dir_lock2(struct hsfs_inode *a, struct hsfs_inode *b)
+{
+	if (a == b) {
+		hsfs_dir_lock(a);
+	} else if (a->ino < b->ino) {
+		hsfs_dir_lock(a);
+		hsfs_dir_lock(b);
+	} else {
+		hsfs_dir_lock(b);
+		hsfs_dir_lock(a);
+	}
+}
+
+static inline void hsfs_dir_unlock2(struct hsfs_inode *a, struct hsfs_inode *b)
+{
+	hsfs_dir_unlock(a);
+	if (a != b)
+		hsfs_dir_unlock(b);
+}
+
 struct  hsfs_table
 {
   struct hsfs_inode  **array;
@@ -171,6 +232,12 @@ struct  hsfs_table
 #define HSFS_ID_HASH_SIZE (1 << HSFS_ID_HASH_BITS)
 
 struct nfs_fattr;
+struct fuse_session;
+struct hsi_nfs3_rtt;
+struct hsi_nfs3_limit;
+struct hsi_nfs3_hedge;
+struct hsx_tenants;
+struct hsx_ra;
 struct hsfs_super_ops
 {
 	struct hsfs_inode *(*alloc_inode)(struct hsfs_super *sb);
@@ -183,16 +250,37 @@ struct hsfs_super
 {
 	DECLARE_HASHTABLE(fh_table, HSFS_FH_HASH_BITS); /* For HSFS iget5 */
 	DECLARE_HASHTABLE(id_table, HSFS_ID_HASH_BITS);	/* For HSFS iget/ilookup */
+	DECLARE_HASHTABLE(name_table, HSFS_ID_HASH_BITS); /* For hsfs_ichildren */
 	struct hsfs_super_ops *sop;
 	unsigned int version;
 	void *private;
+	struct fuse_session *se;	/* For kernel cache notifications */
+	/* Called when an inode is seen changed on the server, or NULL */
+	void (*changed)(struct hsfs_inode *inode);
 
 	/* XXX need protected by mutex */
 	unsigned long curr_id;
+	/* Read to walk the hash tables, written to change them */
+	pthread_rwlock_t icache_lock;
+	/* The names of inodes and name_table */
+	pthread_mutex_t name_lock;
+	/* Inodes forgotten by the kernel, freed in batches off requests */
+	struct hsfs_inode *reclaim;
+	pthread_mutex_t reclaim_lock;
+	pthread_cond_t reclaim_cond;
+	int reclaim_stop;
+	pthread_t reclaimer;
 
 	/* XXX Should put them into nfs_super */
   CLIENT *clntp;
   CLIENT *acl_clntp;
+  /* Retransmit timers of clntp and acl_clntp */
+  struct hsi_nfs3_rtt *rtt;
+  struct hsi_nfs3_rtt *acl_rtt;
+  /* Adaptive limit of the calls outstanding on clntp */
+  struct hsi_nfs3_limit *limit;
+  /* Hedging of slow idempotent calls on clntp, NULL when off */
+  struct hsi_nfs3_hedge *hedging;
   int    flags;
   /* for read/write */
   unsigned int    rsize;
@@ -202,15 +290,50 @@ struct hsfs_super
    */
   int	 timeo;
   int    retrans;
+  /* Transports opened to the server */
+  int	 nconnect;
+  /* Percent of idempotent calls which may be sent twice */
+  unsigned int	 hedge;
   int	 acregmin;
   int	 acregmax;
   int	 acdirmin;
   int	 acdirmax;
   struct sockaddr_in	addr;
+  /* Addresses the server is reached at, addr among them */
+  struct sockaddr_in	paths[HSFS_MAX_PATHS];
+  int			npaths;
   /* for statfs */
   int	 namlen;
   /* Readdir size */
   unsigned int	 dtsize;
+  /* Bytes pushed into the kernel page cache ahead of a sequential reader */
+  unsigned int	 readahead;
+  /* Regular files up to this size are read whole on open */
+  unsigned int	 smallfile;
+  /* HSFS_BUF_* flags for the I/O buffer pool */
+  int		 bufflags;
+  /* Take FUSE requests over io_uring, entries per queue (0 for default) */
+  int		 io_uring;
+  unsigned int	 io_uring_depth;
+  /* Serve requests with a worker bound to each CPU */
+  int		 percpu;
+  /* Run those workers as reactors, continuing calls on their replies */
+  int		 reactor;
+  /* Splice request and reply data to and from /dev/fuse */
+  int		 splice;
+  /* Per tenant requests/s and KiB/s, 0 for no limit */
+  unsigned int	 tenant_ops;
+  unsigned int	 tenant_bw;
+  int		 tenant_key;	/* HSX_TENANT_* */
+  struct hsx_tenants *tenants;
+  /* Kernel cache invalidations waiting to be sent */
+  struct hsx_notify *notify;
+  /* Kernel attribute and entry timeout with notify, 0 to use ac* */
+  unsigned int	 kcache;
+  /* Prefetch jobs asked through HSFS_IOC_PREFETCH */
+  struct hsx_advise *advise;
+  /* Readahead windows waiting to be read */
+  struct hsx_ra *ra;
   unsigned int	    bsize;
   unsigned char	    bsize_bits;
   struct hsfs_inode *root;
@@ -268,15 +391,82 @@ unsigned long hsfs_block_size(unsigned long bsize, unsigned char *nrbitsp);
 #define min(x, y) ((x) < (y) ? (x) : (y))
 extern int hsfs_init_icache(struct hsfs_super *sb);
 
+/**
+ * @brief Stop the reclaimer of the inode cache, freeing what it holds
+ *
+ * @param sb[IN] the hsfs superblock
+ **/
+extern void hsfs_destroy_icache(struct hsfs_super *sb);
+
+/**
+ * @brief Drop lookups of the kernel on an inode
+ *
+ * When none is left and nothing references it (i_count), the inode is
+ * handed to the reclaimer: unhashed and freed later, in a batch, unless
+ * it was looked up or referenced again by then.
+ *
+ * @param inode[IN] the hsfs inode
+ * @param nlookup[IN] the lookups the kernel forgot
+ * @return the lookups left
+ **/
+extern unsigned long hsfs_iforget(struct hsfs_inode *inode,
+				  unsigned long nlookup);
+
+/**
+ * @brief Remember the name an inode was last looked up by
+ *
+ * So that the kernel can be told to drop that entry, see hsfs_ichildren().
+ *
+ * @param inode[IN] the hsfs inode
+ * @param dir[IN] the directory it was found in
+ * @param name[IN] its name there
+ **/
+extern void hsfs_iname(struct hsfs_inode *inode, struct hsfs_inode *dir,
+		       const char *name);
+
+/**
+ * @brief Walk the names last looked up in a directory
+ *
+ * @param sb[IN] the hsfs superblock
+ * @param dir[IN] the ino of the directory
+ * Only the inodes named in that directory are walked, under a lock of
+ * their own: the inode cache stays free for lookups meanwhile.
+ *
+ * @param fn[IN] called for each name with the names locked, must not block
+ * @param arg[IN] passed to fn
+ **/
+extern void hsfs_ichildren(struct hsfs_super *sb, uint64_t dir,
+			   void (*fn)(void *arg, const char *name), void *arg);
+
+/**
+ * @brief The directory an inode was last looked up in
+ *
+ * @param inode[IN] the hsfs inode, referenced
+ * @return its ino, 0 when the inode has no name yet
+ **/
+extern uint64_t hsfs_iparent(struct hsfs_inode *inode);
+
 /**
  * @brief Lookup the inode cache with ino
  *
+ * No reference is taken: only for an ino the kernel holds, as it does
+ * for the inos of the requests it sends.
+ *
  * @param sb[IN] the hsfs superblock
  * @param ino[IN] the hsfs number (non-persistent)
  * @return the pointer to the hsfs inode found if success, else NULL 
  **/
 extern struct hsfs_inode *hsfs_ilookup(struct hsfs_super *sb, uint64_t ino);
 
+/**
+ * @brief Lookup the inode cache with ino, taking a reference
+ *
+ * @param sb[IN] the hsfs superblock
+ * @param ino[IN] the hsfs number (non-persistent)
+ * @return the hsfs inode, to drop with hsfs_iput(), else NULL
+ **/
+extern struct hsfs_inode *hsfs_iget(struct hsfs_super *sb, uint64_t ino);
+
 
 /**
  * iget5_locked - obtain an inode from a mounted file system
@@ -306,9 +496,8 @@ struct hsfs_inode *hsfs_iget5_locked(struct hsfs_super *sb, unsigned long hashva
  *@inode: inode to put
  *
  *Puts an inode, dropping its usage count. If the inode use count hits
- *zero, the inode is then freed and may also be destroyed.
- *
- *Consequently, iput() can sleep.
+ *zero and the kernel does not know it either, the inode is handed to
+ *the reclaimer, see hsfs_iforget(). The inode must not be used after.
  */
 void hsfs_iput(struct hsfs_inode *inode);
 void hsfs_unlock_new_inode(struct hsfs_inode *inode);
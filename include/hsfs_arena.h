@@ -0,0 +1,61 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HSFS_ARENA_H__
+#define __HSFS_ARENA_H__
+
+#include <stddef.h>
+
+/*
+ * Per thread bump allocator for memory that lives no longer than the
+ * request being handled. A handler takes a mark before it starts and
+ * releases it once the reply is sent; everything allocated in between
+ * goes away at once. Nothing allocated here may be kept in an inode or
+ * any other long lived structure.
+ */
+struct hsfs_arena_chunk;
+
+struct hsfs_arena_mark {
+	struct hsfs_arena_chunk *chunk;
+	size_t used;
+};
+
+/**
+ * @brief Remember the current top of this thread's arena
+ *
+ * @param mark[out] where to save it
+ **/
+extern void hsfs_arena_mark(struct hsfs_arena_mark *mark);
+
+/**
+ * @brief Free everything allocated since mark was taken
+ *
+ * @param mark[in] taken by hsfs_arena_mark() on this thread
+ **/
+extern void hsfs_arena_release(const struct hsfs_arena_mark *mark);
+
+/**
+ * @brief Allocate from this thread's arena
+ *
+ * @param size[in] bytes needed
+ *
+ * @return 16 bytes aligned memory or NULL
+ **/
+extern void *hsfs_arena_alloc(size_t size);
+
+#endif /* __HSFS_ARENA_H__ */
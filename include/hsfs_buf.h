@@ -0,0 +1,68 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HSFS_BUF_H__
+#define __HSFS_BUF_H__
+
+#include <stddef.h>
+
+/*
+ * I/O buffer pool for the read/write data path.
+ *
+ * Buffers come in power of two size classes from HSFS_BUF_MIN to
+ * HSFS_BUF_MAX. Each thread keeps a small cache per class, backed by a
+ * per NUMA node depot, which is refilled by carving 2MiB slabs. Getting
+ * and putting a buffer takes no syscall and no lock in the common case.
+ * Larger requests fall back to malloc().
+ */
+#define HSFS_BUF_MIN_SHIFT	12
+#define HSFS_BUF_MAX_SHIFT	20
+#define HSFS_BUF_MIN		(1UL << HSFS_BUF_MIN_SHIFT)
+#define HSFS_BUF_MAX		(1UL << HSFS_BUF_MAX_SHIFT)
+
+/* Flags for hsfs_buf_init() */
+#define HSFS_BUF_HUGEPAGE	(1 << 0)	/* madvise(MADV_HUGEPAGE) slabs */
+#define HSFS_BUF_MLOCK		(1 << 1)	/* mlock() slabs */
+
+/**
+ * @brief Set up the buffer pool
+ *
+ * @param flags[in] HSFS_BUF_* flags
+ *
+ * @return error number
+ **/
+extern int hsfs_buf_init(int flags);
+
+/**
+ * @brief Borrow a buffer of at least size bytes
+ *
+ * @param size[in] bytes needed
+ *
+ * @return the buffer or NULL
+ **/
+extern void *hsfs_buf_get(size_t size);
+
+/**
+ * @brief Return a buffer taken with hsfs_buf_get()
+ *
+ * @param buf[in] the buffer, may be NULL
+ * @param size[in] the size passed to hsfs_buf_get()
+ **/
+extern void hsfs_buf_put(void *buf, size_t size);
+
+#endif /* __HSFS_BUF_H__ */
@@ -0,0 +1,112 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ioctls of a mounted nfs-fuse, issued on an open file or directory of it.
+ *
+ * FUSE only passes ioctls whose argument size is encoded in the command,
+ * at most 16 KiB, so each one takes a fixed size structure in and out.
+ * Shared by the daemon and nfs-fuse-ctl(1): fixed width types only.
+ */
+#ifndef __HSFS_IOCTL_H__
+#define __HSFS_IOCTL_H__
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#define HSFS_IOC_MAGIC		'N'
+
+/* Names of one HSFS_IOC_BSTAT call */
+#define HSFS_BSTAT_MAX		128
+/* Bytes for all of them, each terminated by a NUL */
+#define HSFS_BSTAT_NAMES	14336
+
+/* One stat record of HSFS_IOC_BSTAT, as stat(2) would have returned */
+struct hsfs_bstat {
+	int32_t  err;		/* errno, the rest is valid when 0 */
+	uint32_t mode;
+	uint64_t handle;	/* To pass as parent, while in use */
+	uint64_t ino;
+	uint64_t size;
+	uint64_t blocks;
+	uint32_t nlink;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t blksize;
+	uint64_t rdev;
+	int64_t  atime;
+	int64_t  mtime;
+	int64_t  ctime;
+	uint32_t atime_ns;
+	uint32_t mtime_ns;
+	uint32_t ctime_ns;
+	uint32_t pad;
+};
+
+struct hsfs_bstat_args {
+	uint32_t count;		/* Names in, records out */
+	uint32_t flags;		/* None yet, must be 0 */
+	union {
+		struct {
+			/*
+			 * The handle of the directory to look each name up
+			 * in, 0 for the one the ioctl is issued on. Any
+			 * other must have been looked up from that one. A
+			 * name may be a relative path, without "..".
+			 */
+			uint64_t parent[HSFS_BSTAT_MAX];
+			char names[HSFS_BSTAT_NAMES];
+		} in;
+		struct hsfs_bstat out[HSFS_BSTAT_MAX];
+	} u;
+};
+
+/* Stat up to HSFS_BSTAT_MAX names at once, looked up concurrently. */
+#define HSFS_IOC_BSTAT		_IOWR(HSFS_IOC_MAGIC, 1, struct hsfs_bstat_args)
+
+struct hsfs_prefetch_args {
+	uint64_t off;		/* Start of the range */
+	uint64_t len;		/* Bytes, 0 for up to the end of file */
+	uint64_t id;		/* Out: the job, 0 if nothing to read */
+};
+
+struct hsfs_prefetch_status {
+	uint64_t id;		/* The job, 0 for all of the caller's */
+	uint32_t jobs;		/* Out: queued or running */
+	uint32_t pad;
+	uint64_t done;		/* Out: bytes read ahead */
+	uint64_t total;		/* Out: bytes asked */
+};
+
+/*
+ * Read a range of an open regular file into the kernel page cache in
+ * the background, at a low priority. Queued jobs run one at a time, and
+ * EAGAIN is returned when too many are. A job belongs to the caller's
+ * uid: only that uid and root see or cancel it.
+ */
+#define HSFS_IOC_PREFETCH	_IOWR(HSFS_IOC_MAGIC, 2, struct hsfs_prefetch_args)
+/*
+ * Progress of a job, or summed over all the jobs of the caller still
+ * queued when id is 0. A job finished or cancelled is not found any more.
+ */
+#define HSFS_IOC_PREFETCH_STATUS \
+	_IOWR(HSFS_IOC_MAGIC, 3, struct hsfs_prefetch_status)
+/* Cancel a job, or all of the caller's with 0. */
+#define HSFS_IOC_PREFETCH_CANCEL _IOW(HSFS_IOC_MAGIC, 4, uint64_t)
+
+#endif
@@ -150,6 +150,7 @@ static inline blkcnt_t nfs_calc_block_size(uint64_t tsize)
 	return (used > LLONG_MAX) ? LLONG_MAX : used;
 }
 
+/* The inode comes with a reference, dropped with hsfs_iput() */
 struct hsfs_inode *
 hsi_nfs_fhget(struct hsfs_super *sb, struct nfs_fh *fh, struct nfs_fattr *fattr);
 
@@ -1,11 +1,14 @@
 #ifndef __HSI_NFS3_H__
 #define __HSI_NFS3_H__
 
+#include <pthread.h>
+
 #include "hsfs.h"
 #include <hsfs_nfs.h>
 
 #include "acl3.h"
 #include "acl.h"
+#include "conn.h"
 /**
  * @brief Make a directory
  *
@@ -74,7 +77,8 @@ extern int hsi_rpc_stat_to_errno(CLIENT *clntp);
  * @brief Read the contents of the symbolic link
  *
  * @param inode[in]		the struct hsfs_inode of the symbolic link 
- * @param link[out]		the contents of the symbolic link
+ * @param link[out]		the contents of the symbolic link, in the
+ *				request arena (see hsfs_arena.h)
  *
  * @return error number
  **/
@@ -104,6 +108,26 @@ extern int hsi_nfs3_symlink(struct hsfs_inode *parent, struct hsfs_inode **new,
  **/
 extern int hsi_nfs3_read(struct hsfs_rw_info* rw);
 
+/**
+ * @brief Set up the arguments of a READ, as hsi_nfs3_read() sends it
+ *
+ * @param rw[in] the read operation, data pointing to the buffer
+ * @param args[out] arguments of the call
+ * @param res[out] result, set to decode into the buffer
+ **/
+extern void hsi_nfs3_read_prepare(struct hsfs_rw_info *rw,
+				  struct read3args *args, struct read3res *res);
+
+/**
+ * @brief Take the result of a READ made from hsi_nfs3_read_prepare()
+ *
+ * @param rw[in,out] the read operation, its counts filled on success
+ * @param res[in] the decoded result, freed
+ *
+ * @return error number
+ **/
+extern int hsi_nfs3_read_finish(struct hsfs_rw_info *rw, struct read3res *res);
+
 
 /**  
  * @brief Write file
@@ -212,6 +236,18 @@ extern struct hsfs_inode *hsi_nfs3_ifind(struct hsfs_super *sb, nfs_fh3 *fh,
  */
 extern int hsi_nfs3_getattr(struct hsfs_inode *inode, struct stat *st);
 
+/**
+ * @brief Take the result of a GETATTR sent on an inode's handle
+ *
+ * @param inode[in,out] the inode, its attributes refreshed
+ * @param res[in] the decoded result, freed
+ * @param st[out] the attributes
+ *
+ * @return error number
+ */
+extern int hsi_nfs3_getattr_finish(struct hsfs_inode *inode,
+				   struct getattr3res *res, struct stat *st);
+
 /**
  * @brief Convert struct fattr3 to struct stat
  *                                                                                                                                         
@@ -296,6 +332,17 @@ extern int hsi_nfs3_fsinfo(struct hsfs_super *sb, struct nfs_fh3 *fh, struct nfs
  */
 extern int hsi_nfs3_pathconf(struct hsfs_inode *inode);
 
+/**
+ * @brief Completion of a submitted call
+ *
+ * Runs in the thread reading the replies: it must not block, and should
+ * only hand the call over to its owner.
+ *
+ * @param priv[in]	given at submission
+ * @param st[in]	RPC_SUCCESS with the result decoded, else the failure
+ */
+typedef void (*hsi_nfs3_done_t)(void *priv, enum clnt_stat st);
+
 /**
  * @brief Potting clnt_call
  *
@@ -314,6 +361,375 @@ extern int hsi_nfs3_clnt_call(struct hsfs_super *sb, CLIENT *clnt,
 				xdrproc_t inproc, char *in,
 				xdrproc_t outproc, char *out);
 
+/**
+ * @brief Start a call of hsi_nfs3_clnt_call() without waiting for it
+ *
+ * The call is sent once, under the concurrency limit and the RTT based
+ * timeout, but is neither shared with an identical one, hedged nor
+ * retried: on any failure done gets it back and the owner is expected to
+ * make it again with hsi_nfs3_clnt_call().
+ *
+ * @param sb[in]	super block of hsfs
+ * @param clnt[in]	CLIENT info
+ * @param procnum[in]	NFS procedure number
+ * @param inproc[in]	encoder of the arguments
+ * @param in[in]	the arguments
+ * @param outproc[in]	decoder of the results
+ * @param out[out]	the results, valid until done runs
+ * @param done[in]	run once when the call ends, from the reply reader
+ * @param priv[in]	passed to done
+ *
+ * @return 0 if started, else the call must be made with
+ * hsi_nfs3_clnt_call() and done is never run
+ */
+extern int hsi_nfs3_clnt_submit(struct hsfs_super *sb, CLIENT *clnt,
+				unsigned long procnum,
+				xdrproc_t inproc, char *in,
+				xdrproc_t outproc, char *out,
+				hsi_nfs3_done_t done, void *priv);
+
+/**
+ * @brief Connect to a server and check it answers NULLPROC
+ *
+ * @param nfs_server[in]	address and program of the server
+ * @param ssize[in]	send buffer size
+ * @param rsize[in]	receive buffer size
+ *
+ * @return the CLIENT or NULL
+ */
+extern CLIENT *hsi_nfs3_clnt_create(clnt_addr_t *nfs_server, int ssize,
+				    int rsize);
+
+/**
+ * @brief Open a TCP transport carrying many calls at once
+ *
+ * Calls from any number of threads are written out together and matched
+ * to their replies by xid. CLSET_XID and CLGET_XID act per thread.
+ *
+ * @param saddr[in]	address of the server, port 0 to ask its portmapper
+ * @param prog[in]	RPC program
+ * @param vers[in]	program version
+ *
+ * @return the CLIENT, without cl_auth, or NULL with rpc_createerr set
+ */
+extern CLIENT *hsi_nfs3_mux_create(struct sockaddr_in *saddr, u_long prog,
+				   u_long vers);
+
+/**
+ * @brief Tell whether a transport is one of hsi_nfs3_mux_create()
+ *
+ * @param clnt[in]	the transport
+ *
+ * @return 1 if calls may be made on it concurrently
+ */
+extern int hsi_nfs3_is_mux(CLIENT *clnt);
+
+/**
+ * @brief Send a call on a multiplexed transport without waiting for it
+ *
+ * The arguments are encoded before returning. The result is decoded by
+ * the reply reader into res, which must stay valid until done runs; done
+ * may run before this returns.
+ *
+ * @param cl[in]	a transport of hsi_nfs3_mux_create()
+ * @param proc[in]	procedure number
+ * @param xargs[in]	encoder of the arguments
+ * @param args[in]	the arguments
+ * @param xres[in]	decoder of the result
+ * @param res[out]	the result
+ * @param tout[in]	time to wait for the reply
+ * @param done[in]	run once when the call ends, however it ends
+ * @param priv[in]	passed to done
+ *
+ * @return 0 if submitted, else the error and done is never run
+ */
+extern int hsi_nfs3_mux_submit(CLIENT *cl, rpcproc_t proc, xdrproc_t xargs,
+			       void *args, xdrproc_t xres, void *res,
+			       struct timeval tout, hsi_nfs3_done_t done,
+			       void *priv);
+
+/**
+ * @brief Create a reconnecting connection to a server
+ *
+ * The returned CLIENT stays valid for the life of the mount. When the
+ * transport breaks, calls park until a background thread reconnects and
+ * are then resent with their original xid.
+ *
+ * nconnect transports are opened, spread over the paths, and each call
+ * takes the one with the fewest bytes outstanding. TCP transports carry
+ * many calls at once, UDP ones a call at a time. Transports much slower than the
+ * best one or failing are drained.
+ *
+ * @param server[in]	address and program of the server
+ * @param ssize[in]	send buffer size
+ * @param rsize[in]	receive buffer size
+ * @param nconnect[in]	transports to open, up to HSI_NFS3_MAX_NCONNECT
+ * @param paths[in]	addresses of the server, NULL for server's only
+ * @param npaths[in]	number of paths
+ *
+ * @return the CLIENT or NULL
+ */
+extern CLIENT *hsi_nfs3_conn_create(clnt_addr_t *server, int ssize, int rsize,
+				    int nconnect,
+				    const struct sockaddr_in *paths,
+				    int npaths);
+
+/**
+ * @brief Set the error returned by CLNT_GETERR() on a connection
+ *
+ * For calls made on the connection by another thread on behalf of this
+ * one; the error is kept per thread.
+ *
+ * @param err[in]	the error of the call
+ */
+extern void hsi_nfs3_conn_seterr(const struct rpc_err *err);
+
+/**
+ * @brief Give the calling thread a home transport on each connection
+ *
+ * The calls of the thread start their search for a transport at the one
+ * of this slot instead of going round robin, so that a thread bound to a
+ * CPU keeps to the same socket while it is not the busiest.
+ *
+ * @param slot[in]	the slot, usually the CPU of the thread
+ */
+extern void hsi_nfs3_conn_home(int slot);
+
+/**
+ * @brief Steer the calling thread's next call on a connection
+ *
+ * @param slot[out]	where to store the slot of the transport the call
+ *			takes, as soon as it is taken, or NULL
+ * @param avoid[in]	slot of a transport to take only when no other one
+ *			is up, or -1
+ */
+extern void hsi_nfs3_conn_steer(int *slot, int avoid);
+
+/**
+ * @brief Send a call on a connection without waiting for it
+ *
+ * As hsi_nfs3_mux_submit(), on a transport of the connection chosen as
+ * for a call. Broken transports are reported to the reconnect thread but
+ * the call is not replayed: the owner redoes it with CLNT_CALL().
+ *
+ * @param cl[in]	a connection of hsi_nfs3_conn_create() or a transport
+ *			of hsi_nfs3_mux_create()
+ *
+ * @return 0 if submitted, EAGAIN if the connection is down, ENOTSUP if
+ * it does not multiplex, else the error; done is only run on 0
+ */
+extern int hsi_nfs3_conn_submit(CLIENT *cl, rpcproc_t proc, xdrproc_t xargs,
+				void *args, xdrproc_t xres, void *res,
+				struct timeval tout, hsi_nfs3_done_t done,
+				void *priv);
+
+/**
+ * @brief Allocate the adaptive concurrency limit of a connection
+ *
+ * @param max[in]	highest limit, the calls the connection can carry
+ *
+ * @return the limiter or NULL
+ */
+extern struct hsi_nfs3_limit *hsi_nfs3_limit_alloc(int max);
+extern void hsi_nfs3_limit_free(struct hsi_nfs3_limit *lim);
+
+/**
+ * @brief Wait until the scheduler lets one more call go
+ *
+ * @param lim[in]	the limiter
+ * @param cls[in]	class of the procedure, HSI_RTT_*
+ * @param bytes[in]	cost of the call, from hsi_nfs3_call_bytes()
+ */
+extern void hsi_nfs3_limit_acquire(struct hsi_nfs3_limit *lim, int cls,
+				   unsigned int bytes);
+
+/**
+ * @brief Take a slot only if one is free now and nobody waits
+ *
+ * @param lim[in]	the limiter
+ * @param cls[in]	class of the procedure, HSI_RTT_*
+ * @param bytes[in]	cost of the call, from hsi_nfs3_call_bytes()
+ *
+ * @return 1 if a slot was taken, to give back with hsi_nfs3_limit_release()
+ */
+extern int hsi_nfs3_limit_tryacquire(struct hsi_nfs3_limit *lim, int cls,
+				     unsigned int bytes);
+
+/**
+ * @brief Account the end of a call and adjust the limit
+ *
+ * @param lim[in]	the limiter
+ * @param cls[in]	class given to hsi_nfs3_limit_acquire()
+ * @param bytes[in]	cost given to hsi_nfs3_limit_acquire()
+ * @param us[in]	round trip time, in usec, negative if never sent
+ * @param timedout[in]	the call got no reply in time
+ */
+extern void hsi_nfs3_limit_release(struct hsi_nfs3_limit *lim, int cls,
+				   unsigned int bytes, long us, int timedout);
+
+/**
+ * @brief Get the scheduling cost of a call
+ *
+ * @param procnum[in]	NFS procedure number
+ * @param in[in]	the arguments of the call
+ *
+ * @return the bytes of file data moved, or a fixed cost for metadata
+ */
+extern unsigned int hsi_nfs3_call_bytes(unsigned long procnum, const char *in);
+
+/**
+ * @brief Start hedging idempotent calls of a connection
+ *
+ * @param percent[in]	share of the calls which may be hedged
+ * @param nthread[in]	workers making the calls
+ * @param lim[in]	concurrency limit of the connection
+ *
+ * @return the hedging state or NULL
+ */
+extern struct hsi_nfs3_hedge *hsi_nfs3_hedge_alloc(unsigned int percent,
+						   int nthread,
+						   struct hsi_nfs3_limit *lim);
+extern void hsi_nfs3_hedge_free(struct hsi_nfs3_hedge *hg);
+
+/**
+ * @brief Make a call, sending it twice if it is slow to come back
+ *
+ * Only GETATTR, LOOKUP, ACCESS, READLINK, READ, READDIR and READDIRPLUS
+ * are hedged, the other procedures go out once as by clnt_call().
+ *
+ * @param hg[in]	hedging state of clnt
+ * @param clnt[in]	connection from hsi_nfs3_conn_create()
+ * @param xid[out]	xid of the first call when no reply came back
+ *
+ * @return the status of the first good reply, else of the first call
+ */
+extern enum clnt_stat hsi_nfs3_hedge_call(struct hsi_nfs3_hedge *hg,
+					  CLIENT *clnt, unsigned long procnum,
+					  xdrproc_t inproc, char *in,
+					  xdrproc_t outproc, char *out,
+					  struct timeval tout, u_int32_t *xid);
+
+/* Upper bound of the nconnect= mount option */
+#define HSI_NFS3_MAX_NCONNECT	16
+/* Calls the limiter lets go per TCP transport, at most */
+#define HSI_NFS3_MUX_SLOTS	16
+/* Upper bound of the hedge= mount option, in percent */
+#define HSI_NFS3_MAX_HEDGE	50
+
+/* Classes of procedures timed separately */
+enum {
+	HSI_RTT_META,
+	HSI_RTT_READ,
+	HSI_RTT_WRITE,
+	HSI_RTT_NCLASS
+};
+
+struct hsi_nfs3_rtt {
+	pthread_mutex_t lock;
+	long timeo;			/* Mount timeo, in usec */
+	long srtt[HSI_RTT_NCLASS];	/* Smoothed RTT, in usec */
+	long rttvar[HSI_RTT_NCLASS];	/* RTT variation, in usec */
+	unsigned int ntimeouts[HSI_RTT_NCLASS];
+};
+
+/**
+ * @brief Allocate the retransmit timer of a connection
+ *
+ * @param timeo[in]	mount timeo, in deciseconds
+ *
+ * @return the timer or NULL
+ */
+extern struct hsi_nfs3_rtt *hsi_nfs3_rtt_alloc(unsigned int timeo);
+extern void hsi_nfs3_rtt_free(struct hsi_nfs3_rtt *rtt);
+
+/**
+ * @brief Get the timer class of a procedure
+ *
+ * @param procnum[in]	NFS procedure number
+ *
+ * @return HSI_RTT_*
+ */
+extern int hsi_nfs3_rtt_class(unsigned long procnum);
+
+/**
+ * @brief Compute the timeout of the next transmission
+ *
+ * @param rtt[in]	the timer
+ * @param cls[in]	class of the procedure
+ * @param ntimeo[in]	timeouts this call has already seen
+ * @param tv[out]	the timeout
+ */
+extern void hsi_nfs3_rtt_timeout(struct hsi_nfs3_rtt *rtt, int cls,
+				 unsigned int ntimeo, struct timeval *tv);
+
+/**
+ * @brief Feed a round trip sample, only from calls sent once
+ *
+ * @param rtt[in]	the timer
+ * @param cls[in]	class of the procedure
+ * @param us[in]	round trip time, in usec
+ */
+extern void hsi_nfs3_rtt_update(struct hsi_nfs3_rtt *rtt, int cls, long us);
+
+/**
+ * @brief Note a timeout, backing off the class until the next sample
+ *
+ * @param rtt[in]	the timer
+ * @param cls[in]	class of the procedure
+ */
+extern void hsi_nfs3_rtt_timedout(struct hsi_nfs3_rtt *rtt, int cls);
+
+/**
+ * @brief Sleep before retrying a transient failure
+ *
+ * @param attempt[in]	retries done so far, the wait doubles with each
+ */
+extern void hsi_nfs3_backoff(unsigned int attempt);
+
+struct hsi_sflight;
+
+/**
+ * @brief Join an identical outstanding call or register as its leader
+ *
+ * Only idempotent procedures (GETATTR, LOOKUP, ACCESS, READLINK, READ)
+ * are coalesced.
+ *
+ * @param clnt[in]	CLIENT the call goes to
+ * @param procnum[in]	NFS procedure number
+ * @param inproc[in]	function encoding the arguments
+ * @param in[in]	the arguments
+ * @param outproc[in]	function decoding the results
+ * @param out[out]	where to place the results when joining
+ * @param flp[out]	the flight to end with hsi_nfs3_sflight_end(), or NULL
+ * @param err[out]	errno of the joined call
+ *
+ * @return 1 if out and err were filled from another caller's reply
+ */
+extern int hsi_nfs3_sflight_begin(CLIENT *clnt, unsigned long procnum,
+				  xdrproc_t inproc, char *in,
+				  xdrproc_t outproc, char *out,
+				  struct hsi_sflight **flp, int *err);
+
+/**
+ * @brief Publish the reply of a leader to the callers waiting on it
+ *
+ * @param fl[in]	flight from hsi_nfs3_sflight_begin(), may be NULL
+ * @param err[in]	errno of the call
+ * @param outproc[in]	function encoding the results
+ * @param out[in]	the results
+ */
+extern void hsi_nfs3_sflight_end(struct hsi_sflight *fl, int err,
+				 xdrproc_t outproc, char *out);
+
+/**
+ * @brief Note that a call completed, outstanding flights may now be stale
+ *
+ * Calls of procedures that change nothing are ignored.
+ *
+ * @param procnum[in]	NFS procedure number of the call
+ */
+extern void hsi_nfs3_sflight_changed(unsigned long procnum);
+
 /**
  * @brief Get extended attribute
  *
@@ -354,6 +770,43 @@ static inline void hsi_nfs3_time2spec(struct nfstime3 *f, struct timespec *t)
 }
 
 extern int hsi_nfs3_post2fattr(struct post_op_attr *p, struct nfs_fattr *t);
+
+/**
+ * @brief Update an inode from the wcc data of a call which changed it
+ *
+ * The pre-op attributes tell nfs_refresh_inode() that the change is the
+ * one made by that call, not one the kernel has to be told about.
+ *
+ * @param inode[in]	The changed inode
+ * @param wcc[in]	The wcc data replied for it
+ */
+extern void hsi_nfs3_wcc_update(struct hsfs_inode *inode, struct wcc_data *wcc);
+
+/*
+ * Specialized XDR routines, see hsi_nfs3_xdr.c. Drop-in replacements of
+ * the rpcgen ones of the same name without the hsi_ prefix.
+ */
+extern bool_t hsi_xdr_fattr3(XDR *xdrs, fattr3 *fa);
+extern bool_t hsi_xdr_post_op_attr(XDR *xdrs, post_op_attr *pa);
+extern bool_t hsi_xdr_getattr3res(XDR *xdrs, getattr3res *res);
+extern bool_t hsi_xdr_lookup3res(XDR *xdrs, lookup3res *res);
+extern bool_t hsi_xdr_access3res(XDR *xdrs, access3res *res);
+extern bool_t hsi_xdr_write3res(XDR *xdrs, write3res *res);
+extern bool_t hsi_xdr_read3args(XDR *xdrs, read3args *args);
+extern bool_t hsi_xdr_write3args(XDR *xdrs, write3args *args);
+
+/**
+ * @brief Specialized xdr_read3res()
+ *
+ * When decoding with resok.data.data_val set, the data goes there and
+ * data_len gives the room; a longer reply fails to decode.
+ *
+ * @param xdrs[in]	the stream
+ * @param res[in,out]	the result
+ *
+ * @return TRUE on success
+ */
+extern bool_t hsi_xdr_read3res(XDR *xdrs, read3res *res);
 struct hsfs_inode *hsi_nfs3_handle_create(struct hsfs_super *sb, struct diropres3ok *dir);
 
 /* The same as NFS_FH() but return nfs_fh3 */
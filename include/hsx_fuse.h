@@ -8,9 +8,215 @@
 
 #include <fuse_lowlevel.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include <hsfs.h>
 
+/*
+ * Per open file state, hung on fi->fh by open/create and freed by release.
+ */
+struct hsx_fuse_file {
+	pthread_mutex_t lock;
+	off_t next_off;		/* Where a sequential reader continues */
+	off_t ra_end;		/* End of data already pushed to the kernel */
+	unsigned int seq;	/* Sequential reads seen in a row */
+	int small;		/* Small file cache in use or being filled */
+	char *data;		/* Whole file contents of a small file */
+	size_t data_len;
+	off_t data_size;	/* i_size/i_mtime data was read at */
+	struct timespec data_mtime;
+};
+
+static inline struct hsx_fuse_file *hsx_fuse_file(struct fuse_file_info *fi)
+{
+	return fi ? (struct hsx_fuse_file *)(uintptr_t)fi->fh : NULL;
+}
+
+extern struct hsx_fuse_file *hsx_fuse_file_alloc(void);
+extern void hsx_fuse_file_free(struct hsx_fuse_file *hf);
+
+/**
+ * @brief Push file data into the kernel page cache
+ *
+ * @param sb[in] the hsfs superblock
+ * @param inode[in] the inode the data belongs to
+ * @param off[in] file offset of the data
+ * @param buf[in] the data
+ * @param len[in] number of bytes in buf
+ *
+ * @return error number
+ **/
+extern int hsx_fuse_notify_store(struct hsfs_super *sb, struct hsfs_inode *inode,
+				 off_t off, const char *buf, size_t len);
+
+/**
+ * @brief Detect a sequential stream and prefetch ahead of it
+ *
+ * Called after a read has been replied. If the reader is sequential, the
+ * next sb->readahead bytes are queued to the readahead threads, which
+ * read them from the server and store them into the kernel page cache,
+ * so the following reads never leave the kernel.
+ *
+ * @param sb[in] the hsfs superblock
+ * @param inode[in] the inode being read
+ * @param hf[in] the open file, may be NULL
+ * @param off[in] offset of the read just served
+ * @param cnt[in] number of bytes just served
+ **/
+extern void hsx_fuse_readahead(struct hsfs_super *sb, struct hsfs_inode *inode,
+			       struct hsx_fuse_file *hf, off_t off, size_t cnt);
+
+/**
+ * @brief Start the readahead threads, when readahead is on
+ *
+ * @param sb[in] the hsfs superblock
+ *
+ * @return error number
+ **/
+extern int hsx_fuse_ra_init(struct hsfs_super *sb);
+
+/**
+ * @brief Stop the readahead threads, dropping the windows left
+ *
+ * @param sb[in] the hsfs superblock
+ **/
+extern void hsx_fuse_ra_fini(struct hsfs_super *sb);
+
+/**
+ * @brief Start a whole file prefetch of a small file
+ *
+ * Must be called before replying the open. If the file qualifies, hf->lock
+ * is taken so reads racing with the prefetch wait for it, and the caller
+ * has to call hsx_fuse_smallfile_fill() after replying.
+ *
+ * @param sb[in] the hsfs superblock
+ * @param inode[in] the inode being opened
+ * @param hf[in] the new open file
+ * @param flags[in] open flags
+ *
+ * @return 1 if the caller must call hsx_fuse_smallfile_fill(), else 0
+ **/
+extern int hsx_fuse_smallfile_begin(struct hsfs_super *sb,
+				    struct hsfs_inode *inode,
+				    struct hsx_fuse_file *hf, int flags);
+
+/**
+ * @brief Read a small file whole with a single READ and release hf->lock
+ *
+ * @param inode[in] the inode being opened
+ * @param hf[in] the open file locked by hsx_fuse_smallfile_begin()
+ **/
+extern void hsx_fuse_smallfile_fill(struct hsfs_inode *inode,
+				    struct hsx_fuse_file *hf);
+
+/**
+ * @brief Serve a read from the small file cache
+ *
+ * @param req[in] the read request, replied on success
+ * @param inode[in] the inode being read
+ * @param hf[in] the open file, may be NULL
+ * @param size[in] bytes asked
+ * @param off[in] offset asked
+ *
+ * @return 1 if the request was replied, 0 if the caller must read it
+ **/
+extern int hsx_fuse_smallfile_read(fuse_req_t req, struct hsfs_inode *inode,
+				   struct hsx_fuse_file *hf, size_t size,
+				   off_t off);
+
+/**
+ * @brief Drop the small file cache of an open file
+ *
+ * @param hf[in] the open file, may be NULL
+ **/
+extern void hsx_fuse_smallfile_drop(struct hsx_fuse_file *hf);
+
 extern void hsx_fuse_init(void *data, struct fuse_conn_info *conn);
+extern void hsx_fuse_destroy(void *data);
+
+/**
+ * @brief Set up the per tenant rate limits of the mount, if any
+ *
+ * @param sb[in] the hsfs superblock
+ *
+ * @return error number
+ **/
+extern int hsx_fuse_tenant_init(struct hsfs_super *sb);
+
+/**
+ * @brief Log the counters of every tenant, then free them
+ *
+ * @param sb[in] the hsfs superblock
+ **/
+extern void hsx_fuse_tenant_fini(struct hsfs_super *sb);
+
+/**
+ * @brief Log the counters of every tenant
+ *
+ * @param sb[in] the hsfs superblock
+ **/
+extern void hsx_fuse_tenant_report(struct hsfs_super *sb);
+
+/**
+ * @brief Wrap the handlers of requests that go to the server with the
+ * per tenant rate limits
+ *
+ * A request over its tenant's limits is queued until it is due, instead
+ * of being served by the worker that read it.
+ *
+ * @param base[in] the handlers to wrap
+ *
+ * @return the wrapped handlers, to pass to fuse_session_new()
+ **/
+extern const struct fuse_lowlevel_ops *
+hsx_fuse_tenant_oper(const struct fuse_lowlevel_ops *base);
+
+/**
+ * @brief Start the thread sending kernel cache invalidations
+ *
+ * @param sb[in] the hsfs superblock
+ *
+ * @return error number
+ **/
+extern int hsx_fuse_notify_init(struct hsfs_super *sb);
+
+/**
+ * @brief Stop the invalidation thread, dropping what is still queued
+ *
+ * @param sb[in] the hsfs superblock
+ **/
+extern void hsx_fuse_notify_fini(struct hsfs_super *sb);
+
+/**
+ * @brief Queue the invalidation of the kernel caches of an inode
+ *
+ * Safe from within a request: the kernel is told from another thread.
+ *
+ * @param sb[in] the hsfs superblock
+ * @param inode[in] the inode whose attributes and data went stale
+ **/
+extern void hsx_fuse_notify_inval(struct hsfs_super *sb,
+				  struct hsfs_inode *inode);
+
+/**
+ * @brief Queue the invalidation of a directory entry in the kernel
+ *
+ * @param sb[in] the hsfs superblock
+ * @param dir[in] the directory
+ * @param name[in] the name in it
+ **/
+extern void hsx_fuse_notify_inval_entry(struct hsfs_super *sb,
+					struct hsfs_inode *dir,
+					const char *name);
+
+/**
+ * @brief Tell the kernel an inode changed on the server
+ *
+ * Installed as sb->changed. Drops the kernel's listing of a directory,
+ * and with kcache its attributes, data and entries too.
+ *
+ * @param inode[in] the inode
+ **/
+extern void hsx_fuse_changed(struct hsfs_inode *inode);
 
 /**
  * @brief Make a directory
@@ -54,7 +260,7 @@ extern void hsx_fuse_fill_reply(struct hsfs_inode *inode,
  * @brief Read data
  *
  * Valid replies:
- *   fuse_reply_buf
+ *   fuse_reply_data
  *   fuse_reply_err
  *
  * @param req[in] request handle
@@ -83,6 +289,35 @@ extern void hsx_fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size,
 extern void hsx_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 				size_t size, off_t off, struct fuse_file_info *fi);
 
+/**
+ * @brief Write data given as a buffer vector, spliced or not
+ *
+ * Valid replies:
+ *   fuse_reply_write
+ *   fuse_reply_err
+ *
+ * @param req[in] request handle
+ * @param ino[in] the inode number
+ * @param bufv[in] data to write, in memory or in a pipe
+ * @param off[in] offset to write to
+ * @param fi[in] file information
+ **/
+extern void hsx_fuse_write_buf(fuse_req_t req, fuse_ino_t ino,
+			       struct fuse_bufvec *bufv, off_t off,
+			       struct fuse_file_info *fi);
+
+/**
+ * @brief Reply to a read with data in memory
+ *
+ * The data goes through a pipe to the kernel instead of being written
+ * when the splice mount option is set.
+ *
+ * @param req[in] request handle
+ * @param buf[in] the data
+ * @param size[in] its length
+ **/
+extern void hsx_fuse_reply_read(fuse_req_t req, const char *buf, size_t size);
+
 /**
  * @brief Remove a file
  *
@@ -226,6 +461,19 @@ extern  void  hsx_fuse_lookup(fuse_req_t req, fuse_ino_t ino, const char *name);
  */
 extern  void  hsx_fuse_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup);
 
+/**
+ * @brief Forget several inodes in one request
+ *
+ * Valid replies:
+ *   fuse_reply_none
+ *
+ * @param req[in] request handle
+ * @param count[in] the number of inodes to forget
+ * @param forgets[in] each inode number with its lookups to forget
+ **/
+extern void hsx_fuse_forget_multi(fuse_req_t req, size_t count,
+				  struct fuse_forget_data *forgets);
+
 /**
  * @brief Open a file
  * 
@@ -302,6 +550,85 @@ extern void hsx_fuse_statfs(fuse_req_t req, fuse_ino_t ino);
 extern void hsx_fuse_readdir(fuse_req_t req,  fuse_ino_t ino,  size_t size,  off_t off,  struct fuse_file_info  *fi);
 extern void hsx_fuse_readdir_plus(fuse_req_t req,  fuse_ino_t ino,  size_t size,  off_t off,  struct fuse_file_info  *fi);
 
+struct hsfs_prefetch_args;
+struct hsfs_prefetch_status;
+
+/**
+ * @brief Start the thread running the prefetch jobs
+ *
+ * @param sb[in] the hsfs superblock
+ *
+ * @return error number
+ **/
+extern int hsx_fuse_advise_init(struct hsfs_super *sb);
+
+/**
+ * @brief Stop the prefetch thread, cancelling the jobs left
+ *
+ * @param sb[in] the hsfs superblock
+ **/
+extern void hsx_fuse_advise_fini(struct hsfs_super *sb);
+
+/**
+ * @brief Queue the prefetch of a file range into the kernel page cache
+ *
+ * @param sb[in] the hsfs superblock
+ * @param inode[in] the regular file
+ * @param uid[in] the caller, who owns the job
+ * @param args[in,out] the range, and the id of the job on return
+ *
+ * @return error number, EAGAIN if too many jobs are queued
+ **/
+extern int hsx_fuse_advise_prefetch(struct hsfs_super *sb,
+				    struct hsfs_inode *inode, uid_t uid,
+				    struct hsfs_prefetch_args *args);
+
+/**
+ * @brief Report the progress of a prefetch job, or of all of the caller's
+ *
+ * @param sb[in] the hsfs superblock
+ * @param uid[in] the caller, 0 for any job
+ * @param status[in,out] the job asked, and its progress on return
+ *
+ * @return error number, ENOENT if the job is over, EPERM if not the caller's
+ **/
+extern int hsx_fuse_advise_status(struct hsfs_super *sb, uid_t uid,
+				  struct hsfs_prefetch_status *status);
+
+/**
+ * @brief Cancel a prefetch job, or all of the caller's
+ *
+ * @param sb[in] the hsfs superblock
+ * @param uid[in] the caller, 0 for any job
+ * @param id[in] the job, 0 for all
+ *
+ * @return error number, ENOENT if the job is over, EPERM if not the caller's
+ **/
+extern int hsx_fuse_advise_cancel(struct hsfs_super *sb, uid_t uid,
+				  uint64_t id);
+
+/**
+ * @brief Serve an ioctl of hsfs_ioctl.h
+ *
+ * Valid replies:
+ *   fuse_reply_ioctl
+ *   fuse_reply_err
+ *
+ * @param req[in] request handle
+ * @param ino[in] the inode number the ioctl is issued on
+ * @param cmd[in] the ioctl command
+ * @param arg[in] its argument in the caller, unused
+ * @param fi[in] file information
+ * @param flags[in] FUSE_IOCTL_* flags
+ * @param in_buf[in] the argument, copied in
+ * @param in_bufsz[in] size of in_buf
+ * @param out_bufsz[in] bytes the reply may carry back
+ **/
+extern void hsx_fuse_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
+			   struct fuse_file_info *fi, unsigned flags,
+			   const void *in_buf, size_t in_bufsz,
+			   size_t out_bufsz);
+
 /**
  * @brief Open a directory
  * 
@@ -373,6 +700,51 @@ extern void hsx_fuse_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
 				const char *value, size_t size, int flags );
 void hsx_fuse_stat2iattr(struct stat *st, int to_set, struct hsfs_iattr *attr);
 
+/**
+ * @brief Serve a session with one worker bound to each allowed CPU
+ *
+ * @param se[in]	the session, mounted
+ * @param reactor[in]	run the workers as reactors, see below
+ *
+ * @return 0 when the session ends normally, or the error
+ **/
+extern int hsx_fuse_loop_percpu(struct fuse_session *se, int reactor);
+
+/**
+ * @brief Serve a session from this thread as an event driven reactor
+ *
+ * @param se[in]	the session, mounted
+ *
+ * @return 0 when the session ends normally, or the error
+ **/
+extern int hsx_fuse_reactor_serve(struct fuse_session *se);
+
+/**
+ * @brief Continue a GETATTR from the reactor once the server answers
+ *
+ * @param req[in]	the request
+ * @param inode[in]	its inode
+ *
+ * @return 1 if the reactor replies, 0 if the caller has to do it all
+ **/
+extern int hsx_fuse_reactor_getattr(fuse_req_t req, struct hsfs_inode *inode);
+
+/**
+ * @brief Continue a READ of up to rsize from the reactor
+ *
+ * @param req[in]	the request
+ * @param inode[in]	its inode
+ * @param hf[in]	the open file
+ * @param buf[in]	buffer of hsfs_buf_get(size), given to the reactor
+ * @param size[in]	bytes to read
+ * @param off[in]	where from
+ *
+ * @return 1 if the reactor replies and puts buf, 0 if the caller has to
+ **/
+extern int hsx_fuse_reactor_read(fuse_req_t req, struct hsfs_inode *inode,
+				 struct hsx_fuse_file *hf, char *buf,
+				 size_t size, off_t off);
+
 #define FUSE_ASSERT(exp) do {						\
 		if (unlikely(!(exp))){					\
 			ERR("Assert failed at %s:%d/%s()", __FILE__, __LINE__, __func__); \
@@ -380,6 +752,24 @@ void hsx_fuse_stat2iattr(struct stat *st, int to_set, struct hsfs_iattr *attr);
 		assert(exp);						\
 	}while(0)
 
+/* Attributes kept by the kernel: long when it is told of changes */
+static inline double hsx_fuse_attr_timeout(struct hsfs_inode *inode)
+{
+	struct hsfs_super *sb = inode->sb;
+
+	if (sb->kcache && sb->notify)
+		return sb->kcache;
+	return S_ISDIR(inode->i_mode) ? sb->acdirmin : sb->acregmin;
+}
+
+/* Names belong to their directory, so do their timeouts. */
+static inline double hsx_fuse_entry_timeout(struct hsfs_super *sb)
+{
+	if (sb->kcache && sb->notify)
+		return sb->kcache;
+	return sb->acdirmin;
+}
+
 static inline unsigned long hsx_fuse_ref_xchg(struct hsfs_inode *inode, unsigned long val)
 {
 	return __sync_lock_test_and_set(&(inode->private), val);
@@ -28,7 +28,8 @@
 #define ERR(fmt, args...) syslog(LOG_ERR, fmt, ##args)
 #define	INFO(fmt, args...) syslog(LOG_INFO, fmt, ##args)
 
-extern int __INIT_DEBUG;
+/* Call depth of the thread, for the traces. */
+extern __thread int __INIT_DEBUG;
 #define DEBUG_IN(fmt, args...)						\
 	do {								\
 		DEBUG("Enter[%d] %s: "fmt, __INIT_DEBUG, __func__, args); \
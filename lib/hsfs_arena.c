@@ -0,0 +1,130 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Request scoped arena, see hsfs_arena.h.
+ *
+ * Memory comes in 64KiB chunks chained backwards. One released chunk is
+ * kept per thread, so a handler that fits in a single chunk never calls
+ * malloc() after the first request served by its thread.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "hsfs_arena.h"
+
+#define HSFS_ARENA_CHUNK	(64UL * 1024)
+#define HSFS_ARENA_ALIGN	16UL
+
+struct hsfs_arena_chunk {
+	struct hsfs_arena_chunk *prev;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(HSFS_ARENA_ALIGN)));
+};
+
+static __thread struct hsfs_arena_chunk *hsfs_arena_cur;
+static __thread struct hsfs_arena_chunk *hsfs_arena_spare;
+static pthread_key_t hsfs_arena_key;
+static pthread_once_t hsfs_arena_once = PTHREAD_ONCE_INIT;
+
+/* FUSE worker threads come and go, give their chunks back. */
+static void hsfs_arena_thread_exit(void *arg)
+{
+	struct hsfs_arena_chunk *chunk;
+
+	(void)arg;
+	while ((chunk = hsfs_arena_cur)) {
+		hsfs_arena_cur = chunk->prev;
+		free(chunk);
+	}
+	free(hsfs_arena_spare);
+	hsfs_arena_spare = NULL;
+}
+
+static void hsfs_arena_key_init(void)
+{
+	pthread_key_create(&hsfs_arena_key, hsfs_arena_thread_exit);
+}
+
+static struct hsfs_arena_chunk *hsfs_arena_grow(size_t size)
+{
+	struct hsfs_arena_chunk *chunk;
+
+	if (size <= HSFS_ARENA_CHUNK) {
+		size = HSFS_ARENA_CHUNK;
+		chunk = hsfs_arena_spare;
+		hsfs_arena_spare = NULL;
+	} else {
+		chunk = NULL;
+	}
+
+	if (!chunk) {
+		chunk = malloc(sizeof(*chunk) + size);
+		if (!chunk)
+			return NULL;
+		chunk->size = size;
+		pthread_once(&hsfs_arena_once, hsfs_arena_key_init);
+		pthread_setspecific(hsfs_arena_key, chunk);
+	}
+	chunk->used = 0;
+	chunk->prev = hsfs_arena_cur;
+	hsfs_arena_cur = chunk;
+
+	return chunk;
+}
+
+void hsfs_arena_mark(struct hsfs_arena_mark *mark)
+{
+	mark->chunk = hsfs_arena_cur;
+	mark->used = hsfs_arena_cur ? hsfs_arena_cur->used : 0;
+}
+
+void hsfs_arena_release(const struct hsfs_arena_mark *mark)
+{
+	struct hsfs_arena_chunk *chunk;
+
+	while (hsfs_arena_cur && hsfs_arena_cur != mark->chunk) {
+		chunk = hsfs_arena_cur;
+		hsfs_arena_cur = chunk->prev;
+		if (chunk->size == HSFS_ARENA_CHUNK && !hsfs_arena_spare)
+			hsfs_arena_spare = chunk;
+		else
+			free(chunk);
+	}
+	if (hsfs_arena_cur)
+		hsfs_arena_cur->used = mark->used;
+}
+
+void *hsfs_arena_alloc(size_t size)
+{
+	struct hsfs_arena_chunk *chunk = hsfs_arena_cur;
+	void *p;
+
+	size = (size + HSFS_ARENA_ALIGN - 1) & ~(HSFS_ARENA_ALIGN - 1);
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk = hsfs_arena_grow(size);
+		if (!chunk)
+			return NULL;
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return p;
+}
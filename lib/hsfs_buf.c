@@ -0,0 +1,248 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Pooled I/O buffers, see hsfs_buf.h.
+ *
+ * Buffers are carved from 2MiB slabs which are never given back. A thread
+ * first fills its own cache from the depot of the NUMA node it runs on,
+ * and the pages are first touched there, so buffers tend to stay local to
+ * the node of the FUSE worker using them.
+ */
+/* Before any system header: config.h defines _GNU_SOURCE, for getcpu(). */
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "hsfs.h"
+#include "hsfs_buf.h"
+
+#define HSFS_BUF_NCLASS		(HSFS_BUF_MAX_SHIFT - HSFS_BUF_MIN_SHIFT + 1)
+#define HSFS_BUF_SLAB		(2UL << 20)
+/* Bytes a thread may keep per size class before giving back to the depot */
+#define HSFS_BUF_CACHE_BYTES	(4UL << 20)
+#define HSFS_BUF_MAX_NODES	8
+
+struct hsfs_buf {
+	struct hsfs_buf *next;
+};
+
+struct hsfs_buf_depot {
+	pthread_mutex_t lock;
+	struct hsfs_buf *head[HSFS_BUF_NCLASS];
+};
+
+struct hsfs_buf_cache {
+	struct hsfs_buf *head[HSFS_BUF_NCLASS];
+	unsigned int count[HSFS_BUF_NCLASS];
+	int node;
+	int inited;
+};
+
+static struct hsfs_buf_depot hsfs_buf_depots[HSFS_BUF_MAX_NODES];
+static int hsfs_buf_flags;
+static pthread_key_t hsfs_buf_key;
+static pthread_once_t hsfs_buf_once = PTHREAD_ONCE_INIT;
+static __thread struct hsfs_buf_cache hsfs_buf_cache;
+
+static inline int hsfs_buf_class(size_t size)
+{
+	if (size <= HSFS_BUF_MIN)
+		return 0;
+	return (sizeof(long) * 8 - __builtin_clzl(size - 1)) - HSFS_BUF_MIN_SHIFT;
+}
+
+static inline unsigned int hsfs_buf_cache_max(int class)
+{
+	unsigned int max = HSFS_BUF_CACHE_BYTES >> (class + HSFS_BUF_MIN_SHIFT);
+
+	return max < 2 ? 2 : max;
+}
+
+/* Give back the first n buffers of the thread cache of class. */
+static void hsfs_buf_flush(struct hsfs_buf_cache *cache, int class,
+			   unsigned int n)
+{
+	struct hsfs_buf_depot *depot = &hsfs_buf_depots[cache->node];
+	struct hsfs_buf *first, *last;
+
+	if (!n || !cache->head[class])
+		return;
+
+	first = last = cache->head[class];
+	cache->count[class]--;
+	while (--n && last->next) {
+		last = last->next;
+		cache->count[class]--;
+	}
+	cache->head[class] = last->next;
+
+	pthread_mutex_lock(&depot->lock);
+	last->next = depot->head[class];
+	depot->head[class] = first;
+	pthread_mutex_unlock(&depot->lock);
+}
+
+static void hsfs_buf_thread_exit(void *arg)
+{
+	struct hsfs_buf_cache *cache = arg;
+	int class;
+
+	for (class = 0; class < HSFS_BUF_NCLASS; class++)
+		hsfs_buf_flush(cache, class, cache->count[class]);
+}
+
+static void hsfs_buf_key_init(void)
+{
+	int i;
+
+	for (i = 0; i < HSFS_BUF_MAX_NODES; i++)
+		pthread_mutex_init(&hsfs_buf_depots[i].lock, NULL);
+	pthread_key_create(&hsfs_buf_key, hsfs_buf_thread_exit);
+}
+
+static struct hsfs_buf_cache *hsfs_buf_this_cache(void)
+{
+	struct hsfs_buf_cache *cache = &hsfs_buf_cache;
+	unsigned int node = 0;
+
+	if (cache->inited)
+		return cache;
+
+	pthread_once(&hsfs_buf_once, hsfs_buf_key_init);
+#ifdef HAVE_GETCPU
+	{
+		unsigned int cpu;
+
+		if (getcpu(&cpu, &node))
+			node = 0;
+	}
+#endif
+	cache->node = node % HSFS_BUF_MAX_NODES;
+	cache->inited = 1;
+	pthread_setspecific(hsfs_buf_key, cache);
+
+	return cache;
+}
+
+/* Carve a new slab into the depot. Caller holds depot->lock. */
+static int hsfs_buf_grow(struct hsfs_buf_depot *depot, int class)
+{
+	size_t size = 1UL << (class + HSFS_BUF_MIN_SHIFT);
+	struct hsfs_buf *buf;
+	char *slab, *p;
+	int err;
+
+	err = posix_memalign((void **)&slab, HSFS_BUF_SLAB, HSFS_BUF_SLAB);
+	if (err)
+		return err;
+
+	if ((hsfs_buf_flags & HSFS_BUF_HUGEPAGE) &&
+	    madvise(slab, HSFS_BUF_SLAB, MADV_HUGEPAGE))
+		DEBUG("madvise(MADV_HUGEPAGE) failed: %d", errno);
+	if ((hsfs_buf_flags & HSFS_BUF_MLOCK) && mlock(slab, HSFS_BUF_SLAB))
+		WARNING("Failed to lock I/O buffers: %d", errno);
+
+	for (p = slab + HSFS_BUF_SLAB - size; p >= slab; p -= size) {
+		buf = (struct hsfs_buf *)p;
+		buf->next = depot->head[class];
+		depot->head[class] = buf;
+	}
+
+	return 0;
+}
+
+/* Refill the thread cache with half of its capacity. */
+static int hsfs_buf_refill(struct hsfs_buf_cache *cache, int class)
+{
+	struct hsfs_buf_depot *depot = &hsfs_buf_depots[cache->node];
+	unsigned int n = hsfs_buf_cache_max(class) / 2;
+	struct hsfs_buf *buf;
+	int err = 0;
+
+	pthread_mutex_lock(&depot->lock);
+	if (!depot->head[class])
+		err = hsfs_buf_grow(depot, class);
+	while (n-- && (buf = depot->head[class])) {
+		depot->head[class] = buf->next;
+		buf->next = cache->head[class];
+		cache->head[class] = buf;
+		cache->count[class]++;
+	}
+	pthread_mutex_unlock(&depot->lock);
+
+	return err;
+}
+
+int hsfs_buf_init(int flags)
+{
+	pthread_once(&hsfs_buf_once, hsfs_buf_key_init);
+	hsfs_buf_flags = flags;
+
+	return 0;
+}
+
+void *hsfs_buf_get(size_t size)
+{
+	struct hsfs_buf_cache *cache;
+	struct hsfs_buf *buf;
+	int class;
+
+	if (size > HSFS_BUF_MAX)
+		return malloc(size);
+
+	class = hsfs_buf_class(size);
+	cache = hsfs_buf_this_cache();
+	if (!cache->head[class] && hsfs_buf_refill(cache, class)) {
+		ERR("Failed to grow buffer pool: %s", strerror(ENOMEM));
+		return NULL;
+	}
+
+	buf = cache->head[class];
+	cache->head[class] = buf->next;
+	cache->count[class]--;
+
+	return buf;
+}
+
+void hsfs_buf_put(void *buf, size_t size)
+{
+	struct hsfs_buf_cache *cache;
+	struct hsfs_buf *b = buf;
+	int class;
+
+	if (!buf)
+		return;
+	if (size > HSFS_BUF_MAX) {
+		free(buf);
+		return;
+	}
+
+	class = hsfs_buf_class(size);
+	cache = hsfs_buf_this_cache();
+	b->next = cache->head[class];
+	cache->head[class] = b;
+	if (++cache->count[class] > hsfs_buf_cache_max(class))
+		hsfs_buf_flush(cache, class, cache->count[class] / 2);
+}
@@ -17,8 +17,24 @@
  * along with HSFS.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <string.h>
 #include <hsfs.h>
 
+/*
+ * The hash tables are walked under icache_lock taken for reading and
+ * changed under it taken for writing. An inode is pinned by the kernel's
+ * lookups (private) and by i_count, which a lookup takes before dropping
+ * the lock. The reclaimer only frees an inode it finds with neither,
+ * unhashing it under the write lock: nobody can reach it any more. The
+ * last of either count is dropped under the read lock, so that the
+ * reclaimer can't free the inode between the drop and the check of the
+ * other count.
+ *
+ * Seconds between two rounds of the reclaimer, to batch the write locks.
+ */
+#define HSFS_RECLAIM_SECS	1
+
 void hsfs_unlock_new_inode(struct hsfs_inode *inode)
 {
 	inode->i_state &= ~I_NEW;
@@ -63,40 +79,65 @@ struct hsfs_inode bad_hsfs_inode = {
 	.ino = 0,
 };
 
+static void *hsfs_reclaimer(void *arg);
+
 int hsfs_init_icache(struct hsfs_super *sb)
 {
+	int err;
+
 	hash_init(sb->id_table);
 	hash_init(sb->fh_table);
-	return 0;
-}
-
-static void wait_on_inode(struct hsfs_inode *inode __attribute__((unused)))
-{
-	;
+	hash_init(sb->name_table);
+	pthread_rwlock_init(&sb->icache_lock, NULL);
+	pthread_mutex_init(&sb->name_lock, NULL);
+	pthread_mutex_init(&sb->reclaim_lock, NULL);
+	pthread_cond_init(&sb->reclaim_cond, NULL);
+	sb->reclaim = NULL;
+	sb->reclaim_stop = 0;
+	err = pthread_create(&sb->reclaimer, NULL, hsfs_reclaimer, sb);
+	if (err) {
+		ERR("Failed to start the inode reclaimer: %d.", err);
+		pthread_cond_destroy(&sb->reclaim_cond);
+		pthread_mutex_destroy(&sb->reclaim_lock);
+		pthread_mutex_destroy(&sb->name_lock);
+		pthread_rwlock_destroy(&sb->icache_lock);
+	}
+	return err;
 }
 
-static void wake_up_inode(struct hsfs_inode *inode __attribute__((unused)))
+void hsfs_destroy_icache(struct hsfs_super *sb)
 {
-	;
+	pthread_mutex_lock(&sb->reclaim_lock);
+	sb->reclaim_stop = 1;
+	pthread_cond_signal(&sb->reclaim_cond);
+	pthread_mutex_unlock(&sb->reclaim_lock);
+	pthread_join(sb->reclaimer, NULL);
+	pthread_cond_destroy(&sb->reclaim_cond);
+	pthread_mutex_destroy(&sb->reclaim_lock);
+	pthread_mutex_destroy(&sb->name_lock);
+	pthread_rwlock_destroy(&sb->icache_lock);
 }
 
-static void generic_delete_inode(struct hsfs_inode *inode __attribute__((unused)))
+static void wait_on_inode(struct hsfs_inode *inode __attribute__((unused)))
 {
 	;
 }
 
-static void __iget(struct hsfs_inode *inode __attribute__((unused)))
+/* Called with icache_lock held, for reading at least. */
+static void __iget(struct hsfs_inode *inode)
 {
-	;
+	__sync_fetch_and_add(&inode->i_count, 1);
 }
 
-/* This is equal to Linux ifind_fast() but without __iget() called. */
+/*
+ * This is equal to Linux ifind_fast() but without __iget() called.
+ * Called with icache_lock held.
+ */
 static struct hsfs_inode *__id_ifind(struct hsfs_super *sb, uint64_t key)
 {
 	struct hsfs_inode *inode = NULL;
 	struct hlist_node *node = NULL;
 	
-	/* XXX LOCK */
 	hash_for_each_possible(sb->id_table, inode, node, id_hash, key){
 		if (inode->ino != key)
 			continue;
@@ -109,7 +150,7 @@ static struct hsfs_inode *__id_ifind(struct hsfs_super *sb, uint64_t key)
 	return NULL;
 }
 
-/* This is just the same as ifind() of Linux kernel */
+/* This is just the same as ifind() of Linux kernel, icache_lock held */
 static struct hsfs_inode *
 __fh_ifind(struct hsfs_super *sb, unsigned long key,
 	   int (*test)(struct hsfs_inode *, void *),
@@ -120,7 +161,6 @@ __fh_ifind(struct hsfs_super *sb, unsigned long key,
 	
 	DEBUG_IN("(%p, %lu, %p)", sb, key, data);
 
-	/* XXX LOCK */
 	hash_for_each_possible(sb->fh_table, inode, node, fh_hash, key){
 		DEBUG_V("Find Inode(%p:%lu)", inode, inode->private);
 		if (!test(inode, data))
@@ -130,34 +170,102 @@ __fh_ifind(struct hsfs_super *sb, unsigned long key,
 	}
 	if (node){
  		__iget(inode);
-		/* UNLOCK */
 		if (wait)
 			wait_on_inode(inode);
 		DEBUG_OUT("(%p)", inode);
 		return inode;
 	}
-	/* UNLOCK */
 
 	DEBUG_OUT("(%p)", inode);
 	return NULL;
 }
 
-/* Linux: ilookup */
+/* Linux: ilookup, without the reference: the kernel holds ino. */
 struct hsfs_inode *hsfs_ilookup(struct hsfs_super *sb, uint64_t ino)
 {
 	struct hsfs_inode *inode;
 
+	pthread_rwlock_rdlock(&sb->icache_lock);
+	inode = __id_ifind(sb, ino);
+	pthread_rwlock_unlock(&sb->icache_lock);
+
+	return inode;
+}
+
+struct hsfs_inode *hsfs_iget(struct hsfs_super *sb, uint64_t ino)
+{
+	struct hsfs_inode *inode;
+
+	pthread_rwlock_rdlock(&sb->icache_lock);
 	inode = __id_ifind(sb, ino);
 	if (inode)
 		__iget(inode);
+	pthread_rwlock_unlock(&sb->icache_lock);
 
 	return inode;
 }
 
+void hsfs_iname(struct hsfs_inode *inode, struct hsfs_inode *dir,
+		const char *name)
+{
+	struct hsfs_super *sb = inode->sb;
+	char *old, *new;
+
+	/* Mostly a name we already have. */
+	pthread_mutex_lock(&sb->name_lock);
+	old = inode->i_name;
+	if (inode->i_parent == dir->ino && old && !strcmp(old, name)) {
+		pthread_mutex_unlock(&sb->name_lock);
+		return;
+	}
+	pthread_mutex_unlock(&sb->name_lock);
+	new = strdup(name);
+	if (new == NULL)
+		return;
+
+	pthread_mutex_lock(&sb->name_lock);
+	old = inode->i_name;
+	if (old)
+		hash_del(&inode->name_hash);
+	inode->i_parent = dir->ino;
+	inode->i_name = new;
+	hash_add(sb->name_table, &inode->name_hash, inode->i_parent);
+	pthread_mutex_unlock(&sb->name_lock);
+	free(old);
+}
+
+void hsfs_ichildren(struct hsfs_super *sb, uint64_t dir,
+		    void (*fn)(void *arg, const char *name), void *arg)
+{
+	struct hsfs_inode *inode;
+	struct hlist_node *node;
+
+	pthread_mutex_lock(&sb->name_lock);
+	hash_for_each_possible(sb->name_table, inode, node, name_hash, dir) {
+		if (inode->i_parent == dir)
+			fn(arg, inode->i_name);
+	}
+	pthread_mutex_unlock(&sb->name_lock);
+}
+
+uint64_t hsfs_iparent(struct hsfs_inode *inode)
+{
+	struct hsfs_super *sb = inode->sb;
+	uint64_t parent;
+
+	pthread_mutex_lock(&sb->name_lock);
+	parent = inode->i_name ? inode->i_parent : 0;
+	pthread_mutex_unlock(&sb->name_lock);
+
+	return parent;
+}
+
 /* Linux: destroy_inode */
 static void destroy_inode(struct hsfs_inode *inode)
 {
 	/* XXX Need more check: __destroy_inode(inode); */
+	pthread_rwlock_destroy(&inode->i_dirlock);
+	free(inode->i_name);
 	if (inode->sb->sop->destroy_inode)
 		inode->sb->sop->destroy_inode(inode);
 	else
@@ -170,12 +278,18 @@ static int inode_init_always(struct hsfs_super *sb, struct hsfs_inode *inode)
 	inode->sb = sb;
 	inode->generation = 0;
 	inode->private = 0;
+	inode->i_count = 0;
+	inode->i_state = 0;
 	inode->ino = 0;
 	inode->i_blocks = 0;
 	inode->i_nlink = 1;
 	inode->i_blkbits = sb->bsize_bits;
+	inode->i_listed = 0;
+	inode->i_parent = 0;
+	inode->i_name = NULL;
+	INIT_HLIST_NODE(&inode->name_hash);
 
-	return 0;
+	return pthread_rwlock_init(&inode->i_dirlock, NULL);
 }
 
 /* Linux: alloc_inode() */
@@ -202,7 +316,7 @@ static struct hsfs_inode *alloc_inode(struct hsfs_super *sb)
 	return inode;
 }
 
-/* Linux: __inode_add_to_lists */
+/* Linux: __inode_add_to_lists, icache_lock held for writing */
 static inline void
 __inode_add_to_lists(struct hsfs_super *sb, uint64_t key, struct hsfs_inode *inode)
 {
@@ -212,6 +326,7 @@ __inode_add_to_lists(struct hsfs_super *sb, uint64_t key, struct hsfs_inode *ino
 			sb->curr_id = 2;
 	} while (__id_ifind(sb, sb->curr_id) != NULL);
 	inode->ino = sb->curr_id;
+	inode->fh_key = key;
 
 	hash_add(sb->id_table, &inode->id_hash, inode->ino);
 	hash_add(sb->fh_table, &inode->fh_hash, key);
@@ -220,7 +335,7 @@ __inode_add_to_lists(struct hsfs_super *sb, uint64_t key, struct hsfs_inode *ino
 /* Linux: get_new_inode() */
 static struct hsfs_inode *
 get_new_inode(struct hsfs_super *sb, unsigned long key,
-	      int (*test)(struct hsfs_inode *, void *) __attribute__((unused)),
+	      int (*test)(struct hsfs_inode *, void *),
 	      int (*set)(struct hsfs_inode *, void *),
 	      void *data)
 {
@@ -231,18 +346,27 @@ get_new_inode(struct hsfs_super *sb, unsigned long key,
 	if (inode) {
 		struct hsfs_inode *old = NULL;
 	
-		/* XXX Need more checks if there are locks.... */
+		if (set(inode, data))
+			goto set_failed;
+
+		/*
+		 * Lookups in one directory run in parallel: another one
+		 * may have added the same file since we missed it.
+		 */
+		pthread_rwlock_wrlock(&sb->icache_lock);
+		old = __fh_ifind(sb, key, test, data, 0);
 		if (!old){
-			if (set(inode, data))
-				goto set_failed;
-
 			__inode_add_to_lists(sb, key, inode);
 			inode->i_state = I_NEW;
+			inode->i_count = 1;
+			pthread_rwlock_unlock(&sb->icache_lock);
 
 			DEBUG_OUT("Inode(%p:%lu)", inode, inode->ino);
 			return inode;
 		}
-		/* XXX Need more checks if there are locks.... */		
+		pthread_rwlock_unlock(&sb->icache_lock);
+		destroy_inode(inode);
+		inode = old;
 	}
 
 	DEBUG_OUT("HSFS Inode(%p)", inode);
@@ -262,57 +386,125 @@ hsfs_iget5_locked(struct hsfs_super *sb, unsigned long hashval,
 {
 	struct hsfs_inode *inode;
 	
+	pthread_rwlock_rdlock(&sb->icache_lock);
 	inode = __fh_ifind(sb, hashval, test, data, 1);
+	pthread_rwlock_unlock(&sb->icache_lock);
 	if (inode)
 		return inode;
 	
  	return get_new_inode(sb, hashval, test, set, data);
 }
-static void generic_forget_inode(struct hsfs_inode *inode)
+/*
+ * With icache_lock held, for reading at least: once both counts are
+ * seen zero, the reclaimer may free the inode as soon as it is let go.
+ */
+static void hsfs_ireclaim(struct hsfs_inode *inode)
 {
-#if 0
-	if (!generic_detach_inode(inode))
+	struct hsfs_super *sb = inode->sb;
+	struct hsfs_inode *head;
+
+	if (inode == sb->root)
 		return;
-	if (inode->i_data.nrpages)
-		truncate_inode_pages(&inode->i_data, 0);
-	clear_inode(inode);
-#endif
-	wake_up_inode(inode);
-	destroy_inode(inode);
+	/* Forgotten again before the reclaimer saw it. */
+	if (__sync_fetch_and_or(&inode->i_state, I_RECLAIM) & I_RECLAIM)
+		return;
+	do {
+		head = sb->reclaim;
+		inode->reclaim_next = head;
+	} while (!__sync_bool_compare_and_swap(&sb->reclaim, head, inode));
 }
 
-/*
- * Normal UNIX filesystem behaviour: delete the
- * inode when the usage count drops to zero, and
- * i_nlink is zero.
- */
-void generic_drop_inode(struct hsfs_inode *inode)
+unsigned long hsfs_iforget(struct hsfs_inode *inode, unsigned long nlookup)
 {
-	if (!inode->i_nlink)
-		generic_delete_inode(inode);
-	else
-		generic_forget_inode(inode);
+	struct hsfs_super *sb = inode->sb;
+	unsigned long left;
+
+	pthread_rwlock_rdlock(&sb->icache_lock);
+	left = __sync_sub_and_fetch(&inode->private, nlookup);
+	if (!left && !__sync_fetch_and_add(&inode->i_count, 0))
+		hsfs_ireclaim(inode);
+	pthread_rwlock_unlock(&sb->icache_lock);
+
+	return left;
 }
 
-static inline void iput_final(struct hsfs_inode *inode)
+static void *hsfs_reclaimer(void *arg)
 {
-	const struct hsfs_super_ops *op = inode->sb->sop;
-	void (*drop)(struct hsfs_inode *) = generic_drop_inode;
+	struct hsfs_super *sb = arg;
+	struct hsfs_inode *dead, *inode, *next;
+	struct timespec ts;
+	int stop = 0, n;
+
+	while (!stop) {
+		pthread_mutex_lock(&sb->reclaim_lock);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += HSFS_RECLAIM_SECS;
+		while (!sb->reclaim_stop &&
+		       pthread_cond_timedwait(&sb->reclaim_cond,
+					      &sb->reclaim_lock, &ts) != ETIMEDOUT)
+			;
+		stop = sb->reclaim_stop;
+		pthread_mutex_unlock(&sb->reclaim_lock);
+
+		inode = __sync_lock_test_and_set(&sb->reclaim, NULL);
+		if (inode == NULL)
+			continue;
+
+		/* Nobody can take a reference while we hold it. */
+		pthread_rwlock_wrlock(&sb->icache_lock);
+		for (dead = NULL; inode; inode = next) {
+			next = inode->reclaim_next;
+			/* Nobody runs requests any more when stopping. */
+			if (!stop && (inode->private || inode->i_count)) {
+				__sync_fetch_and_and(&inode->i_state,
+						     ~I_RECLAIM);
+				/* Let go since, while still queued here. */
+				if (!inode->private && !inode->i_count)
+					hsfs_ireclaim(inode);
+				continue;
+			}
+			hash_del(&inode->id_hash);
+			hash_del(&inode->fh_hash);
+			pthread_mutex_lock(&sb->name_lock);
+			if (inode->i_name)
+				hash_del(&inode->name_hash);
+			pthread_mutex_unlock(&sb->name_lock);
+			inode->reclaim_next = dead;
+			dead = inode;
+		}
+		pthread_rwlock_unlock(&sb->icache_lock);
 
-	if (op && op->drop_inode)
-		drop = op->drop_inode;
-	drop(inode);
+		for (n = 0; (inode = dead); n++) {
+			dead = inode->reclaim_next;
+			destroy_inode(inode);
+		}
+		if (n)
+			DEBUG("Reclaimed %d inodes.", n);
+	}
+
+	return NULL;
 }
 
 void hsfs_iput(struct hsfs_inode *inode)
 {
-	if (inode) {
-		/* BUG_ON(inode->i_state == I_CLEAR); */
-		inode->i_count--;
-		/* if (atomic_dec_and_lock(&inode->i_count, &inode_lock)) */
-		if (!inode->i_count)
-			iput_final(inode);
-	}
+	struct hsfs_super *sb;
+	int count;
+
+	if (inode == NULL)
+		return;
+	/* Not the last reference, the reclaimer leaves the inode alone. */
+	while ((count = inode->i_count) > 1)
+		if (__sync_bool_compare_and_swap(&inode->i_count, count,
+						 count - 1))
+			return;
+
+	/* Unknown to the kernel as well, see hsfs_iforget(). */
+	sb = inode->sb;
+	pthread_rwlock_rdlock(&sb->icache_lock);
+	if (!__sync_sub_and_fetch(&inode->i_count, 1) &&
+	    !__sync_fetch_and_add(&inode->private, 0))
+		hsfs_ireclaim(inode);
+	pthread_rwlock_unlock(&sb->icache_lock);
 }
 
 /* In future, we should put this into VFS_OPS */
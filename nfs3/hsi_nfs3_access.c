@@ -37,7 +37,7 @@ int hsi_nfs3_access(struct hsfs_inode *hi, int mask)
 	
 	status = hsi_nfs3_clnt_call(hi->sb, clntp, NFSPROC3_ACCESS, 
 			(xdrproc_t)xdr_access3args, (caddr_t)&args, 
-			(xdrproc_t)xdr_access3res, (caddr_t)&res);
+			(xdrproc_t)hsi_xdr_access3res, (caddr_t)&res);
 	if (status)
 		goto out;
 	
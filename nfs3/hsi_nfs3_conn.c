@@ -0,0 +1,663 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reconnecting NFS connection.
+ *
+ * The CLIENT stored in the superblock is a proxy which never changes for
+ * the life of the mount. Calls made through it go to one of the current
+ * transports: multiplexed ones over TCP (see hsi_nfs3_mux.c), TI-RPC
+ * CLIENTs over UDP. A connection opens nconnect of them and a call takes
+ * the one with the fewest bytes outstanding. Transports are spread round
+ * robin over the server addresses (paths) given at creation.
+ *
+ * A transport whose small calls take HSI_CONN_DRAIN_FACTOR times longer
+ * than on the best one, or which failed HSI_CONN_DRAIN_ERRORS calls in a
+ * row, is drained: it gets no calls while others are usable, except one
+ * every HSI_CONN_PROBE_US to find out whether it got better.
+ *
+ * When a transport breaks it is marked broken: the failed call is parked
+ * and retried on another transport, or waits when none is left, while
+ * the background reconnect thread rebuilds it. Parked calls are resent
+ * with the xid they were first sent with, so the server's duplicate
+ * request cache can recognize a retransmission. So are timed out calls
+ * retransmitted by hsi_nfs3_clnt_call(): CLSET_XID and CLGET_XID on the
+ * connection act on the calling thread's next and last call, whatever
+ * transport it takes. A replaced transport is handed back to the
+ * reconnect thread by the last call still using it, and destroyed there:
+ * that last call may complete on the transport's own reader thread.
+ *
+ * Calls submitted without waiting (hsi_nfs3_conn_submit()) only go to
+ * multiplexed transports and are not replayed: a broken transport is
+ * reported and the call handed back to its owner as failed.
+ *
+ * TI-RPC serializes calls on a transport, so holding xprt->lock across
+ * CLSET_XID, the call and CLGET_XID costs nothing there. Multiplexed
+ * transports keep the xid per thread and are called without the lock.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hsi_nfs3.h"
+#include "conn.h"
+
+/* Reconnect attempts back off from 1s to this */
+#define HSI_CONN_MAX_DELAY	30
+#define HSI_CONN_DRAIN_FACTOR	4
+#define HSI_CONN_DRAIN_ERRORS	3
+#define HSI_CONN_PROBE_US	(5 * 1000000L)
+/* Only calls this small time the path, larger ones time the transfer */
+#define HSI_CONN_SMALL_CALL	4096
+
+struct hsi_nfs3_xprt {
+	pthread_mutex_t lock;	/* One call at a time, see above */
+	CLIENT *clnt;
+	int slot;
+	int mux;		/* Calls may run concurrently */
+	/* The rest is guarded by conn->lock */
+	int users;
+	int broken;
+	unsigned long bytes;	/* Outstanding */
+	long srtt;		/* Of small calls, in usec */
+	int errors;		/* Failed calls in a row */
+	long last_used;		/* In usec, for probing drained ones */
+	struct hsi_nfs3_xprt *next;	/* On conn->retired */
+};
+
+struct hsi_nfs3_conn {
+	CLIENT proxy;		/* Must be first */
+	pthread_mutex_t lock;
+	pthread_cond_t up;	/* Parked calls wait here */
+	pthread_cond_t kick;	/* The reconnect thread waits here */
+	int closing;
+	unsigned long gen;	/* Bumped on each reconnect */
+	int nxprt;
+	int nup;		/* Transports not broken */
+	unsigned int next;	/* Where the next search starts */
+	struct hsi_nfs3_xprt *xprt[HSI_NFS3_MAX_NCONNECT];
+	/* Replaced and unused, for the reconnect thread to destroy */
+	struct hsi_nfs3_xprt *retired;
+	clnt_addr_t addr;
+	int npaths;
+	struct in_addr paths[HSI_NFS3_MAX_NCONNECT];
+	int ssize, rsize;
+	pthread_t thread;
+};
+
+/* Error of the last call made by this thread, whatever the connection */
+static __thread struct rpc_err hsi_conn_err;
+/* Slot + 1 of the thread's home transport, 0 for round robin. */
+static __thread unsigned int hsi_conn_home;
+/* CLGET_XID and CLSET_XID, per thread whatever the transport taken */
+static __thread u_int32_t hsi_conn_last_xid;
+static __thread u_int32_t hsi_conn_next_xid;
+static __thread int hsi_conn_xid_set;
+/* Set by hsi_nfs3_conn_steer() for the thread's next call */
+static __thread int *hsi_conn_track;
+static __thread unsigned int hsi_conn_avoid;	/* Slot + 1, or 0 */
+
+/* A call submitted without waiting, until its completion */
+struct hsi_conn_async {
+	struct hsi_nfs3_conn *conn;
+	struct hsi_nfs3_xprt *xprt;
+	unsigned long bytes;
+	long start;
+	hsi_nfs3_done_t done;
+	void *priv;
+};
+
+static struct hsi_nfs3_xprt *hsi_xprt_alloc(CLIENT *clnt, int slot)
+{
+	struct hsi_nfs3_xprt *xprt;
+
+	xprt = calloc(1, sizeof(*xprt));
+	if (xprt == NULL)
+		return NULL;
+	pthread_mutex_init(&xprt->lock, NULL);
+	xprt->clnt = clnt;
+	xprt->slot = slot;
+	xprt->mux = hsi_nfs3_is_mux(clnt);
+	xprt->broken = (clnt == NULL);
+
+	return xprt;
+}
+
+static void hsi_xprt_free(struct hsi_nfs3_xprt *xprt)
+{
+	if (xprt->clnt) {
+		AUTH_DESTROY(xprt->clnt->cl_auth);
+		CLNT_DESTROY(xprt->clnt);
+	}
+	pthread_mutex_destroy(&xprt->lock);
+	free(xprt);
+}
+
+static long __now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/* Called with conn->lock held */
+static int hsi_conn_drained(struct hsi_nfs3_xprt *x, long best, long now)
+{
+	int bad;
+
+	bad = x->errors >= HSI_CONN_DRAIN_ERRORS ||
+	      (best && x->srtt > HSI_CONN_DRAIN_FACTOR * best);
+	if (!bad)
+		return 0;
+	/* Let a call through now and then to see whether it recovered. */
+	return now - x->last_used < HSI_CONN_PROBE_US;
+}
+
+/*
+ * Take the usable transport with the fewest bytes outstanding, parking
+ * while all of them are down unless told not to wait.
+ */
+/* The transport of slot avoid (or -1) only serves when no other can. */
+static struct hsi_nfs3_xprt *hsi_conn_get(struct hsi_nfs3_conn *conn,
+					  unsigned long bytes, int wait,
+					  int avoid)
+{
+	struct hsi_nfs3_xprt *xprt = NULL, *x;
+	long best = 0, now = __now_us();
+	unsigned int start;
+	int i, pass;
+
+	pthread_mutex_lock(&conn->lock);
+	while (wait && conn->nup == 0 && !conn->closing)
+		pthread_cond_wait(&conn->up, &conn->lock);
+	if (conn->closing || conn->nup == 0)
+		goto out;
+
+	/* Ties go to the home transport, or round robin without one. */
+	start = hsi_conn_home ? hsi_conn_home - 1 : conn->next;
+	for (i = 0; i < conn->nxprt; i++) {
+		x = conn->xprt[i];
+		if (!x->broken && x->srtt && x->errors < HSI_CONN_DRAIN_ERRORS &&
+		    (best == 0 || x->srtt < best))
+			best = x->srtt;
+	}
+	/* Drained transports only serve when nothing else is left. */
+	for (pass = 0; pass < 3 && xprt == NULL; pass++) {
+		for (i = 0; i < conn->nxprt; i++) {
+			x = conn->xprt[(start + i) % conn->nxprt];
+			if (x->broken)
+				continue;
+			if (pass < 2 && x->slot == avoid)
+				continue;
+			if (!pass && hsi_conn_drained(x, best, now))
+				continue;
+			if (xprt == NULL || x->bytes < xprt->bytes ||
+			    (x->bytes == xprt->bytes && x->users < xprt->users))
+				xprt = x;
+		}
+	}
+	conn->next = xprt->slot + 1;
+	xprt->users++;
+	xprt->bytes += bytes;
+	xprt->last_used = now;
+out:
+	pthread_mutex_unlock(&conn->lock);
+
+	return xprt;
+}
+
+static void hsi_conn_put(struct hsi_nfs3_conn *conn,
+			 struct hsi_nfs3_xprt *xprt, unsigned long bytes)
+{
+	pthread_mutex_lock(&conn->lock);
+	xprt->bytes -= bytes;
+	if (--xprt->users == 0 && xprt != conn->xprt[xprt->slot]) {
+		xprt->next = conn->retired;
+		conn->retired = xprt;
+		pthread_cond_signal(&conn->kick);
+	}
+	pthread_mutex_unlock(&conn->lock);
+}
+
+/* Account the outcome of a call for draining. */
+static void hsi_conn_account(struct hsi_nfs3_conn *conn,
+			     struct hsi_nfs3_xprt *xprt, enum clnt_stat st,
+			     unsigned long bytes, long us)
+{
+	pthread_mutex_lock(&conn->lock);
+	if (st == RPC_SUCCESS) {
+		if (xprt->errors >= HSI_CONN_DRAIN_ERRORS)
+			INFO("Connection %d to server usable again.",
+			     xprt->slot);
+		xprt->errors = 0;
+		if (bytes <= HSI_CONN_SMALL_CALL)
+			xprt->srtt = xprt->srtt ?
+				xprt->srtt + (us - xprt->srtt) / 8 : us;
+	} else if (st == RPC_TIMEDOUT || st == RPC_CANTSEND ||
+		   st == RPC_CANTRECV) {
+		if (++xprt->errors == HSI_CONN_DRAIN_ERRORS)
+			WARNING("Connection %d to server failing, drained.",
+				xprt->slot);
+	}
+	pthread_mutex_unlock(&conn->lock);
+}
+
+/* The transport is broken, hand it to the reconnect thread. */
+static void hsi_conn_fail(struct hsi_nfs3_conn *conn,
+			  struct hsi_nfs3_xprt *xprt)
+{
+	pthread_mutex_lock(&conn->lock);
+	if (xprt == conn->xprt[xprt->slot] && !xprt->broken) {
+		WARNING("Connection %d to server lost, reconnecting.",
+			xprt->slot);
+		xprt->broken = 1;
+		conn->nup--;
+		pthread_cond_signal(&conn->kick);
+	}
+	pthread_mutex_unlock(&conn->lock);
+}
+
+static int hsi_conn_broken(enum clnt_stat st, const struct rpc_err *err)
+{
+	if (st != RPC_CANTSEND && st != RPC_CANTRECV)
+		return 0;
+
+	return err->re_errno != EINTR && err->re_errno != EAGAIN;
+}
+
+/* Called with conn->lock held, returns a broken slot or -1. */
+static int hsi_conn_broken_slot(struct hsi_nfs3_conn *conn)
+{
+	int i;
+
+	for (i = 0; i < conn->nxprt; i++)
+		if (conn->xprt[i]->broken)
+			return i;
+	return -1;
+}
+
+static CLIENT *hsi_conn_open(struct hsi_nfs3_conn *conn, int slot)
+{
+	clnt_addr_t addr = conn->addr;
+
+	addr.saddr.sin_addr = conn->paths[slot % conn->npaths];
+
+	return hsi_nfs3_clnt_create(&addr, conn->ssize, conn->rsize);
+}
+
+/* Called with conn->lock held, which is dropped meanwhile. */
+static void hsi_conn_reap(struct hsi_nfs3_conn *conn)
+{
+	struct hsi_nfs3_xprt *xprt;
+
+	while ((xprt = conn->retired)) {
+		conn->retired = xprt->next;
+		pthread_mutex_unlock(&conn->lock);
+		hsi_xprt_free(xprt);
+		pthread_mutex_lock(&conn->lock);
+	}
+}
+
+static void *hsi_conn_reconnect(void *arg)
+{
+	struct hsi_nfs3_conn *conn = arg;
+	struct hsi_nfs3_xprt *xprt, *old;
+	struct timespec ts;
+	CLIENT *clnt;
+	int slot, delay, retired;
+
+	pthread_mutex_lock(&conn->lock);
+	for (;;) {
+		hsi_conn_reap(conn);
+		while ((slot = hsi_conn_broken_slot(conn)) < 0 &&
+		       !conn->retired && !conn->closing)
+			pthread_cond_wait(&conn->kick, &conn->lock);
+		if (conn->closing)
+			break;
+		if (slot < 0)
+			continue;
+		pthread_mutex_unlock(&conn->lock);
+
+		delay = 1;
+		for (;;) {
+			clnt = hsi_conn_open(conn, slot);
+			if (clnt && (xprt = hsi_xprt_alloc(clnt, slot)))
+				break;
+			if (clnt) {
+				AUTH_DESTROY(clnt->cl_auth);
+				CLNT_DESTROY(clnt);
+			}
+
+			/* Sleep, but wake up at once on unmount. */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += delay;
+			pthread_mutex_lock(&conn->lock);
+			if (!conn->closing)
+				pthread_cond_timedwait(&conn->kick, &conn->lock,
+						       &ts);
+			if (conn->closing)
+				goto out;
+			hsi_conn_reap(conn);
+			pthread_mutex_unlock(&conn->lock);
+			delay = min(delay * 2, HSI_CONN_MAX_DELAY);
+		}
+
+		pthread_mutex_lock(&conn->lock);
+		old = conn->xprt[slot];
+		conn->xprt[slot] = xprt;
+		conn->proxy.cl_auth = clnt->cl_auth;
+		conn->gen++;
+		conn->nup++;
+		retired = (old->users == 0);
+		pthread_cond_broadcast(&conn->up);
+		pthread_mutex_unlock(&conn->lock);
+
+		if (retired)
+			hsi_xprt_free(old);
+		INFO("Reconnected to server (connection %d, generation %lu).",
+		     slot, conn->gen);
+
+		pthread_mutex_lock(&conn->lock);
+	}
+out:
+	pthread_mutex_unlock(&conn->lock);
+	return NULL;
+}
+
+static enum clnt_stat hsi_conn_call(CLIENT *cl, rpcproc_t proc,
+				    xdrproc_t xargs, void *args,
+				    xdrproc_t xres, void *res,
+				    struct timeval tout)
+{
+	struct hsi_nfs3_conn *conn = (struct hsi_nfs3_conn *)cl;
+	struct hsi_nfs3_xprt *xprt;
+	enum clnt_stat st;
+	unsigned long bytes = 0;
+	u_int32_t xid = hsi_conn_next_xid;
+	int replay = hsi_conn_xid_set;	/* Keep xid */
+	int *track = hsi_conn_track;
+	int avoid = (int)hsi_conn_avoid - 1;
+	long start;
+
+	hsi_conn_xid_set = 0;
+	hsi_conn_track = NULL;
+	hsi_conn_avoid = 0;
+	if (conn->addr.pmap.pm_prog == NFS_PROGRAM)
+		bytes = hsi_nfs3_call_bytes(proc, args);
+
+	for (;;) {
+		xprt = hsi_conn_get(conn, bytes, 1, avoid);
+		if (xprt == NULL) {
+			hsi_conn_err.re_status = RPC_CANTSEND;
+			hsi_conn_err.re_errno = ESHUTDOWN;
+			return RPC_CANTSEND;
+		}
+		if (track)
+			__sync_lock_test_and_set(track, xprt->slot);
+
+		if (!xprt->mux)
+			pthread_mutex_lock(&xprt->lock);
+		start = __now_us();
+		if (replay)
+			CLNT_CONTROL(xprt->clnt, CLSET_XID, (char *)&xid);
+		st = CLNT_CALL(xprt->clnt, proc, xargs, args, xres, res, tout);
+		if (!replay)
+			CLNT_CONTROL(xprt->clnt, CLGET_XID, (char *)&xid);
+		hsi_conn_last_xid = xid;
+		CLNT_GETERR(xprt->clnt, &hsi_conn_err);
+		if (!xprt->mux)
+			pthread_mutex_unlock(&xprt->lock);
+		hsi_conn_account(conn, xprt, st, bytes, __now_us() - start);
+
+		if (st == RPC_SUCCESS || !hsi_conn_broken(st, &hsi_conn_err)) {
+			hsi_conn_put(conn, xprt, bytes);
+			return st;
+		}
+
+		hsi_conn_fail(conn, xprt);
+		hsi_conn_put(conn, xprt, bytes);
+		DEBUG("Proc %u xid 0x%x parked for replay.", proc, xid);
+		replay = 1;
+	}
+}
+
+static void hsi_conn_abort(CLIENT *cl _U_)
+{
+}
+
+static void hsi_conn_geterr(CLIENT *cl _U_, struct rpc_err *err)
+{
+	*err = hsi_conn_err;
+}
+
+/* Results never reference the transport, no need to lock it. */
+static bool_t hsi_conn_freeres(CLIENT *cl _U_, xdrproc_t xres, void *res)
+{
+	xdr_free(xres, res);
+	return TRUE;
+}
+
+static bool_t hsi_conn_control(CLIENT *cl, u_int req, void *info)
+{
+	struct hsi_nfs3_conn *conn = (struct hsi_nfs3_conn *)cl;
+	struct hsi_nfs3_xprt *xprt;
+	bool_t ret;
+
+	/* The next call may go to any transport. */
+	switch (req) {
+	case CLGET_XID:
+		*(u_int32_t *)info = hsi_conn_last_xid;
+		return TRUE;
+	case CLSET_XID:
+		hsi_conn_next_xid = *(u_int32_t *)info;
+		hsi_conn_xid_set = 1;
+		return TRUE;
+	}
+
+	xprt = hsi_conn_get(conn, 0, 1, -1);
+	if (xprt == NULL)
+		return FALSE;
+	if (!xprt->mux)
+		pthread_mutex_lock(&xprt->lock);
+	ret = CLNT_CONTROL(xprt->clnt, req, info);
+	if (!xprt->mux)
+		pthread_mutex_unlock(&xprt->lock);
+	hsi_conn_put(conn, xprt, 0);
+
+	return ret;
+}
+
+static void hsi_conn_destroy(CLIENT *cl)
+{
+	struct hsi_nfs3_conn *conn = (struct hsi_nfs3_conn *)cl;
+	int i;
+
+	pthread_mutex_lock(&conn->lock);
+	conn->closing = 1;
+	pthread_cond_broadcast(&conn->kick);
+	pthread_cond_broadcast(&conn->up);
+	pthread_mutex_unlock(&conn->lock);
+	pthread_join(conn->thread, NULL);
+
+	pthread_mutex_lock(&conn->lock);
+	hsi_conn_reap(conn);
+	pthread_mutex_unlock(&conn->lock);
+	for (i = 0; i < conn->nxprt; i++)
+		hsi_xprt_free(conn->xprt[i]);
+	pthread_cond_destroy(&conn->up);
+	pthread_cond_destroy(&conn->kick);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+}
+
+void hsi_nfs3_conn_seterr(const struct rpc_err *err)
+{
+	hsi_conn_err = *err;
+}
+
+void hsi_nfs3_conn_home(int slot)
+{
+	hsi_conn_home = slot + 1;
+}
+
+void hsi_nfs3_conn_steer(int *slot, int avoid)
+{
+	hsi_conn_track = slot;
+	hsi_conn_avoid = avoid + 1;
+}
+
+static struct clnt_ops hsi_conn_ops = {
+	.cl_call = hsi_conn_call,
+	.cl_abort = hsi_conn_abort,
+	.cl_geterr = hsi_conn_geterr,
+	.cl_freeres = hsi_conn_freeres,
+	.cl_destroy = hsi_conn_destroy,
+	.cl_control = hsi_conn_control,
+};
+
+static void hsi_conn_done(void *arg, enum clnt_stat st)
+{
+	struct hsi_conn_async *a = arg;
+
+	hsi_conn_account(a->conn, a->xprt, st, a->bytes, __now_us() - a->start);
+	/* Only a dead socket gives this, see hsi_nfs3_mux_submit(). */
+	if (st == RPC_CANTRECV)
+		hsi_conn_fail(a->conn, a->xprt);
+	hsi_conn_put(a->conn, a->xprt, a->bytes);
+	a->done(a->priv, st);
+	free(a);
+}
+
+int hsi_nfs3_conn_submit(CLIENT *cl, rpcproc_t proc, xdrproc_t xargs,
+			 void *args, xdrproc_t xres, void *res,
+			 struct timeval tout, hsi_nfs3_done_t done, void *priv)
+{
+	struct hsi_nfs3_conn *conn = (struct hsi_nfs3_conn *)cl;
+	struct hsi_conn_async *a;
+	int err;
+
+	if (hsi_nfs3_is_mux(cl))
+		return hsi_nfs3_mux_submit(cl, proc, xargs, args, xres, res,
+					   tout, done, priv);
+	if (cl->cl_ops != &hsi_conn_ops)
+		return ENOTSUP;
+
+	a = malloc(sizeof(*a));
+	if (a == NULL)
+		return ENOMEM;
+	a->conn = conn;
+	a->bytes = 0;
+	if (conn->addr.pmap.pm_prog == NFS_PROGRAM)
+		a->bytes = hsi_nfs3_call_bytes(proc, args);
+	a->done = done;
+	a->priv = priv;
+
+	a->xprt = hsi_conn_get(conn, a->bytes, 0, -1);
+	if (a->xprt == NULL) {
+		free(a);
+		return EAGAIN;
+	}
+	if (!a->xprt->mux) {
+		err = ENOTSUP;
+		goto out_put;
+	}
+	a->start = __now_us();
+	err = hsi_nfs3_mux_submit(a->xprt->clnt, proc, xargs, args, xres, res,
+				  tout, hsi_conn_done, a);
+	if (err == 0)
+		return 0;
+out_put:
+	hsi_conn_put(conn, a->xprt, a->bytes);
+	free(a);
+	return err;
+}
+
+CLIENT *hsi_nfs3_conn_create(clnt_addr_t *server, int ssize, int rsize,
+			     int nconnect, const struct sockaddr_in *paths,
+			     int npaths)
+{
+	struct hsi_nfs3_conn *conn;
+	CLIENT *clnt;
+	int i;
+
+	if (nconnect < 1)
+		nconnect = 1;
+	if (nconnect > HSI_NFS3_MAX_NCONNECT)
+		nconnect = HSI_NFS3_MAX_NCONNECT;
+
+	conn = calloc(1, sizeof(*conn));
+	if (conn == NULL)
+		return NULL;
+	pthread_mutex_init(&conn->lock, NULL);
+	pthread_cond_init(&conn->up, NULL);
+	pthread_cond_init(&conn->kick, NULL);
+	conn->addr = *server;
+	conn->addr.hostname = NULL;	/* Points to the caller's stack */
+	conn->ssize = ssize;
+	conn->rsize = rsize;
+	conn->proxy.cl_ops = &hsi_conn_ops;
+	conn->proxy.cl_private = conn;
+	if (paths == NULL || npaths < 1) {
+		conn->paths[0] = server->saddr.sin_addr;
+		conn->npaths = 1;
+	} else {
+		for (i = 0; i < npaths && i < HSI_NFS3_MAX_NCONNECT; i++)
+			conn->paths[i] = paths[i].sin_addr;
+		conn->npaths = i;
+	}
+
+	/*
+	 * The first transport must come up, the others are left to the
+	 * reconnect thread if their path is down for now.
+	 */
+	for (i = 0; i < nconnect; i++) {
+		clnt = hsi_conn_open(conn, i);
+		if (clnt == NULL && i == 0)
+			goto out;
+		conn->xprt[i] = hsi_xprt_alloc(clnt, i);
+		if (conn->xprt[i] == NULL) {
+			if (clnt) {
+				AUTH_DESTROY(clnt->cl_auth);
+				CLNT_DESTROY(clnt);
+			}
+			goto out;
+		}
+		conn->nxprt++;
+		if (clnt)
+			conn->nup++;
+	}
+	conn->proxy.cl_auth = conn->xprt[0]->clnt->cl_auth;
+
+	if (pthread_create(&conn->thread, NULL, hsi_conn_reconnect, conn)) {
+		ERR("Failed to start the reconnect thread.");
+		goto out;
+	}
+
+	return &conn->proxy;
+
+out:
+	for (i = 0; i < conn->nxprt; i++)
+		hsi_xprt_free(conn->xprt[i]);
+	pthread_cond_destroy(&conn->up);
+	pthread_cond_destroy(&conn->kick);
+	pthread_mutex_destroy(&conn->lock);
+	free(conn);
+	return NULL;
+}
@@ -40,6 +40,7 @@ int hsi_nfs3_create(struct hsfs_inode *hi, struct hsfs_inode **new,
 	struct hsfs_super *sb = hi->sb;
 	struct create3args args;
 	struct diropres3 res;
+	char fhbuf[NFS3_FHSIZE];
 	mode_t cmode = mode & 0xF0000;
 	mode_t fmode = mode & FULL_MODE;
 	CLIENT *clntp = NULL;
@@ -49,6 +50,8 @@ int hsi_nfs3_create(struct hsfs_inode *hi, struct hsfs_inode **new,
 	
 	memset(&args, 0, sizeof(struct create3args));
 	memset(&res, 0, sizeof(struct diropres3));
+	/* The handle is decoded in place, the reply holds nothing to free. */
+	res.diropres3_u.resok.obj.post_op_fh3_u.handle.data.data_val = fhbuf;
 
 	hsi_nfs3_getfh3(hi, &args.where.dir);
 	args.where.name = (char *)name;
@@ -81,14 +84,15 @@ int hsi_nfs3_create(struct hsfs_inode *hi, struct hsfs_inode **new,
 
 	if (NFS3_OK != res.status) {
 		status = hsi_nfs3_stat_to_errno(res.status);
-		goto out_free;
+		goto out;
 	}
 
+	hsi_nfs3_wcc_update(hi, &res.diropres3_u.resok.dir_wcc);
 	*new = hsi_nfs3_handle_create(sb, &res.diropres3_u.resok);
 	if(IS_ERR(*new)){
 		status = PTR_ERR(*new);
 		*new = NULL;
-		goto out_free;
+		goto out;
 	}
 
 	if (EXCLUSIVE == args.how.mode) {
@@ -98,8 +102,6 @@ int hsi_nfs3_create(struct hsfs_inode *hi, struct hsfs_inode **new,
 		status = hsi_nfs_setattr(*new, &sattr);
 	}
 
-out_free:
-	clnt_freeres(clntp, (xdrproc_t)xdr_diropres3, (caddr_t)&res);
 out:
 	DEBUG_OUT("Out of hsi_nfs3_create, with STATUS = %d", status);
 	return status;
@@ -19,29 +19,20 @@
 
 #include "hsi_nfs3.h"
 
-int hsi_nfs3_do_getattr(struct hsfs_super *sb, struct nfs_fh3 *fh,
-			struct nfs_fattr *fattr, struct stat *st)
+/* Check a GETATTR reply and convert its attributes. */
+static int hsi_nfs3_getattr_res(struct getattr3res *res,
+				struct nfs_fattr *fattr, struct stat *st)
 {
-	struct getattr3res res;
 	struct fattr3 *attr = NULL;
 	int err;
-	
-	DEBUG_IN("(%p, %p, %p, %p)", sb, fh, fattr, st);
-
-	memset(&res, 0, sizeof(res));
-	err = hsi_nfs3_clnt_call(sb, sb->clntp, NFSPROC3_GETATTR,
-				 (xdrproc_t)xdr_nfs_fh3, (caddr_t)fh,
-				(xdrproc_t)xdr_getattr3res, (caddr_t)&res);
-	if (err)
-		goto out_no_free;
 
-	if (NFS3_OK != res.status) {
-		err = hsi_nfs3_stat_to_errno(res.status);
+	if (NFS3_OK != res->status) {
+		err = hsi_nfs3_stat_to_errno(res->status);
 		ERR("RPC Server returns failed status : %d.\n", err);
-		goto out;
+		return err;
 	}
-	
-	attr = &res.getattr3res_u.attributes;
+
+	attr = &res->getattr3res_u.attributes;
 	if (fattr){
 		hsi_nfs3_fattr2fattr(attr, fattr);
 		DEBUG("get nfs_fattr(V:%x, U:%u, G:%u, S:%llu, I:%llu)",
@@ -49,14 +40,52 @@ int hsi_nfs3_do_getattr(struct hsfs_super *sb, struct nfs_fh3 *fh,
 	}
 	if (st)
 		hsi_nfs3_fattr2stat(attr, st);
+
+	return 0;
+}
+
+int hsi_nfs3_do_getattr(struct hsfs_super *sb, struct nfs_fh3 *fh,
+			struct nfs_fattr *fattr, struct stat *st)
+{
+	struct getattr3res res;
+	int err;
 	
- out:
+	DEBUG_IN("(%p, %p, %p, %p)", sb, fh, fattr, st);
+
+	memset(&res, 0, sizeof(res));
+	err = hsi_nfs3_clnt_call(sb, sb->clntp, NFSPROC3_GETATTR,
+				 (xdrproc_t)xdr_nfs_fh3, (caddr_t)fh,
+				(xdrproc_t)hsi_xdr_getattr3res, (caddr_t)&res);
+	if (err)
+		goto out_no_free;
+
+	err = hsi_nfs3_getattr_res(&res, fattr, st);
 	clnt_freeres(sb->clntp, (xdrproc_t)xdr_getattr3res, (char *)&res);
  out_no_free:
 	DEBUG_OUT("with errno %d.\n", err);
 	return err;
 }
 
+int hsi_nfs3_getattr_finish(struct hsfs_inode *inode,
+			    struct getattr3res *res, struct stat *st)
+{
+	struct nfs_fattr fattr;
+	int err;
+
+	DEBUG_IN("(%p)", inode);
+
+	nfs_init_fattr(&fattr);
+	err = hsi_nfs3_getattr_res(res, &fattr, st);
+	xdr_free((xdrproc_t)xdr_getattr3res, (char *)res);
+	if (err)
+		goto out;
+
+	err = nfs_refresh_inode(inode, &fattr);
+out:
+	DEBUG_OUT("(%d)", err);
+	return err;
+}
+
 int hsi_nfs3_getattr(struct hsfs_inode *inode, struct stat *st)
 {
 	int err = 0;
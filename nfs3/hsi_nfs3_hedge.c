@@ -0,0 +1,535 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hedged requests.
+ *
+ * An idempotent call which has not been answered within the p95 latency
+ * of its class is sent a second time, and the first good reply wins. A
+ * TI-RPC call blocks the thread making it, so both copies (legs) are made
+ * by a few worker threads while the caller waits for a winner. The legs
+ * decode into their own results; the winner's is then passed to the
+ * caller through XDR, like a joined single-flight call, so the loser can
+ * finish on its own and be freed by whoever drops the race last.
+ *
+ * The arguments are encoded once, before the first leg goes out, since
+ * the caller's own may be gone by the time a losing leg sends them.
+ *
+ * The second leg goes to the least busy transport of the connection other
+ * than the one carrying the first, unless no other one is up. It is only
+ * sent when the budget allows it and the concurrency limiter has a free
+ * slot, so hedging cannot add load to a server that is already behind.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hsi_nfs3.h"
+#include "hsfs_buf.h"
+
+/* Latency histogram: 4 buckets per power of two, from 1us to ~16s */
+#define HSI_HEDGE_SUB		4
+#define HSI_HEDGE_NBUCKET	(24 * HSI_HEDGE_SUB)
+/* Samples needed before the p95 is trusted */
+#define HSI_HEDGE_MIN_SAMPLES	100
+/* Counts are halved after this many samples, to follow the server */
+#define HSI_HEDGE_DECAY		2048
+/* Hedges that can be saved up while the budget is not used */
+#define HSI_HEDGE_MAX_TOKENS	10.0
+
+struct hsi_hedge_race;
+
+struct hsi_hedge_leg {
+	struct hsi_hedge_leg *next;	/* In the work queue */
+	struct hsi_hedge_race *race;
+	int slot;		/* Transport taken, -1 until known */
+	enum clnt_stat st;
+	struct rpc_err err;
+	u_int32_t xid;		/* Sent with, for a retransmission */
+	union {
+		getattr3res getattr;
+		lookup3res lookup;
+		access3res access;
+		readlink3res readlink;
+		read3res read;
+		readdir3res readdir;
+		readdirplus3res readdirplus;
+	} res;
+};
+
+struct hsi_hedge_race {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int refs;
+	int nlegs;
+	int pending;		/* Legs not answered yet */
+	int winner;		/* Leg with the first good reply, or -1 */
+	struct hsi_nfs3_hedge *hg;
+	CLIENT *clnt;
+	unsigned long proc;
+	int cls;
+	unsigned int bytes;	/* Scheduling cost */
+	xdrproc_t xres;
+	struct timeval tout;
+	char *args;
+	unsigned int alen;
+	struct hsi_hedge_leg leg[2];
+};
+
+struct hsi_nfs3_hedge {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	struct hsi_hedge_leg *head, **tail;
+	int idle;		/* Workers free to take a leg */
+	int closing;
+	double tokens;
+	double refill;		/* Tokens earned per eligible call */
+	struct hsi_nfs3_limit *lim;
+	unsigned int count[HSI_RTT_NCLASS][HSI_HEDGE_NBUCKET];
+	unsigned int total[HSI_RTT_NCLASS];
+	int nthread;
+	pthread_t thread[];
+};
+
+static inline long __now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static xdrproc_t hsi_hedge_xres(unsigned long proc)
+{
+	switch (proc) {
+	case NFSPROC3_GETATTR:
+		return (xdrproc_t)hsi_xdr_getattr3res;
+	case NFSPROC3_LOOKUP:
+		return (xdrproc_t)hsi_xdr_lookup3res;
+	case NFSPROC3_ACCESS:
+		return (xdrproc_t)hsi_xdr_access3res;
+	case NFSPROC3_READLINK:
+		return (xdrproc_t)xdr_readlink3res;
+	case NFSPROC3_READ:
+		return (xdrproc_t)hsi_xdr_read3res;
+	case NFSPROC3_READDIR:
+		return (xdrproc_t)xdr_readdir3res;
+	case NFSPROC3_READDIRPLUS:
+		return (xdrproc_t)xdr_readdirplus3res;
+	default:
+		return NULL;
+	}
+}
+
+static int hsi_hedge_bucket(long us)
+{
+	int b, s;
+
+	if (us < 1)
+		us = 1;
+	b = 63 - __builtin_clzl((unsigned long)us);
+	s = b >= 2 ? (us >> (b - 2)) & (HSI_HEDGE_SUB - 1) : 0;
+	b = b * HSI_HEDGE_SUB + s;
+
+	return min(b, HSI_HEDGE_NBUCKET - 1);
+}
+
+/* Upper bound of a bucket, in usec */
+static long hsi_hedge_bound(int i)
+{
+	int b = i / HSI_HEDGE_SUB, s = i % HSI_HEDGE_SUB;
+
+	return (1L << b) + ((1L << b) * (s + 1)) / HSI_HEDGE_SUB;
+}
+
+static void hsi_hedge_sample(struct hsi_nfs3_hedge *hg, int cls, long us)
+{
+	int i;
+
+	pthread_mutex_lock(&hg->lock);
+	hg->count[cls][hsi_hedge_bucket(us)]++;
+	if (++hg->total[cls] >= HSI_HEDGE_DECAY) {
+		hg->total[cls] = 0;
+		for (i = 0; i < HSI_HEDGE_NBUCKET; i++) {
+			hg->count[cls][i] /= 2;
+			hg->total[cls] += hg->count[cls][i];
+		}
+	}
+	pthread_mutex_unlock(&hg->lock);
+}
+
+/* Called with hg->lock held, returns 0 until enough samples are seen */
+static long hsi_hedge_p95(struct hsi_nfs3_hedge *hg, int cls)
+{
+	unsigned int want, sum = 0;
+	int i;
+
+	if (hg->total[cls] < HSI_HEDGE_MIN_SAMPLES)
+		return 0;
+	want = hg->total[cls] - hg->total[cls] / 20;
+	for (i = 0; i < HSI_HEDGE_NBUCKET; i++) {
+		sum += hg->count[cls][i];
+		if (sum >= want)
+			break;
+	}
+
+	return hsi_hedge_bound(min(i, HSI_HEDGE_NBUCKET - 1));
+}
+
+static bool_t __xdr_hedge_args(XDR *xdrs, struct hsi_hedge_race *race)
+{
+	return xdr_opaque(xdrs, race->args, race->alen);
+}
+
+static void hsi_hedge_race_put(struct hsi_hedge_race *race)
+{
+	int i, last;
+
+	pthread_mutex_lock(&race->lock);
+	last = (--race->refs == 0);
+	pthread_mutex_unlock(&race->lock);
+	if (!last)
+		return;
+
+	for (i = 0; i < race->nlegs; i++)
+		if (race->leg[i].st == RPC_SUCCESS)
+			xdr_free(race->xres, (char *)&race->leg[i].res);
+	pthread_cond_destroy(&race->cond);
+	pthread_mutex_destroy(&race->lock);
+	free(race->args);
+	free(race);
+}
+
+/* Called with hg->lock held */
+static int hsi_hedge_submit(struct hsi_nfs3_hedge *hg,
+			    struct hsi_hedge_leg *leg)
+{
+	if (hg->idle == 0 || hg->closing)
+		return -1;
+	hg->idle--;
+	leg->next = NULL;
+	*hg->tail = leg;
+	hg->tail = &leg->next;
+	pthread_cond_signal(&hg->work);
+
+	return 0;
+}
+
+static void hsi_hedge_run(struct hsi_hedge_leg *leg)
+{
+	struct hsi_hedge_race *race = leg->race;
+	int hedge = (leg != &race->leg[0]);
+	long start = __now_us(), us;
+
+	if (hedge)
+		hsi_nfs3_conn_steer(NULL, __sync_fetch_and_add(
+					    &race->leg[0].slot, 0));
+	else
+		hsi_nfs3_conn_steer(&leg->slot, -1);
+	leg->st = clnt_call(race->clnt, race->proc,
+			    (xdrproc_t)__xdr_hedge_args, (char *)race,
+			    race->xres, (char *)&leg->res, race->tout);
+	us = __now_us() - start;
+	CLNT_CONTROL(race->clnt, CLGET_XID, (char *)&leg->xid);
+	clnt_geterr(race->clnt, &leg->err);
+	if (leg->st == RPC_SUCCESS)
+		hsi_hedge_sample(race->hg, race->cls, us);
+	/* The first leg runs on the caller's slot, the hedge on its own. */
+	if (hedge)
+		hsi_nfs3_limit_release(race->hg->lim, race->cls, race->bytes,
+				       us, leg->st == RPC_TIMEDOUT);
+
+	pthread_mutex_lock(&race->lock);
+	race->pending--;
+	if (leg->st == RPC_SUCCESS && race->winner < 0) {
+		race->winner = leg - race->leg;
+		if (hedge)
+			DEBUG("Proc %lu won by its hedge.", race->proc);
+	}
+	pthread_cond_signal(&race->cond);
+	pthread_mutex_unlock(&race->lock);
+
+	hsi_hedge_race_put(race);
+}
+
+static void *hsi_hedge_worker(void *arg)
+{
+	struct hsi_nfs3_hedge *hg = arg;
+	struct hsi_hedge_leg *leg;
+
+	pthread_mutex_lock(&hg->lock);
+	for (;;) {
+		while (hg->head == NULL && !hg->closing)
+			pthread_cond_wait(&hg->work, &hg->lock);
+		if (hg->head == NULL)
+			break;
+		leg = hg->head;
+		hg->head = leg->next;
+		if (hg->head == NULL)
+			hg->tail = &hg->head;
+		pthread_mutex_unlock(&hg->lock);
+
+		hsi_hedge_run(leg);
+
+		pthread_mutex_lock(&hg->lock);
+		hg->idle++;
+	}
+	pthread_mutex_unlock(&hg->lock);
+
+	return NULL;
+}
+
+struct hsi_nfs3_hedge *hsi_nfs3_hedge_alloc(unsigned int percent,
+					    int nthread,
+					    struct hsi_nfs3_limit *lim)
+{
+	struct hsi_nfs3_hedge *hg;
+
+	hg = calloc(1, sizeof(*hg) + nthread * sizeof(pthread_t));
+	if (hg == NULL)
+		return NULL;
+
+	pthread_mutex_init(&hg->lock, NULL);
+	pthread_cond_init(&hg->work, NULL);
+	hg->tail = &hg->head;
+	hg->refill = percent / 100.0;
+	hg->lim = lim;
+
+	for (hg->nthread = 0; hg->nthread < nthread; hg->nthread++) {
+		if (pthread_create(&hg->thread[hg->nthread], NULL,
+				   hsi_hedge_worker, hg)) {
+			ERR("Failed to start hedge worker %d.", hg->nthread);
+			break;
+		}
+	}
+	hg->idle = hg->nthread;
+	if (hg->nthread == 0) {
+		hsi_nfs3_hedge_free(hg);
+		return NULL;
+	}
+
+	return hg;
+}
+
+void hsi_nfs3_hedge_free(struct hsi_nfs3_hedge *hg)
+{
+	int i;
+
+	if (hg == NULL)
+		return;
+
+	pthread_mutex_lock(&hg->lock);
+	hg->closing = 1;
+	pthread_cond_broadcast(&hg->work);
+	pthread_mutex_unlock(&hg->lock);
+	for (i = 0; i < hg->nthread; i++)
+		pthread_join(hg->thread[i], NULL);
+
+	pthread_cond_destroy(&hg->work);
+	pthread_mutex_destroy(&hg->lock);
+	free(hg);
+}
+
+/* Hand the winner's reply to the caller, in the caller's thread. */
+static enum clnt_stat hsi_hedge_copy(struct hsi_hedge_race *race,
+				     xdrproc_t outproc, char *out,
+				     struct rpc_err *err)
+{
+	struct hsi_hedge_leg *leg = &race->leg[race->winner];
+	enum clnt_stat st = RPC_SUCCESS;
+	unsigned int len;
+	char *buf;
+	XDR xdrs;
+
+	*err = leg->err;
+	len = xdr_sizeof(race->xres, &leg->res);
+	buf = hsfs_buf_get(len);
+	if (buf == NULL)
+		goto nomem;
+
+	xdrmem_create(&xdrs, buf, len, XDR_ENCODE);
+	if (!race->xres(&xdrs, &leg->res)) {
+		xdr_destroy(&xdrs);
+		hsfs_buf_put(buf, len);
+		goto nomem;
+	}
+	xdr_destroy(&xdrs);
+
+	xdrmem_create(&xdrs, buf, len, XDR_DECODE);
+	if (!outproc(&xdrs, out)) {
+		st = RPC_CANTDECODERES;
+		err->re_status = st;
+	}
+	xdr_destroy(&xdrs);
+	hsfs_buf_put(buf, len);
+
+	return st;
+nomem:
+	err->re_status = RPC_SYSTEMERROR;
+	err->re_errno = ENOMEM;
+	return RPC_SYSTEMERROR;
+}
+
+/* Send the second leg if the budget and the limiter allow it. */
+static void hsi_hedge_second(struct hsi_nfs3_hedge *hg,
+			     struct hsi_hedge_race *race)
+{
+	int sent = 0;
+
+	/* Nobody sees leg[1] before it is queued, count it in advance. */
+	pthread_mutex_lock(&race->lock);
+	race->refs++;
+	race->nlegs++;
+	race->pending++;
+	pthread_mutex_unlock(&race->lock);
+
+	pthread_mutex_lock(&hg->lock);
+	if (hg->tokens >= 1.0 && hg->idle > 0 &&
+	    hsi_nfs3_limit_tryacquire(hg->lim, race->cls, race->bytes)) {
+		hg->tokens -= 1.0;
+		hsi_hedge_submit(hg, &race->leg[1]);
+		sent = 1;
+	}
+	pthread_mutex_unlock(&hg->lock);
+
+	if (sent) {
+		DEBUG("Proc %lu slower than the p95 of its class, hedged.",
+		      race->proc);
+		return;
+	}
+	pthread_mutex_lock(&race->lock);
+	race->refs--;
+	race->nlegs--;
+	race->pending--;
+	pthread_mutex_unlock(&race->lock);
+}
+
+enum clnt_stat hsi_nfs3_hedge_call(struct hsi_nfs3_hedge *hg, CLIENT *clnt,
+				   unsigned long procnum,
+				   xdrproc_t inproc, char *in,
+				   xdrproc_t outproc, char *out,
+				   struct timeval tout, u_int32_t *xid)
+{
+	struct hsi_hedge_race *race = NULL;
+	struct rpc_err err;
+	struct timespec ts;
+	enum clnt_stat st;
+	xdrproc_t xres;
+	long delay = 0, start, wait;
+	int cls = hsi_nfs3_rtt_class(procnum);
+	int i;
+
+	xres = hsi_hedge_xres(procnum);
+	if (xres) {
+		pthread_mutex_lock(&hg->lock);
+		hg->tokens = min(hg->tokens + hg->refill, HSI_HEDGE_MAX_TOKENS);
+		delay = hsi_hedge_p95(hg, cls);
+		pthread_mutex_unlock(&hg->lock);
+	}
+
+	if (delay)
+		race = calloc(1, sizeof(*race));
+	if (race == NULL)
+		goto direct;
+
+	race->alen = xdr_sizeof(inproc, in);
+	race->args = malloc(race->alen);
+	if (race->args == NULL) {
+		free(race);
+		goto direct;
+	}
+	{
+		XDR xdrs;
+
+		xdrmem_create(&xdrs, race->args, race->alen, XDR_ENCODE);
+		i = inproc(&xdrs, in);
+		xdr_destroy(&xdrs);
+		if (!i) {
+			free(race->args);
+			free(race);
+			goto direct;
+		}
+	}
+	pthread_mutex_init(&race->lock, NULL);
+	pthread_cond_init(&race->cond, NULL);
+	race->hg = hg;
+	race->clnt = clnt;
+	race->proc = procnum;
+	race->cls = cls;
+	race->bytes = hsi_nfs3_call_bytes(procnum, in);
+	race->xres = xres;
+	race->tout = tout;
+	race->winner = -1;
+	race->refs = 2;
+	race->nlegs = race->pending = 1;
+	for (i = 0; i < 2; i++) {
+		race->leg[i].race = race;
+		race->leg[i].slot = -1;
+		race->leg[i].st = RPC_FAILED;
+	}
+
+	pthread_mutex_lock(&hg->lock);
+	i = hsi_hedge_submit(hg, &race->leg[0]);
+	pthread_mutex_unlock(&hg->lock);
+	if (i) {
+		race->refs = 1;
+		hsi_hedge_race_put(race);
+		goto direct;
+	}
+
+	/* Wait for the first leg up to the p95 of its class. */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	wait = ts.tv_nsec / 1000 + delay;
+	ts.tv_sec += wait / 1000000;
+	ts.tv_nsec = wait % 1000000 * 1000;
+	pthread_mutex_lock(&race->lock);
+	while (race->pending && race->winner < 0)
+		if (pthread_cond_timedwait(&race->cond, &race->lock, &ts))
+			break;
+	if (race->pending && race->winner < 0) {
+		pthread_mutex_unlock(&race->lock);
+		hsi_hedge_second(hg, race);
+		pthread_mutex_lock(&race->lock);
+	}
+	while (race->pending && race->winner < 0)
+		pthread_cond_wait(&race->cond, &race->lock);
+	pthread_mutex_unlock(&race->lock);
+
+	if (race->winner >= 0) {
+		st = hsi_hedge_copy(race, outproc, out, &err);
+	} else {
+		/* Every leg failed, report the first one. */
+		st = race->leg[0].st;
+		err = race->leg[0].err;
+		*xid = race->leg[0].xid;
+	}
+	hsi_nfs3_conn_seterr(&err);
+	hsi_hedge_race_put(race);
+
+	return st;
+
+direct:
+	start = __now_us();
+	st = clnt_call(clnt, procnum, inproc, in, outproc, out, tout);
+	CLNT_CONTROL(clnt, CLGET_XID, (char *)xid);
+	if (st == RPC_SUCCESS && xres)
+		hsi_hedge_sample(hg, cls, __now_us() - start);
+
+	return st;
+}
@@ -0,0 +1,321 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Adaptive limit and scheduling of the calls outstanding on a connection.
+ *
+ * The limit follows the round trip times, in the manner of TCP Vegas:
+ * while a call comes back within HSI_LIMIT_TOLERANCE times the baseline
+ * of its class (the smallest RTT seen lately) the server is not queueing
+ * and the limit grows by one per limit calls answered. Above that the
+ * server is past its knee and the limit is cut by HSI_LIMIT_BACKOFF, at
+ * most once per round trip so one burst of slow replies counts once. A
+ * timeout halves it. The baselines are taken again from the last
+ * HSI_LIMIT_WINDOW samples now and then, so they can follow the server
+ * up after a change of path.
+ *
+ * Calls over the limit wait here, in one queue per class (see
+ * hsi_nfs3_rtt_class()), and are let go in weighted fair queueing order:
+ * a call costs its bytes divided by the weight of its class, so a stat
+ * waiting behind a stream of 1MiB WRITEs goes next. Besides, reads and
+ * writes never take the last quarter of the slots, kept for metadata,
+ * and never have more than HSI_SCHED_BULK_BYTES per transport on the
+ * wire.
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hsi_nfs3.h"
+
+#define HSI_LIMIT_INITIAL	4
+#define HSI_LIMIT_TOLERANCE	2
+#define HSI_LIMIT_BACKOFF	0.9
+#define HSI_LIMIT_WINDOW	1000
+
+/* Cost of a call which moves no file data */
+#define HSI_SCHED_META_BYTES	4096
+/* Reads and writes in flight, per transport */
+#define HSI_SCHED_BULK_BYTES	(1024 * 1024)
+
+static const double hsi_sched_weight[HSI_RTT_NCLASS] = {
+	[HSI_RTT_META] = 16,
+	[HSI_RTT_READ] = 2,
+	[HSI_RTT_WRITE] = 1,
+};
+
+struct hsi_sched_wait {
+	struct hsi_sched_wait *next;
+	pthread_cond_t cond;
+	unsigned int bytes;
+	double finish;		/* Virtual finish time */
+	int go;
+};
+
+struct hsi_nfs3_limit {
+	pthread_mutex_t lock;
+	double limit;
+	int max;
+	int inflight;
+	int bulk;		/* Reads and writes in flight */
+	unsigned long bulk_bytes;
+	unsigned long bulk_budget;
+	long min_rtt[HSI_RTT_NCLASS];	/* Baselines, in usec */
+	long win_min[HSI_RTT_NCLASS];	/* Smallest RTTs of the window */
+	unsigned int samples[HSI_RTT_NCLASS];
+	long last_cut;		/* When the limit was last cut, in usec */
+	double vtime;		/* Virtual time of the fair queueing */
+	double last_finish[HSI_RTT_NCLASS];
+	struct hsi_sched_wait *head[HSI_RTT_NCLASS];
+	struct hsi_sched_wait **tail[HSI_RTT_NCLASS];
+};
+
+static long __now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+unsigned int hsi_nfs3_call_bytes(unsigned long procnum, const char *in)
+{
+	switch (procnum) {
+	case NFSPROC3_READ:
+		return ((const read3args *)in)->count;
+	case NFSPROC3_WRITE:
+		return ((const write3args *)in)->count;
+	default:
+		return HSI_SCHED_META_BYTES;
+	}
+}
+
+struct hsi_nfs3_limit *hsi_nfs3_limit_alloc(int max)
+{
+	struct hsi_nfs3_limit *lim;
+	int i;
+
+	lim = calloc(1, sizeof(*lim));
+	if (lim == NULL)
+		return NULL;
+
+	pthread_mutex_init(&lim->lock, NULL);
+	lim->max = max > 0 ? max : 1;
+	lim->limit = min(HSI_LIMIT_INITIAL, lim->max);
+	lim->bulk_budget = (unsigned long)lim->max * HSI_SCHED_BULK_BYTES;
+	for (i = 0; i < HSI_RTT_NCLASS; i++)
+		lim->tail[i] = &lim->head[i];
+
+	return lim;
+}
+
+void hsi_nfs3_limit_free(struct hsi_nfs3_limit *lim)
+{
+	if (lim == NULL)
+		return;
+	pthread_mutex_destroy(&lim->lock);
+	free(lim);
+}
+
+/* Called with lim->lock held */
+static int __sched_can_run(struct hsi_nfs3_limit *lim, int cls,
+			   unsigned int bytes)
+{
+	int slots = (int)lim->limit, reserved;
+
+	if (lim->inflight >= slots)
+		return 0;
+	if (cls == HSI_RTT_META)
+		return 1;
+
+	reserved = slots >= 2 ? 1 + (slots - 1) / 4 : 0;
+	if (lim->bulk >= slots - reserved && lim->bulk)
+		return 0;
+	/* One call always fits, however large. */
+	return lim->bulk == 0 || lim->bulk_bytes + bytes <= lim->bulk_budget;
+}
+
+/* Called with lim->lock held */
+static void __sched_start(struct hsi_nfs3_limit *lim, int cls,
+			  unsigned int bytes)
+{
+	lim->inflight++;
+	if (cls != HSI_RTT_META) {
+		lim->bulk++;
+		lim->bulk_bytes += bytes;
+	}
+}
+
+/* Called with lim->lock held, returns the virtual finish time */
+static double __sched_stamp(struct hsi_nfs3_limit *lim, int cls,
+			    unsigned int bytes)
+{
+	double start = lim->last_finish[cls];
+
+	if (start < lim->vtime)
+		start = lim->vtime;
+	lim->last_finish[cls] = start + bytes / hsi_sched_weight[cls];
+
+	return lim->last_finish[cls];
+}
+
+/* Let waiting calls go while there is room, lowest finish time first. */
+static void __sched_dispatch(struct hsi_nfs3_limit *lim)
+{
+	struct hsi_sched_wait *w;
+	int cls, best;
+
+	for (;;) {
+		best = -1;
+		for (cls = 0; cls < HSI_RTT_NCLASS; cls++) {
+			w = lim->head[cls];
+			if (w == NULL || !__sched_can_run(lim, cls, w->bytes))
+				continue;
+			if (best < 0 || w->finish < lim->head[best]->finish)
+				best = cls;
+		}
+		if (best < 0)
+			return;
+
+		w = lim->head[best];
+		lim->head[best] = w->next;
+		if (lim->head[best] == NULL)
+			lim->tail[best] = &lim->head[best];
+		if (lim->vtime < w->finish)
+			lim->vtime = w->finish;
+		__sched_start(lim, best, w->bytes);
+		w->go = 1;
+		pthread_cond_signal(&w->cond);
+	}
+}
+
+static int __sched_queued(struct hsi_nfs3_limit *lim)
+{
+	int cls;
+
+	for (cls = 0; cls < HSI_RTT_NCLASS; cls++)
+		if (lim->head[cls])
+			return 1;
+	return 0;
+}
+
+void hsi_nfs3_limit_acquire(struct hsi_nfs3_limit *lim, int cls,
+			    unsigned int bytes)
+{
+	struct hsi_sched_wait w;
+
+	pthread_mutex_lock(&lim->lock);
+	w.finish = __sched_stamp(lim, cls, bytes);
+	if (!__sched_queued(lim) && __sched_can_run(lim, cls, bytes)) {
+		if (lim->vtime < w.finish)
+			lim->vtime = w.finish;
+		__sched_start(lim, cls, bytes);
+		pthread_mutex_unlock(&lim->lock);
+		return;
+	}
+
+	pthread_cond_init(&w.cond, NULL);
+	w.bytes = bytes;
+	w.go = 0;
+	w.next = NULL;
+	*lim->tail[cls] = &w;
+	lim->tail[cls] = &w.next;
+	/* Our class may be the one with room, though others wait. */
+	__sched_dispatch(lim);
+	while (!w.go)
+		pthread_cond_wait(&w.cond, &lim->lock);
+	pthread_mutex_unlock(&lim->lock);
+	pthread_cond_destroy(&w.cond);
+}
+
+int hsi_nfs3_limit_tryacquire(struct hsi_nfs3_limit *lim, int cls,
+			      unsigned int bytes)
+{
+	int ok = 0;
+
+	pthread_mutex_lock(&lim->lock);
+	/* Never ahead of a call which is waiting. */
+	if (!__sched_queued(lim) && __sched_can_run(lim, cls, bytes)) {
+		__sched_start(lim, cls, bytes);
+		ok = 1;
+	}
+	pthread_mutex_unlock(&lim->lock);
+
+	return ok;
+}
+
+static void __limit_cut(struct hsi_nfs3_limit *lim, double factor,
+			long now, long rtt)
+{
+	/* Replies already on their way say nothing about the new limit. */
+	if (now - lim->last_cut < rtt)
+		return;
+	lim->limit *= factor;
+	if (lim->limit < 1)
+		lim->limit = 1;
+	lim->last_cut = now;
+	DEBUG("Concurrency limit cut to %.2f.", lim->limit);
+}
+
+void hsi_nfs3_limit_release(struct hsi_nfs3_limit *lim, int cls,
+			    unsigned int bytes, long us, int timedout)
+{
+	long now = __now_us();
+	int used;
+
+	pthread_mutex_lock(&lim->lock);
+	used = (lim->inflight-- >= (int)lim->limit);
+	if (cls != HSI_RTT_META) {
+		lim->bulk--;
+		lim->bulk_bytes -= bytes;
+	}
+
+	if (timedout) {
+		__limit_cut(lim, 0.5, now, lim->min_rtt[cls]);
+		goto out;
+	}
+	/* The call never left, there is nothing to learn. */
+	if (us < 0)
+		goto out;
+
+	if (us == 0)
+		us = 1;
+	if (lim->min_rtt[cls] == 0 || us < lim->min_rtt[cls])
+		lim->min_rtt[cls] = us;
+	if (lim->win_min[cls] == 0 || us < lim->win_min[cls])
+		lim->win_min[cls] = us;
+	if (++lim->samples[cls] >= HSI_LIMIT_WINDOW) {
+		lim->min_rtt[cls] = lim->win_min[cls];
+		lim->win_min[cls] = 0;
+		lim->samples[cls] = 0;
+	}
+
+	if (us <= HSI_LIMIT_TOLERANCE * lim->min_rtt[cls]) {
+		/* Only grow a limit that was reached, else nothing is known. */
+		if (used && lim->limit < lim->max) {
+			lim->limit += 1 / lim->limit;
+			if (lim->limit > lim->max)
+				lim->limit = lim->max;
+		}
+	} else {
+		__limit_cut(lim, HSI_LIMIT_BACKOFF, now, lim->min_rtt[cls]);
+	}
+out:
+	__sched_dispatch(lim);
+	pthread_mutex_unlock(&lim->lock);
+}
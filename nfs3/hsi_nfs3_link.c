@@ -166,6 +166,7 @@ hsi_nfs3_link(struct hsfs_inode *inode, struct hsfs_inode *newparent,
 		goto out1;
 	}
 
+	hsi_nfs3_wcc_update(newparent, &res.link3res_u.res.linkdir_wcc);
 	nfs_init_fattr(&fattr);
 	hsi_nfs3_post2fattr(&res.link3res_u.res.file_attributes, &fattr);
 
@@ -97,11 +97,17 @@ int hsi_nfs3_lookup(struct hsfs_inode *parent,struct hsfs_inode **new,
 
 	struct nfs_fattr fattr;
 	struct nfs_fh name_fh;
+	char fhbuf[NFS3_FHSIZE];
 	
 	int st = 0, err = 0;
 
 	memset(&args, 0, sizeof(args));
 	memset(&res, 0, sizeof(res));
+	/*
+	 * Decode the handle in place: with a buffer set, xdr_bytes() doesn't
+	 * allocate, and the reply holds nothing else to free.
+	 */
+	res.lookup3res_u.resok.object.data.data_val = fhbuf;
 
 	DEBUG_IN("P_I(%p:%llu)", parent, parent->ino);
 
@@ -110,7 +116,7 @@ int hsi_nfs3_lookup(struct hsfs_inode *parent,struct hsfs_inode **new,
 	args.name = (char *)name;
 	err=hsi_nfs3_clnt_call(sb, sb->clntp, NFSPROC3_LOOKUP,
 			(xdrproc_t)xdr_diropargs3,(caddr_t)&args,
-			(xdrproc_t)xdr_lookup3res, (caddr_t)&res);
+			(xdrproc_t)hsi_xdr_lookup3res, (caddr_t)&res);
 
 	if (err) 
 		goto out;
@@ -120,8 +126,6 @@ int hsi_nfs3_lookup(struct hsfs_inode *parent,struct hsfs_inode **new,
 		ERR("Path (%s) on Server is not "
 			"accessible: (%d).",name,st);
 		err = hsi_nfs3_stat_to_errno(st);
-		clnt_freeres(sb->clntp, (xdrproc_t)xdr_lookup3res, 
-			(char *)&res);
 		goto out;
 	}
 
@@ -132,7 +136,6 @@ int hsi_nfs3_lookup(struct hsfs_inode *parent,struct hsfs_inode **new,
 	
 	*new = hsi_nfs_fhget(parent->sb, &name_fh, &fattr);
 
-	clnt_freeres(sb->clntp, (xdrproc_t)xdr_lookup3res, (char *)&res);
 out:
 	DEBUG_OUT("with %d, New inode at %p", err, *new);
 
@@ -40,10 +40,14 @@ int hsi_nfs3_mkdir (struct hsfs_inode *parent, struct hsfs_inode **new,
 	int err = 0;
 	mkdir3args argp;
 	diropres3 clnt_res;
+	char fhbuf[NFS3_FHSIZE];
 	
 	DEBUG_IN(" ino: %lu.\n", parent->ino);
 	memset(&argp, 0, sizeof(mkdir3args));
 	memset(&clnt_res, 0, sizeof(diropres3));
+	/* The handle is decoded in place, the reply holds nothing to free. */
+	clnt_res.diropres3_u.resok.obj.post_op_fh3_u.handle.data.data_val =
+		fhbuf;
 
 	hsi_nfs3_getfh3(parent, &argp.where.dir);
 
@@ -61,17 +65,16 @@ int hsi_nfs3_mkdir (struct hsfs_inode *parent, struct hsfs_inode **new,
 	if (0 != clnt_res.status) {	/*RPC is OK, nfs error*/
 		*new = NULL;
 		err = hsi_nfs3_stat_to_errno(clnt_res.status);
-		goto outfree;
+		goto out;
 	}
 
+	hsi_nfs3_wcc_update(parent, &clnt_res.diropres3_u.resok.dir_wcc);
 	*new = hsi_nfs3_handle_create(sb, &clnt_res.diropres3_u.resok);
 	if(IS_ERR(*new)){
 		*new = NULL;
 		err = PTR_ERR(*new);
 	}
 
-outfree:
-	clnt_freeres(sb->clntp, (xdrproc_t)xdr_diropres3, (char *)&clnt_res);
 out:
 	DEBUG_OUT(" out, errno:%d\n", err);
 	return err;
@@ -139,6 +139,7 @@ hsi_nfs3_mknod(struct hsfs_inode *parent, struct hsfs_inode **new,
 	CLIENT *nfs_client=NULL;
 	struct mknod3args args;
 	struct diropres3 res;
+	char fhbuf[NFS3_FHSIZE];
 
 	DEBUG_IN("the parent ino (%lu),the nlookup is (%lu)",
 		 parent->ino, (unsigned long)parent->private);
@@ -196,6 +197,8 @@ pipe_sattrs:
 	// get the client 
 	nfs_client=parent->sb->clntp; 
 	memset(&res,0,sizeof(res));
+	/* The handle is decoded in place, the reply holds nothing to free. */
+	res.diropres3_u.resok.obj.post_op_fh3_u.handle.data.data_val = fhbuf;
 	err=hsi_nfs3_clnt_call(parent->sb,nfs_client,NFSPROC3_MKNOD,
 				(xdrproc_t)xdr_mknod3args,(caddr_t)&args,
 				(xdrproc_t)xdr_diropres3,(caddr_t)&res);
@@ -205,16 +208,15 @@ pipe_sattrs:
 	if(res.status){
 		ERR("Call NFS3 Server Failure:(%d).\n",res.status);
 		err=hsi_nfs3_stat_to_errno(res.status);
-		goto out1;
+		goto out2;
 	}
 
+	hsi_nfs3_wcc_update(parent, &res.diropres3_u.resok.dir_wcc);
 	*new = hsi_nfs3_handle_create(sb, &res.diropres3_u.resok);
 	if(IS_ERR(*new)){
 		*new = NULL;
 		err = PTR_ERR(*new);
 	}
-out1:
-	clnt_freeres(nfs_client,(xdrproc_t)xdr_diropres3,(char *)&res);
 out2:
 	if(args.where.name)
 		free(args.where.name);
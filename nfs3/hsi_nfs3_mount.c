@@ -22,6 +22,7 @@
 #include "conn.h"
 #include "nfs3.h"
 #include "hsi_nfs3.h"
+#include "hsfs_buf.h"
 #include "mount.h"
 #include "xcommon.h"
 #include "fstab.h"
@@ -34,11 +35,7 @@ typedef dirpath umntarg_t;
 typedef struct mountres3 mntres_t;
 
 #define NFS_MOUNT_TCP		0x0001
-
-static clnt_addr_t nfs_server_bak;
-static clnt_addr_t acl_server_bak;
-static int ssize_bak = 0;
-static int rsize_bak = 0;
+#define NFS_MOUNT_MULTIPATH	0x0002
 
 static int hsi_gethostbyname(const char *hostname, struct sockaddr_in *saddr)
 {
@@ -60,6 +57,48 @@ static int hsi_gethostbyname(const char *hostname, struct sockaddr_in *saddr)
 	return 0;
 }
 
+/* addrs=A+B+...: the server addresses to spread connections over */
+static int hsi_parse_paths(struct hsfs_super *super, const char *list)
+{
+	char buf[128], *addr, *save = NULL;
+
+	if (strlen(list) >= sizeof(buf))
+		return EINVAL;
+	strcpy(buf, list);
+
+	super->npaths = 0;
+	for (addr = strtok_r(buf, "+", &save); addr;
+	     addr = strtok_r(NULL, "+", &save)) {
+		if (super->npaths == HSFS_MAX_PATHS) {
+			WARNING("Only the first %d addresses are used.",
+				HSFS_MAX_PATHS);
+			break;
+		}
+		if (hsi_gethostbyname(addr, &super->paths[super->npaths]))
+			return EINVAL;
+		super->npaths++;
+	}
+
+	return super->npaths ? 0 : EINVAL;
+}
+
+/* multipath: every address the server name resolves to */
+static void hsi_resolve_paths(struct hsfs_super *super, const char *hostname)
+{
+	struct hostent *hp;
+	int i;
+
+	hp = gethostbyname(hostname);
+	if (hp == NULL || hp->h_addrtype != AF_INET)
+		return;
+	for (i = 0; hp->h_addr_list[i] && i < HSFS_MAX_PATHS; i++) {
+		super->paths[i].sin_family = AF_INET;
+		memcpy(&super->paths[i].sin_addr, hp->h_addr_list[i],
+		       sizeof(struct in_addr));
+	}
+	super->npaths = i;
+}
+
 static int hsi_nfsmnt_check_compat(const struct pmap *nfs_pmap,
 				const struct pmap *mnt_pmap)
 {
@@ -215,14 +254,31 @@ out:
 	return ret;
 }
 
-static CLIENT *hsi_nfs3_clnt_create(clnt_addr_t *nfs_server,
-						int ssize, int rsize)
+CLIENT *hsi_nfs3_clnt_create(clnt_addr_t *nfs_server, int ssize, int rsize)
 {
 	CLIENT *clnt = NULL;
 	static char clnt_res;
 	int ret = 0;
 
-	clnt = hsi_mnt_openclnt(nfs_server, ssize, rsize);
+	/* NFS over TCP carries many calls at once, see hsi_nfs3_mux.c. */
+	if (nfs_server->pmap.pm_prot == IPPROTO_TCP) {
+		nfs_server->saddr.sin_port =
+			htons((u_short)nfs_server->pmap.pm_port);
+		clnt = hsi_nfs3_mux_create(&nfs_server->saddr,
+					   nfs_server->pmap.pm_prog,
+					   nfs_server->pmap.pm_vers);
+		if (clnt) {
+			clnt->cl_auth = authunix_create_default();
+			if (!clnt->cl_auth) {
+				ERR("Create authunix failed: %d.",
+				    rpc_createerr.cf_error.re_errno);
+				CLNT_DESTROY(clnt);
+				clnt = NULL;
+			}
+		}
+	} else {
+		clnt = hsi_mnt_openclnt(nfs_server, ssize, rsize);
+	}
 	if (!clnt)
 		goto out;
 
@@ -237,15 +293,6 @@ static CLIENT *hsi_nfs3_clnt_create(clnt_addr_t *nfs_server,
 		clnt = NULL;
 		goto out;
 	};
-
-	ssize_bak = ssize;
-	rsize_bak = rsize;
-	if (nfs_server->pmap.pm_prog == NFS_PROGRAM)
-		nfs_server_bak = *nfs_server;
-	else if (nfs_server->pmap.pm_prog == NFS_ACL_PROGRAM)
-		acl_server_bak = *nfs_server;
-	else
-		ERR("Bad nfs server.");
 out:
 	return clnt;
 }
@@ -283,7 +330,13 @@ static int hsi_nfs3_parse_options(char *old_opts, struct hsfs_super *super,
 
 		if (strlen(opt) >= sizeof(cbuf))
 			goto bad_parameter;
-		if ((opteq = strchr(opt, '=')) && isdigit((int)opteq[1])) {
+		opteq = strchr(opt, '=');
+		/* Names or numeric addresses: before telling them apart. */
+		if (opteq && opteq - opt == 5 && !strncmp(opt, "addrs", 5)) {
+			if (hsi_parse_paths(super, opteq + 1))
+				goto bad_parameter;
+			sprintf(cbuf, "%s,", opt);
+		} else if (opteq && isdigit((int)opteq[1])) {
 			int val = atoi(opteq + 1);	
 			*opteq = '\0';
 			if (!strcmp(opt, "rsize"))
@@ -294,6 +347,22 @@ static int hsi_nfs3_parse_options(char *old_opts, struct hsfs_super *super,
 				super->timeo = val;
 			else if (!strcmp(opt, "retrans"))
 				super->retrans = val;
+			else if (!strcmp(opt, "nconnect"))
+				super->nconnect = val;
+			else if (!strcmp(opt, "hedge"))
+				super->hedge = val;
+			else if (!strcmp(opt, "tenant_ops"))
+				super->tenant_ops = val;
+			else if (!strcmp(opt, "tenant_bw"))
+				super->tenant_bw = val;
+			else if (!strcmp(opt, "readahead"))
+				super->readahead = val;
+			else if (!strcmp(opt, "smallfile"))
+				super->smallfile = val;
+			else if (!strcmp(opt, "io_uring_depth"))
+				super->io_uring_depth = val;
+			else if (!strcmp(opt, "kcache"))
+				super->kcache = val;
 			else if (!strcmp(opt, "acregmin"))
 				super->acregmin = val;
 			else if (!strcmp(opt, "acregmax"))
@@ -354,7 +423,14 @@ static int hsi_nfs3_parse_options(char *old_opts, struct hsfs_super *super,
 			} else if (!strcmp(opt, "mounthost"))
 				mounthost=xstrndup(opteq+1,
 						   strcspn(opteq+1," \t\n\r,"));
-			 else if (!strcmp(opt, "context")) {
+			 else if (!strcmp(opt, "tenant")) {
+				if (!strcmp(opteq+1, "uid"))
+					super->tenant_key = HSX_TENANT_UID;
+				else if (!strcmp(opteq+1, "pid"))
+					super->tenant_key = HSX_TENANT_PID;
+				else
+					goto bad_parameter;
+			 } else if (!strcmp(opt, "context")) {
 				WARNING("Warning: ignoring context option");
 			 } else
 				goto bad_parameter;
@@ -410,6 +486,29 @@ static int hsi_nfs3_parse_options(char *old_opts, struct hsfs_super *super,
 				continue;
 			} else if (!strcmp(opt, "sharecache")) {
 				continue;
+			} else if (!strcmp(opt, "multipath")) {
+				if (val)
+					super->flags |= NFS_MOUNT_MULTIPATH;
+				else
+					super->flags &= ~NFS_MOUNT_MULTIPATH;
+			} else if (!strcmp(opt, "hugebuf")) {
+				if (val)
+					super->bufflags |= HSFS_BUF_HUGEPAGE;
+				else
+					super->bufflags &= ~HSFS_BUF_HUGEPAGE;
+			} else if (!strcmp(opt, "lockbuf")) {
+				if (val)
+					super->bufflags |= HSFS_BUF_MLOCK;
+				else
+					super->bufflags &= ~HSFS_BUF_MLOCK;
+			} else if (!strcmp(opt, "io_uring")) {
+				super->io_uring = val;
+			} else if (!strcmp(opt, "percpu")) {
+				super->percpu = val;
+			} else if (!strcmp(opt, "reactor")) {
+				super->reactor = val;
+			} else if (!strcmp(opt, "splice")) {
+				super->splice = val;
 			} else {
 				WARNING("%s: Unsupported nfs mount option:"
 						" %s%s", progname,
@@ -485,6 +584,21 @@ void hsi_validate_mount_data(struct hsfs_super *super, clnt_addr_t *ms,
 	if (!super->retrans)
 		super->retrans = 3;
 
+	/* At least one connection per path. */
+	if (super->nconnect < super->npaths)
+		super->nconnect = super->npaths;
+	if (super->nconnect < 1)
+		super->nconnect = 1;
+	if (super->nconnect > HSI_NFS3_MAX_NCONNECT)
+		super->nconnect = HSI_NFS3_MAX_NCONNECT;
+	/* A hedge sharing the transport of its original is no use. */
+	if (super->hedge > HSI_NFS3_MAX_HEDGE)
+		super->hedge = HSI_NFS3_MAX_HEDGE;
+	if (super->hedge && super->nconnect < 2) {
+		INFO("hedge needs nconnect=2 or more, ignored.");
+		super->hedge = 0;
+	}
+
 	if (!super->acregmin)
 		super->acregmin = 3;
 	if (!super->acregmax)
@@ -528,6 +642,15 @@ void hsi_validate_mount_data(struct hsfs_super *super, clnt_addr_t *ms,
 		super->rsize = super->wsize = RPC_MAXDATASIZE;
 	}
 
+	/* Readahead is pushed in rsize chunks, don't let it run away. */
+	if (super->readahead > HSFS_MAX_READAHEAD)
+		super->readahead = HSFS_MAX_READAHEAD;
+	if (super->readahead && super->readahead < super->rsize)
+		super->readahead = super->rsize;
+	/* Small files are fetched with a single READ. */
+	if (super->smallfile > super->rsize)
+		super->smallfile = super->rsize;
+
 	/* init retry */
 	if (*retry == -1) {
 		*retry = 10000;  /* 10000 mins == ~1 week*/
@@ -559,14 +682,14 @@ static int hsi_fill_super(struct hsfs_super *super, nfs_fh3 *fh)
 
 	ret = hsi_nfs3_fsinfo(super, fh, &fattr);
 	if (ret)
-		goto out;
+		goto out_icache;
 
 	nfs_copy_fh3(&nfh, fh->data.data_len, fh->data.data_val);
 	root = hsi_nfs_fhget(super, &nfh, &fattr);
 
 	if (IS_ERR(root)) {
 		ret = PTR_ERR(root);
-		goto out;
+		goto out_icache;
 	}
 
 	super->root = root;
@@ -574,10 +697,13 @@ static int hsi_fill_super(struct hsfs_super *super, nfs_fh3 *fh)
 	
 	ret = hsi_nfs3_pathconf(super->root);
 	if (ret)
-		goto out;
+		goto out_icache;
 out:
 	DEBUG_OUT("(%d)", ret);
 	return ret;
+out_icache:
+	hsfs_destroy_icache(super);
+	goto out;
 }
 
 int nfs3_do_mount(struct hsfs_cmdline_opts *hsfs_opts,
@@ -639,14 +765,27 @@ int nfs3_do_mount(struct hsfs_cmdline_opts *hsfs_opts,
 	if (hsi_nfsmnt_check_compat(nfs_pmap, mnt_pmap))
 		goto fail;
 
+	if (super->npaths == 0 && (super->flags & NFS_MOUNT_MULTIPATH))
+		hsi_resolve_paths(super, hostname);
+	if (super->npaths == 0) {
+		super->paths[0] = super->addr;
+		super->npaths = 1;
+	}
+
 	/* Set default options, call after hsi_nfs3_parse_options. */
 	hsi_validate_mount_data(super, &mnt_server, &nfs_server, &retry);
 
 	if (verbose) {
 		INFO("rsize = %d, wsize = %d, timeo = %d, retrans = %d",
 		       super->rsize, super->wsize, super->timeo, super->retrans);
+		INFO("readahead = %u, smallfile = %u, nconnect = %d, hedge = %u",
+		     super->readahead, super->smallfile, super->nconnect,
+		     super->hedge);
+		INFO("%d server address(es), first %s", super->npaths,
+		     inet_ntoa(super->paths[0].sin_addr));
 		INFO("acreg (min, max) = (%d, %d), acdir (min, max) = (%d, %d)",
 		       super->acregmin, super->acregmax, super->acdirmin, super->acdirmax);
+		INFO("kcache = %u", super->kcache);
 		INFO("mountprog = %lu, mountvers = %lu, nfsprog = %lu, nfsvers = %lu",
 		       mnt_pmap->pm_prog, mnt_pmap->pm_vers,
 		       nfs_pmap->pm_prog, nfs_pmap->pm_vers);
@@ -705,19 +844,35 @@ int nfs3_do_mount(struct hsfs_cmdline_opts *hsfs_opts,
 			goto fail;
 	}
 
+	super->rtt = hsi_nfs3_rtt_alloc(super->timeo);
+	super->acl_rtt = hsi_nfs3_rtt_alloc(super->timeo);
+	super->limit = hsi_nfs3_limit_alloc(super->nconnect *
+			(nfs_server.pmap.pm_prot == IPPROTO_TCP ?
+			 HSI_NFS3_MUX_SLOTS : 1));
+	if (super->rtt == NULL || super->acl_rtt == NULL || super->limit == NULL)
+		goto umnt_fail;
+
 	/* nfs3 client */
-	super->clntp = hsi_nfs3_clnt_create(&nfs_server, super->wsize,
-						super->rsize);
+	super->clntp = hsi_nfs3_conn_create(&nfs_server, super->wsize,
+						super->rsize, super->nconnect,
+						super->paths, super->npaths);
 	if (super->clntp == NULL) {
 		goto umnt_fail;
 	}
+	if (super->hedge) {
+		super->hedging = hsi_nfs3_hedge_alloc(super->hedge,
+						      2 * super->nconnect,
+						      super->limit);
+		if (super->hedging == NULL)
+			WARNING("Failed to start hedging, continue without.");
+	}
 
 	/* acl client */
 	memcpy(&acl_server, &nfs_server, sizeof(acl_server));
 	acl_server.pmap.pm_prog = NFS_ACL_PROGRAM;
 	acl_server.pmap.pm_vers = NFS_ACL_V3;
-	super->acl_clntp = hsi_nfs3_clnt_create(&acl_server, super->wsize,
-						super->rsize);
+	super->acl_clntp = hsi_nfs3_conn_create(&acl_server, super->wsize,
+						super->rsize, 1, NULL, 0);
 	if (super->acl_clntp == NULL)
 		INFO("Not supported ACL.");
 
@@ -754,7 +909,15 @@ umnt_fail:
 	if (super->acl_clntp)
 		clnt_destroy(super->acl_clntp);
 
-	clnt_destroy(super->clntp);
+	hsi_nfs3_hedge_free(super->hedging);
+	super->hedging = NULL;
+	if (super->clntp)
+		clnt_destroy(super->clntp);
+	hsi_nfs3_rtt_free(super->rtt);
+	hsi_nfs3_rtt_free(super->acl_rtt);
+	super->rtt = super->acl_rtt = NULL;
+	hsi_nfs3_limit_free(super->limit);
+	super->limit = NULL;
 	hsi_nfs3_unmount(&mnt_server, &dirname);
 fail:
 	DEBUG_OUT("Failed with %d", ret);
@@ -776,7 +939,13 @@ int nfs3_do_unmount(struct hsfs_cmdline_opts *hsfs_opts,
 	if (!nfs_parse_devname(hostdir, &hostname, &dirname))
 		return -1;
 
+	hsi_nfs3_hedge_free(super->hedging);
 	CLNT_DESTROY(super->clntp);
+	if (super->acl_clntp)
+		CLNT_DESTROY(super->acl_clntp);
+	hsi_nfs3_rtt_free(super->rtt);
+	hsi_nfs3_rtt_free(super->acl_rtt);
+	hsi_nfs3_limit_free(super->limit);
 
 	memcpy(&mnt_server.saddr, &super->addr, sizeof(struct sockaddr_in));
 	ump->pm_prog = MOUNTPROG;
@@ -787,32 +956,23 @@ int nfs3_do_unmount(struct hsfs_cmdline_opts *hsfs_opts,
 		ump->pm_prot = IPPROTO_UDP;
 	}
 
+	hsfs_destroy_icache(super);
 	hsfs_iput(super->root);
 
 	return hsi_nfs3_unmount(&mnt_server, &dirname);
 }
 
 
-static CLIENT *hsi_nfs3_clnt_reconnect(struct hsfs_super *sb, CLIENT *clnt)
-{
-	CLIENT **sclnt = NULL;
-	clnt_addr_t *addr_bak = NULL;
-
-	if (clnt == sb->clntp) {
-		sclnt = &sb->clntp;
-		addr_bak = &nfs_server_bak;
-	} else if (sb->acl_clntp && clnt == sb->acl_clntp) {
-		sclnt = &sb->acl_clntp;
-		addr_bak = &acl_server_bak;
-	} else
-		ERR("Bad client point.");
+/* Retries of transient (EAGAIN) failures */
+#define HSI_NFS3_MAX_RETRY	5
 
-	hsi_mnt_closeclnt(clnt);
-	clnt = hsi_nfs3_clnt_create(addr_bak, ssize_bak, ssize_bak);
-	if (clnt)
-		*sclnt = clnt;
+static inline long __elapsed_us(const struct timespec *start)
+{
+	struct timespec now;
 
-	return clnt;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+		(now.tv_nsec - start->tv_nsec) / 1000;
 }
 
 int hsi_nfs3_clnt_call(struct hsfs_super *sb, CLIENT *clnt,
@@ -822,29 +982,169 @@ int hsi_nfs3_clnt_call(struct hsfs_super *sb, CLIENT *clnt,
 {
 	struct timeval tout = {sb->timeo / 10, sb->timeo % 10 * 100000};
 	enum clnt_stat st = RPC_SUCCESS;
+	struct hsi_sflight *fl = NULL;
+	struct hsi_nfs3_limit *lim;
+	struct hsi_nfs3_rtt *rtt;
+	struct timespec start, first;
+	unsigned int bytes;
+	long us, left, budget;
+	unsigned int ntimeo = 0;
+	u_int32_t xid = 0;
+	int keep_xid = 0;
+	int cls = hsi_nfs3_rtt_class(procnum);
 	int rtry = 0, ret = 0;
+
+	/* An identical call is outstanding, take its reply. */
+	if (hsi_nfs3_sflight_begin(clnt, procnum, inproc, in, outproc, out,
+				   &fl, &ret))
+		return ret;
+
+	rtt = (sb->acl_clntp && clnt == sb->acl_clntp) ? sb->acl_rtt : sb->rtt;
+	lim = (clnt == sb->clntp) ? sb->limit : NULL;
+	bytes = hsi_nfs3_call_bytes(procnum, in);
+	/*
+	 * Short retransmit intervals over UDP, but as long to give up as
+	 * ever. A stream loses nothing: over TCP a retransmission is only a
+	 * duplicate, so each one waits the whole timeo.
+	 */
+	budget = (long)sb->timeo * 100000L * (sb->retrans ? sb->retrans : 1);
 retry:
 	ret = 0;
-	st = clnt_call(clnt, procnum, inproc, in, outproc, out, tout);
-	if (st != RPC_SUCCESS) {
+	if (rtt && !(sb->flags & NFS_MOUNT_TCP))
+		hsi_nfs3_rtt_timeout(rtt, cls, ntimeo, &tout);
+	if (ntimeo) {
+		left = budget - __elapsed_us(&first);
+		if (tout.tv_sec * 1000000L + tout.tv_usec > left) {
+			tout.tv_sec = left / 1000000;
+			tout.tv_usec = left % 1000000;
+		}
+	}
+	/* Wait for the limit first, the RTT must not count our own queue. */
+	if (lim)
+		hsi_nfs3_limit_acquire(lim, cls, bytes);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!ntimeo)
+		first = start;
+	/* Only a first transmission is hedged, retries are slow anyway. */
+	if (sb->hedging && clnt == sb->clntp && !ntimeo && !rtry) {
+		st = hsi_nfs3_hedge_call(sb->hedging, clnt, procnum, inproc, in,
+					 outproc, out, tout, &xid);
+		keep_xid = st == RPC_TIMEDOUT;
+	} else {
+		/*
+		 * A retransmission keeps the xid of the first one, so that
+		 * the duplicate request cache of the server catches a
+		 * REMOVE or CREATE it already did.
+		 */
+		if (keep_xid)
+			CLNT_CONTROL(clnt, CLSET_XID, (char *)&xid);
+		st = clnt_call(clnt, procnum, inproc, in, outproc, out, tout);
+		CLNT_CONTROL(clnt, CLGET_XID, (char *)&xid);
+		keep_xid = keep_xid || st == RPC_TIMEDOUT;
+	}
+	us = __elapsed_us(&start);
+	if (lim)
+		hsi_nfs3_limit_release(lim, cls, bytes, us,
+				       st == RPC_TIMEDOUT);
+	if (st == RPC_SUCCESS) {
+		/* Karn: a retransmitted call gives no usable sample. */
+		if (rtt && !ntimeo)
+			hsi_nfs3_rtt_update(rtt, cls, us);
+	} else if (st == RPC_TIMEDOUT) {
+		ret = ETIMEDOUT;
+		if (rtt)
+			hsi_nfs3_rtt_timedout(rtt, cls);
+		if (__elapsed_us(&first) < budget) {
+			DEBUG("Proc %lu xid 0x%x timed out after %ld.%06lds, "
+			      "retransmit.", procnum, xid, (long)tout.tv_sec,
+			      (long)tout.tv_usec);
+			ntimeo++;
+			goto retry;
+		}
+		ERR("Server not responding, proc %lu timed out.", procnum);
+	} else {
 		ret = hsi_rpc_stat_to_errno(clnt);
 
-		if (rtry >= 5) {
+		if (rtry >= HSI_NFS3_MAX_RETRY) {
 			ERR("Have retry %d times, break!", rtry);
 		}else if (ret == EAGAIN) {
-			sleep(1);
-			rtry++;
+			hsi_nfs3_backoff(rtry++);
 			goto retry;
-		} else if (ret == ENOTCONN || ret == ECONNRESET) {
-			clnt = hsi_nfs3_clnt_reconnect(sb, clnt);
-			if (clnt != NULL) {
-				rtry++;
-				goto retry;
-			}
 		}
+		/* Broken connections are replayed by the CLIENT itself. */
 
 		ERR("Sending rpc request failed: %d(%d).", st, ret);
 	}
+	/* Even failed, the server may have done it. */
+	hsi_nfs3_sflight_changed(procnum);
+	hsi_nfs3_sflight_end(fl, ret, outproc, out);
 
 	return ret;
 }
+
+/* A call of hsi_nfs3_clnt_submit(), until its completion */
+struct hsi_nfs3_async {
+	struct hsi_nfs3_limit *lim;
+	struct hsi_nfs3_rtt *rtt;
+	int cls;
+	unsigned int bytes;
+	struct timespec start;
+	hsi_nfs3_done_t done;
+	void *priv;
+};
+
+static void hsi_nfs3_clnt_done(void *arg, enum clnt_stat st)
+{
+	struct hsi_nfs3_async *a = arg;
+	long us = __elapsed_us(&a->start);
+
+	if (a->lim)
+		hsi_nfs3_limit_release(a->lim, a->cls, a->bytes, us,
+				       st == RPC_TIMEDOUT);
+	if (a->rtt && st == RPC_SUCCESS)
+		hsi_nfs3_rtt_update(a->rtt, a->cls, us);
+	else if (a->rtt && st == RPC_TIMEDOUT)
+		hsi_nfs3_rtt_timedout(a->rtt, a->cls);
+	a->done(a->priv, st);
+	free(a);
+}
+
+int hsi_nfs3_clnt_submit(struct hsfs_super *sb, CLIENT *clnt,
+			 unsigned long procnum,
+			 xdrproc_t inproc, char *in,
+			 xdrproc_t outproc, char *out,
+			 hsi_nfs3_done_t done, void *priv)
+{
+	struct timeval tout = {sb->timeo / 10, sb->timeo % 10 * 100000};
+	struct hsi_nfs3_async *a;
+	int err;
+
+	a = malloc(sizeof(*a));
+	if (a == NULL)
+		return ENOMEM;
+	a->rtt = (sb->acl_clntp && clnt == sb->acl_clntp) ?
+		sb->acl_rtt : sb->rtt;
+	a->lim = (clnt == sb->clntp) ? sb->limit : NULL;
+	a->cls = hsi_nfs3_rtt_class(procnum);
+	a->bytes = hsi_nfs3_call_bytes(procnum, in);
+	a->done = done;
+	a->priv = priv;
+	if (a->rtt && !(sb->flags & NFS_MOUNT_TCP))
+		hsi_nfs3_rtt_timeout(a->rtt, a->cls, 0, &tout);
+
+	/* Never wait for the limit, the caller has better things to do. */
+	if (a->lim && !hsi_nfs3_limit_tryacquire(a->lim, a->cls, a->bytes)) {
+		free(a);
+		return EAGAIN;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &a->start);
+	err = hsi_nfs3_conn_submit(clnt, procnum, inproc, in, outproc, out,
+				   tout, hsi_nfs3_clnt_done, a);
+	if (err) {
+		if (a->lim)
+			hsi_nfs3_limit_release(a->lim, a->cls, a->bytes, -1, 0);
+		free(a);
+	}
+
+	return err;
+}
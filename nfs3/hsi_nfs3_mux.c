@@ -0,0 +1,763 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Multiplexed RPC over TCP.
+ *
+ * TI-RPC's clnt_vc sends one call at a time on a socket and reads its
+ * reply with a read() per record fragment, so every small call costs two
+ * syscalls and usually a segment of its own. This CLIENT lets any number
+ * of calls be outstanding on one socket instead:
+ *
+ * - A caller encodes its record and queues it. If nobody is sending, it
+ *   becomes the sender and writes everything queued with one writev(),
+ *   over and over until the queue is empty. Under load it first waits
+ *   HSI_MUX_CORK_US for the records of other callers to pile up.
+ * - A receiver thread reads the socket in HSI_MUX_RBUF chunks, splits the
+ *   records out of them and hands each one to the caller waiting for its
+ *   xid. Large records are read straight into their own buffer.
+ * - The caller decodes its reply in its own thread.
+ *
+ * Calls may also be submitted without waiting (hsi_nfs3_mux_submit()):
+ * the receiver decodes their reply and runs their completion. The socket
+ * has a receive timeout of HSI_MUX_TICK_MS so that the receiver can time
+ * them out while the server is silent.
+ *
+ * CLSET_XID and CLGET_XID act on the calling thread's next and last call,
+ * so retransmissions can keep their xid while other threads use the same
+ * socket. A reply to nobody (the caller timed out) is dropped.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+
+#include "hsi_nfs3.h"
+#include "hsfs_buf.h"
+
+#define HSI_MUX_BUCKETS		64
+#define HSI_MUX_RBUF		(256 * 1024)
+#define HSI_MUX_CORK_US		50
+/* Call header, up to the credentials */
+#define HSI_MUX_HDR		(10 * BYTES_PER_XDR_UNIT)
+#define HSI_MUX_LAST_FRAG	0x80000000U
+/* Records larger than this are refused, a broken stream more likely */
+#define HSI_MUX_MAX_RECORD	(64U * 1024 * 1024)
+/* How often submitted calls are checked for their timeout, at worst */
+#define HSI_MUX_TICK_MS		1000
+
+/* A record on its way out, owned by the send queue */
+struct hsi_mux_rec {
+	struct hsi_mux_rec *next;
+	char *buf;
+	size_t len;
+	size_t cap;
+};
+
+/* A caller waiting for its reply on its stack, or a submitted call */
+struct hsi_mux_call {
+	struct hsi_mux_call *next;
+	u_int32_t xid;
+	int done;
+	char *reply;
+	size_t replen;
+	size_t repcap;		/* Given to hsfs_buf_get() */
+	pthread_cond_t cond;
+	/* Submitted calls only */
+	hsi_nfs3_done_t fn;
+	void *priv;
+	xdrproc_t xres;
+	void *res;
+	long deadline;		/* CLOCK_MONOTONIC, in msec */
+};
+
+struct hsi_mux {
+	CLIENT clnt;		/* Must be first */
+	int fd;
+	u_long prog, vers;
+	pthread_mutex_t lock;
+	int dead;		/* The socket failed, with errno */
+	int err;
+	u_int32_t xid;
+	int inflight;
+	int sending;
+	struct hsi_mux_rec *sq_head, **sq_tail;
+	struct hsi_mux_call *table[HSI_MUX_BUCKETS];
+	struct hsi_mux_call *orphans;	/* Submitted, the socket died */
+	pthread_t reader;
+};
+
+static __thread struct rpc_err hsi_mux_err;
+static __thread u_int32_t hsi_mux_last_xid;
+static __thread u_int32_t hsi_mux_next_xid;
+static __thread int hsi_mux_xid_set;
+
+static struct clnt_ops hsi_mux_ops;
+
+/* Called with mux->lock held */
+static struct hsi_mux_call *hsi_mux_unhash(struct hsi_mux *mux,
+					   u_int32_t xid)
+{
+	struct hsi_mux_call **pp, *c;
+
+	for (pp = &mux->table[xid % HSI_MUX_BUCKETS]; (c = *pp);
+	     pp = &c->next) {
+		if (c->xid == xid) {
+			*pp = c->next;
+			return c;
+		}
+	}
+
+	return NULL;
+}
+
+static long __now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Called with mux->lock held. Waiting callers are woken, submitted calls
+ * are moved to mux->orphans for the receiver to complete on its way out.
+ */
+static void hsi_mux_kill(struct hsi_mux *mux, int err)
+{
+	struct hsi_mux_call **pp, *c;
+	int i;
+
+	if (mux->dead)
+		return;
+	mux->dead = 1;
+	mux->err = err ? err : ECONNRESET;
+	for (i = 0; i < HSI_MUX_BUCKETS; i++) {
+		for (pp = &mux->table[i]; (c = *pp);) {
+			if (c->fn == NULL) {
+				pthread_cond_signal(&c->cond);
+				pp = &c->next;
+				continue;
+			}
+			*pp = c->next;
+			c->next = mux->orphans;
+			mux->orphans = c;
+			mux->inflight--;
+		}
+	}
+}
+
+/* Complete a submitted call, without mux->lock. */
+static void hsi_mux_finish(struct hsi_mux_call *c, enum clnt_stat st)
+{
+	c->fn(c->priv, st);
+	free(c);
+}
+
+/* Time out the submitted calls whose deadline has passed. */
+static void hsi_mux_expire(struct hsi_mux *mux)
+{
+	struct hsi_mux_call **pp, *c, *gone = NULL;
+	long now = __now_ms();
+	int i;
+
+	pthread_mutex_lock(&mux->lock);
+	for (i = 0; i < HSI_MUX_BUCKETS; i++) {
+		for (pp = &mux->table[i]; (c = *pp);) {
+			if (c->fn == NULL || c->deadline > now) {
+				pp = &c->next;
+				continue;
+			}
+			*pp = c->next;
+			c->next = gone;
+			gone = c;
+			mux->inflight--;
+		}
+	}
+	pthread_mutex_unlock(&mux->lock);
+
+	while ((c = gone)) {
+		gone = c->next;
+		DEBUG("Submitted call xid 0x%x timed out.", c->xid);
+		hsi_mux_finish(c, RPC_TIMEDOUT);
+	}
+}
+
+static void hsi_mux_rec_free(struct hsi_mux_rec *rec)
+{
+	hsfs_buf_put(rec->buf, rec->cap);
+	free(rec);
+}
+
+/* Write a batch of records, returns 0 or errno */
+static int hsi_mux_writev(int fd, struct hsi_mux_rec *batch)
+{
+	struct iovec iov[64], *v;
+	struct hsi_mux_rec *rec = batch;
+	ssize_t n;
+	int cnt;
+
+	while (rec) {
+		for (cnt = 0; rec && cnt < 64; rec = rec->next, cnt++) {
+			iov[cnt].iov_base = rec->buf;
+			iov[cnt].iov_len = rec->len;
+		}
+		v = iov;
+		while (cnt) {
+			n = writev(fd, v, cnt);
+			if (n < 0) {
+				if (errno == EINTR)
+					continue;
+				return errno;
+			}
+			while (cnt && (size_t)n >= v->iov_len) {
+				n -= v->iov_len;
+				v++;
+				cnt--;
+			}
+			if (cnt) {
+				v->iov_base = (char *)v->iov_base + n;
+				v->iov_len -= n;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Called with mux->lock held, returns with it held */
+static void hsi_mux_send(struct hsi_mux *mux)
+{
+	struct hsi_mux_rec *batch, *rec;
+	struct timespec ts = { 0, HSI_MUX_CORK_US * 1000 };
+	int err;
+
+	mux->sending = 1;
+	/* Others are talking too, let their records join this write. */
+	if (mux->inflight > 1) {
+		pthread_mutex_unlock(&mux->lock);
+		nanosleep(&ts, NULL);
+		pthread_mutex_lock(&mux->lock);
+	}
+
+	while ((batch = mux->sq_head)) {
+		mux->sq_head = NULL;
+		mux->sq_tail = &mux->sq_head;
+		pthread_mutex_unlock(&mux->lock);
+
+		err = mux->dead ? 0 : hsi_mux_writev(mux->fd, batch);
+		while ((rec = batch)) {
+			batch = rec->next;
+			hsi_mux_rec_free(rec);
+		}
+
+		pthread_mutex_lock(&mux->lock);
+		if (err) {
+			/* The reader sees the same, make sure nobody waits. */
+			hsi_mux_kill(mux, err);
+			shutdown(mux->fd, SHUT_RDWR);
+		}
+	}
+	mux->sending = 0;
+}
+
+static struct hsi_mux_rec *hsi_mux_encode(struct hsi_mux *mux, u_int32_t xid,
+					  rpcproc_t proc, xdrproc_t xargs,
+					  void *args)
+{
+	struct hsi_mux_rec *rec;
+	struct rpc_msg msg;
+	u_int32_t mark;
+	XDR xdrs;
+
+	rec = malloc(sizeof(*rec));
+	if (rec == NULL)
+		return NULL;
+	rec->next = NULL;
+	rec->cap = BYTES_PER_XDR_UNIT + HSI_MUX_HDR +
+		   2 * (MAX_AUTH_BYTES + 2 * BYTES_PER_XDR_UNIT) +
+		   xdr_sizeof(xargs, args);
+	rec->buf = hsfs_buf_get(rec->cap);
+	if (rec->buf == NULL) {
+		free(rec);
+		return NULL;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.rm_xid = xid;
+	msg.rm_direction = CALL;
+	msg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+	msg.rm_call.cb_prog = mux->prog;
+	msg.rm_call.cb_vers = mux->vers;
+
+	xdrmem_create(&xdrs, rec->buf + BYTES_PER_XDR_UNIT,
+		      rec->cap - BYTES_PER_XDR_UNIT, XDR_ENCODE);
+	if (!xdr_callhdr(&xdrs, &msg) || !xdr_u_int32_t(&xdrs, &proc) ||
+	    !AUTH_MARSHALL(mux->clnt.cl_auth, &xdrs) ||
+	    !xargs(&xdrs, args)) {
+		xdr_destroy(&xdrs);
+		hsi_mux_rec_free(rec);
+		return NULL;
+	}
+	rec->len = BYTES_PER_XDR_UNIT + xdr_getpos(&xdrs);
+	xdr_destroy(&xdrs);
+
+	mark = htonl(HSI_MUX_LAST_FRAG | (u_int32_t)(rec->len - BYTES_PER_XDR_UNIT));
+	memcpy(rec->buf, &mark, sizeof(mark));
+
+	return rec;
+}
+
+static enum clnt_stat hsi_mux_decode(struct hsi_mux *mux, char *buf,
+				     size_t len, xdrproc_t xres, void *res)
+{
+	struct rpc_msg reply;
+	XDR xdrs;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.acpted_rply.ar_verf = _null_auth;
+	reply.acpted_rply.ar_results.where = res;
+	reply.acpted_rply.ar_results.proc = xres;
+
+	memset(&hsi_mux_err, 0, sizeof(hsi_mux_err));
+	xdrmem_create(&xdrs, buf, len, XDR_DECODE);
+	if (!xdr_replymsg(&xdrs, &reply)) {
+		hsi_mux_err.re_status = RPC_CANTDECODERES;
+		goto out;
+	}
+
+	_seterr_reply(&reply, &hsi_mux_err);
+	if (hsi_mux_err.re_status == RPC_SUCCESS &&
+	    !AUTH_VALIDATE(mux->clnt.cl_auth, &reply.acpted_rply.ar_verf)) {
+		hsi_mux_err.re_status = RPC_AUTHERROR;
+		hsi_mux_err.re_why = AUTH_INVALIDRESP;
+	}
+	if (reply.acpted_rply.ar_verf.oa_base != NULL) {
+		xdrs.x_op = XDR_FREE;
+		xdr_opaque_auth(&xdrs, &reply.acpted_rply.ar_verf);
+	}
+out:
+	xdr_destroy(&xdrs);
+	return hsi_mux_err.re_status;
+}
+
+static enum clnt_stat hsi_mux_call(CLIENT *cl, rpcproc_t proc,
+				   xdrproc_t xargs, void *args,
+				   xdrproc_t xres, void *res,
+				   struct timeval tout)
+{
+	struct hsi_mux *mux = (struct hsi_mux *)cl;
+	struct hsi_mux_call call;
+	struct hsi_mux_rec *rec;
+	struct timespec ts;
+	enum clnt_stat st = RPC_TIMEDOUT;
+	long nsec;
+	int err = 0;
+
+	memset(&hsi_mux_err, 0, sizeof(hsi_mux_err));
+
+	pthread_mutex_lock(&mux->lock);
+	call.xid = hsi_mux_xid_set ? hsi_mux_next_xid : mux->xid++;
+	pthread_mutex_unlock(&mux->lock);
+	hsi_mux_xid_set = 0;
+	hsi_mux_last_xid = call.xid;
+
+	rec = hsi_mux_encode(mux, call.xid, proc, xargs, args);
+	if (rec == NULL) {
+		hsi_mux_err.re_status = RPC_CANTENCODEARGS;
+		return RPC_CANTENCODEARGS;
+	}
+
+	pthread_cond_init(&call.cond, NULL);
+	call.done = 0;
+	call.reply = NULL;
+	call.fn = NULL;
+
+	pthread_mutex_lock(&mux->lock);
+	if (mux->dead) {
+		err = mux->err;
+		pthread_mutex_unlock(&mux->lock);
+		hsi_mux_rec_free(rec);
+		pthread_cond_destroy(&call.cond);
+		hsi_mux_err.re_status = RPC_CANTSEND;
+		hsi_mux_err.re_errno = err;
+		return RPC_CANTSEND;
+	}
+	call.next = mux->table[call.xid % HSI_MUX_BUCKETS];
+	mux->table[call.xid % HSI_MUX_BUCKETS] = &call;
+	*mux->sq_tail = rec;
+	mux->sq_tail = &rec->next;
+	mux->inflight++;
+	if (!mux->sending)
+		hsi_mux_send(mux);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	nsec = ts.tv_nsec + tout.tv_usec * 1000L;
+	ts.tv_sec += tout.tv_sec + nsec / 1000000000L;
+	ts.tv_nsec = nsec % 1000000000L;
+	while (!call.done && !mux->dead && !err)
+		err = pthread_cond_timedwait(&call.cond, &mux->lock, &ts);
+
+	if (!call.done) {
+		hsi_mux_unhash(mux, call.xid);
+		st = mux->dead ? RPC_CANTRECV : RPC_TIMEDOUT;
+		hsi_mux_err.re_errno = mux->dead ? mux->err : 0;
+	}
+	mux->inflight--;
+	pthread_mutex_unlock(&mux->lock);
+	pthread_cond_destroy(&call.cond);
+
+	if (!call.done) {
+		hsi_mux_err.re_status = st;
+		return st;
+	}
+
+	st = hsi_mux_decode(mux, call.reply, call.replen, xres, res);
+	hsfs_buf_put(call.reply, call.repcap);
+
+	return st;
+}
+
+/* Hand a complete record to its caller, complete it, or drop it. */
+static void hsi_mux_dispatch(struct hsi_mux *mux, char *rec, size_t len,
+			     size_t cap)
+{
+	struct hsi_mux_call *c = NULL;
+	u_int32_t xid;
+
+	if (len >= sizeof(xid)) {
+		memcpy(&xid, rec, sizeof(xid));
+		xid = ntohl(xid);
+		pthread_mutex_lock(&mux->lock);
+		c = hsi_mux_unhash(mux, xid);
+		if (c && c->fn) {
+			mux->inflight--;
+		} else if (c) {
+			c->reply = rec;
+			c->replen = len;
+			c->repcap = cap;
+			c->done = 1;
+			pthread_cond_signal(&c->cond);
+		}
+		pthread_mutex_unlock(&mux->lock);
+	}
+	if (c == NULL) {
+		DEBUG("Dropped a reply to nobody, %zu bytes.", len);
+		hsfs_buf_put(rec, cap);
+	} else if (c->fn) {
+		enum clnt_stat st = hsi_mux_decode(mux, rec, len, c->xres,
+						   c->res);
+
+		hsfs_buf_put(rec, cap);
+		hsi_mux_finish(c, st);
+	}
+}
+
+static void *hsi_mux_reader(void *arg)
+{
+	struct hsi_mux *mux = arg;
+	struct hsi_mux_call *orphans, *c;
+	char *rbuf, *rec = NULL;
+	size_t head = 0, tail = 0, reclen = 0, reccap = 0, flen, take;
+	u_int32_t mark;
+	ssize_t n;
+	int err = 0, last;
+
+	rbuf = malloc(HSI_MUX_RBUF);
+	if (rbuf == NULL) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (;;) {
+		/* The fragment header */
+		while (tail - head < sizeof(mark)) {
+			memmove(rbuf, rbuf + head, tail - head);
+			tail -= head;
+			head = 0;
+			n = read(mux->fd, rbuf + tail, HSI_MUX_RBUF - tail);
+			if (n <= 0) {
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n < 0 && errno == EAGAIN) {
+					hsi_mux_expire(mux);
+					continue;
+				}
+				err = n ? errno : ECONNRESET;
+				goto out;
+			}
+			tail += n;
+		}
+		memcpy(&mark, rbuf + head, sizeof(mark));
+		head += sizeof(mark);
+		mark = ntohl(mark);
+		last = !!(mark & HSI_MUX_LAST_FRAG);
+		flen = mark & ~HSI_MUX_LAST_FRAG;
+		if (reclen + flen > HSI_MUX_MAX_RECORD) {
+			ERR("Record of %zu bytes from server, giving up.",
+			    reclen + flen);
+			err = EPROTO;
+			goto out;
+		}
+
+		/*
+		 * The fragment body, what is buffered then the rest. Replies
+		 * are one fragment but for odd servers, so the buffer is
+		 * taken from the pool at the size of the record.
+		 */
+		if (reclen + flen > reccap) {
+			char *p = hsfs_buf_get(reclen + flen);
+
+			if (p == NULL) {
+				err = ENOMEM;
+				goto out;
+			}
+			if (reclen)
+				memcpy(p, rec, reclen);
+			hsfs_buf_put(rec, reccap);
+			rec = p;
+			reccap = reclen + flen;
+		}
+		take = min(flen, tail - head);
+		memcpy(rec + reclen, rbuf + head, take);
+		head += take;
+		reclen += take;
+		flen -= take;
+		while (flen) {
+			n = read(mux->fd, rec + reclen, flen);
+			if (n <= 0) {
+				if (n < 0 && errno == EINTR)
+					continue;
+				if (n < 0 && errno == EAGAIN) {
+					hsi_mux_expire(mux);
+					continue;
+				}
+				err = n ? errno : ECONNRESET;
+				goto out;
+			}
+			reclen += n;
+			flen -= n;
+		}
+
+		if (last) {
+			hsi_mux_dispatch(mux, rec, reclen, reccap);
+			rec = NULL;
+			reclen = reccap = 0;
+		}
+	}
+out:
+	hsfs_buf_put(rec, reccap);
+	free(rbuf);
+	pthread_mutex_lock(&mux->lock);
+	hsi_mux_kill(mux, err);
+	orphans = mux->orphans;
+	mux->orphans = NULL;
+	pthread_mutex_unlock(&mux->lock);
+
+	while ((c = orphans)) {
+		orphans = c->next;
+		hsi_mux_finish(c, RPC_CANTRECV);
+	}
+
+	return NULL;
+}
+
+static void hsi_mux_abort(CLIENT *cl _U_)
+{
+}
+
+static void hsi_mux_geterr(CLIENT *cl _U_, struct rpc_err *err)
+{
+	*err = hsi_mux_err;
+}
+
+static bool_t hsi_mux_freeres(CLIENT *cl _U_, xdrproc_t xres, void *res)
+{
+	xdr_free(xres, res);
+	return TRUE;
+}
+
+static bool_t hsi_mux_control(CLIENT *cl _U_, u_int req, void *info)
+{
+	switch (req) {
+	case CLGET_XID:
+		*(u_int32_t *)info = hsi_mux_last_xid;
+		return TRUE;
+	case CLSET_XID:
+		hsi_mux_next_xid = *(u_int32_t *)info;
+		hsi_mux_xid_set = 1;
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static void hsi_mux_destroy(CLIENT *cl)
+{
+	struct hsi_mux *mux = (struct hsi_mux *)cl;
+	struct hsi_mux_rec *rec;
+
+	shutdown(mux->fd, SHUT_RDWR);
+	pthread_join(mux->reader, NULL);
+	close(mux->fd);
+
+	while ((rec = mux->sq_head)) {
+		mux->sq_head = rec->next;
+		hsi_mux_rec_free(rec);
+	}
+	pthread_mutex_destroy(&mux->lock);
+	free(mux);
+}
+
+static struct clnt_ops hsi_mux_ops = {
+	.cl_call = hsi_mux_call,
+	.cl_abort = hsi_mux_abort,
+	.cl_geterr = hsi_mux_geterr,
+	.cl_freeres = hsi_mux_freeres,
+	.cl_destroy = hsi_mux_destroy,
+	.cl_control = hsi_mux_control,
+};
+
+int hsi_nfs3_mux_submit(CLIENT *cl, rpcproc_t proc, xdrproc_t xargs,
+			void *args, xdrproc_t xres, void *res,
+			struct timeval tout, hsi_nfs3_done_t done, void *priv)
+{
+	struct hsi_mux *mux = (struct hsi_mux *)cl;
+	struct hsi_mux_call *c;
+	struct hsi_mux_rec *rec;
+	int err;
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return ENOMEM;
+	c->fn = done;
+	c->priv = priv;
+	c->xres = xres;
+	c->res = res;
+	c->deadline = __now_ms() + tout.tv_sec * 1000L + tout.tv_usec / 1000;
+
+	pthread_mutex_lock(&mux->lock);
+	c->xid = mux->xid++;
+	pthread_mutex_unlock(&mux->lock);
+
+	rec = hsi_mux_encode(mux, c->xid, proc, xargs, args);
+	if (rec == NULL) {
+		free(c);
+		return EINVAL;
+	}
+
+	pthread_mutex_lock(&mux->lock);
+	if (mux->dead) {
+		err = mux->err;
+		pthread_mutex_unlock(&mux->lock);
+		hsi_mux_rec_free(rec);
+		free(c);
+		return err;
+	}
+	/* The reply may come, and complete c, as soon as it is sent. */
+	c->next = mux->table[c->xid % HSI_MUX_BUCKETS];
+	mux->table[c->xid % HSI_MUX_BUCKETS] = c;
+	*mux->sq_tail = rec;
+	mux->sq_tail = &rec->next;
+	mux->inflight++;
+	if (!mux->sending)
+		hsi_mux_send(mux);
+	pthread_mutex_unlock(&mux->lock);
+
+	return 0;
+}
+
+int hsi_nfs3_is_mux(CLIENT *clnt)
+{
+	return clnt && clnt->cl_ops == &hsi_mux_ops;
+}
+
+CLIENT *hsi_nfs3_mux_create(struct sockaddr_in *saddr, u_long prog,
+			    u_long vers)
+{
+	struct sockaddr_in addr = *saddr;
+	struct timeval tick = { HSI_MUX_TICK_MS / 1000,
+				(HSI_MUX_TICK_MS % 1000) * 1000 };
+	struct hsi_mux *mux;
+	struct timespec ts;
+	int one = 1, err;
+
+	if (addr.sin_port == 0) {
+		addr.sin_port = htons(pmap_getport(&addr, prog, vers,
+						   IPPROTO_TCP));
+		if (addr.sin_port == 0) {
+			ERR("Server has no TCP port for program %lu.", prog);
+			return NULL;
+		}
+	}
+
+	mux = calloc(1, sizeof(*mux));
+	if (mux == NULL)
+		return NULL;
+	mux->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (mux->fd < 0) {
+		err = errno;
+		goto fail_free;
+	}
+	/* Servers exporting "secure" want a reserved port, best effort. */
+	bindresvport(mux->fd, NULL);
+	if (connect(mux->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		err = errno;
+		ERR("Connect to server failed: %d.", err);
+		goto fail_close;
+	}
+	/* Records are batched here, don't let Nagle delay them further. */
+	setsockopt(mux->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	setsockopt(mux->fd, SOL_SOCKET, SO_RCVTIMEO, &tick, sizeof(tick));
+
+	pthread_mutex_init(&mux->lock, NULL);
+	mux->prog = prog;
+	mux->vers = vers;
+	mux->sq_tail = &mux->sq_head;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	mux->xid = (u_int32_t)getpid() ^ (u_int32_t)ts.tv_sec ^
+		   (u_int32_t)ts.tv_nsec;
+	mux->clnt.cl_ops = &hsi_mux_ops;
+	mux->clnt.cl_private = mux;
+
+	err = pthread_create(&mux->reader, NULL, hsi_mux_reader, mux);
+	if (err) {
+		ERR("Failed to start the reply reader: %d.", err);
+		pthread_mutex_destroy(&mux->lock);
+		goto fail_close;
+	}
+
+	return &mux->clnt;
+
+fail_close:
+	close(mux->fd);
+fail_free:
+	free(mux);
+	rpc_createerr.cf_stat = RPC_SYSTEMERROR;
+	rpc_createerr.cf_error.re_errno = err;
+	return NULL;
+}
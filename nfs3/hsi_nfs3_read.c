@@ -4,42 +4,35 @@
 #include "hsi_nfs3.h"
 #include "log.h"
 
-int hsi_nfs3_read(struct hsfs_rw_info* rinfo)
+void hsi_nfs3_read_prepare(struct hsfs_rw_info *rinfo,
+			   struct read3args *args, struct read3res *res)
 {
-	struct hsfs_super *sb = rinfo->inode->sb;
-	CLIENT *clnt = sb->clntp;
-	struct read3args args;
-	struct read3res res;
-	struct read3resok * resok = NULL;
-	int err = 0;
-
-	DEBUG_IN("offset 0x%x size 0x%x", (unsigned int)rinfo->rw_off,
-		(unsigned int)rinfo->rw_size);
-	memset(&args, 0, sizeof(args));
-	memset(&res, 0, sizeof(res));
+	memset(args, 0, sizeof(*args));
+	memset(res, 0, sizeof(*res));
 
-	hsi_nfs3_getfh3(rinfo->inode, &args.file);
+	hsi_nfs3_getfh3(rinfo->inode, &args->file);
 
-	args.offset = rinfo->rw_off;
-	args.count = rinfo->rw_size;
+	args->offset = rinfo->rw_off;
+	args->count = rinfo->rw_size;
+	/* Decode the data straight into the caller's buffer. */
+	res->read3res_u.resok.data.data_val = rinfo->data.data_val;
+	res->read3res_u.resok.data.data_len = rinfo->data.data_len;
+}
 
-	err = hsi_nfs3_clnt_call(sb, clnt, NFSPROC3_READ,
-				(xdrproc_t)xdr_read3args, (char *)&args,
-				(xdrproc_t)xdr_read3res, (char *)&res);
-	if (err)
-		goto out;
+int hsi_nfs3_read_finish(struct hsfs_rw_info *rinfo, struct read3res *res)
+{
+	struct read3resok * resok = NULL;
+	int err = 0;
 
 #ifdef HSFS_NFS3_TEST
-	err = res.status;
+	err = res->status;
 #else
-	err = hsi_nfs3_stat_to_errno(res.status);
+	err = hsi_nfs3_stat_to_errno(res->status);
 #endif
 	if(!err){
-		resok = &res.read3res_u.resok;
+		resok = &res->read3res_u.resok;
 		DEBUG("hsi_nfs3_read 0x%x done eof: %d",
 				resok->count, resok->eof);
-		memcpy(rinfo->data.data_val, resok->data.data_val,
-			resok->data.data_len);
 		rinfo->data.data_len = resok->data.data_len;
 		rinfo->ret_count = resok->count;
 		rinfo->eof = resok->eof;
@@ -56,9 +49,33 @@ int hsi_nfs3_read(struct hsfs_rw_info* rinfo)
 /* 				&res.read3res_u.resfail.post_op_attr_u.attributes, */
 /* 				sizeof(fattr3)); */
 	}
-	
-	clnt_freeres(clnt, (xdrproc_t)xdr_read3res, (char *)&res);
 
+	/* Only data decoded into a buffer of its own needs freeing. */
+	if (rinfo->data.data_val == NULL)
+		xdr_free((xdrproc_t)xdr_read3res, (char *)res);
+
+	return err;
+}
+
+int hsi_nfs3_read(struct hsfs_rw_info* rinfo)
+{
+	struct hsfs_super *sb = rinfo->inode->sb;
+	CLIENT *clnt = sb->clntp;
+	struct read3args args;
+	struct read3res res;
+	int err = 0;
+
+	DEBUG_IN("offset 0x%x size 0x%x", (unsigned int)rinfo->rw_off,
+		(unsigned int)rinfo->rw_size);
+	hsi_nfs3_read_prepare(rinfo, &args, &res);
+
+	err = hsi_nfs3_clnt_call(sb, clnt, NFSPROC3_READ,
+				(xdrproc_t)hsi_xdr_read3args, (char *)&args,
+				(xdrproc_t)hsi_xdr_read3res, (char *)&res);
+	if (err)
+		goto out;
+
+	err = hsi_nfs3_read_finish(rinfo, &res);
 out:
 	DEBUG_OUT("err %d", err);
 	return err;
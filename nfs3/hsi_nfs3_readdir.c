@@ -17,7 +17,10 @@
  * along with HSFS.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
+
 #include "hsfs.h"
+#include "hsfs_arena.h"
 #include "hsi_nfs3.h"
 #include "log.h"
 
@@ -32,27 +35,135 @@ static void __set_cookie_verf(struct hsfs_inode *inode, cookieverf3 *verf)
 	memcpy(&(NFS_I(inode)->cookieverf), verf, NFS3_COOKIEVERFSIZE);
 }
 
-static int __alloc_copy_name(struct hsfs_readdir_ctx **hrc, filename3 name)
+/*
+ * READDIR and READDIRPLUS replies are decoded straight into the request
+ * arena: entries, names and file handles are never malloc()ed, and the
+ * directory context handed to the FUSE layer points into the same memory.
+ * The caller releases it all at once after replying.
+ */
+static bool_t __xdr_arena_name(XDR *xdrs, filename3 *name)
 {
-	struct hsfs_readdir_ctx *ctx;
-	int len, err = 0;
+	u_int len;
 
-	ctx = malloc(sizeof(struct hsfs_readdir_ctx));
-	if (!ctx){
-		err = ENOMEM;
-		goto out1;
+	if (!xdr_u_int(xdrs, &len) || len > PATH_MAX)
+		return FALSE;
+	*name = hsfs_arena_alloc(len + 1);
+	if (*name == NULL || !xdr_opaque(xdrs, *name, len))
+		return FALSE;
+	(*name)[len] = '\0';
+
+	return TRUE;
+}
+
+static bool_t __xdr_arena_post_op_fh3(XDR *xdrs, post_op_fh3 *pfh)
+{
+	nfs_fh3 *fh = &pfh->post_op_fh3_u.handle;
+
+	if (!xdr_bool(xdrs, &pfh->present))
+		return FALSE;
+	if (!pfh->present)
+		return TRUE;
+	if (!xdr_u_int(xdrs, &fh->data.data_len) ||
+	    fh->data.data_len > NFS3_FHSIZE)
+		return FALSE;
+	fh->data.data_val = hsfs_arena_alloc(fh->data.data_len);
+	if (fh->data.data_val == NULL)
+		return FALSE;
+
+	return xdr_opaque(xdrs, fh->data.data_val, fh->data.data_len);
+}
+
+static bool_t __xdr_arena_readdir3res(XDR *xdrs, readdir3res *res)
+{
+	readdir3resok *ok = &res->readdir3res_u.resok;
+	entry3 **tail = &ok->reply.entries;
+	entry3 *entry;
+	bool_t more;
+
+	/* Nothing to free, the arena owns it all. */
+	if (xdrs->x_op == XDR_FREE)
+		return TRUE;
+	if (xdrs->x_op != XDR_DECODE)
+		return FALSE;
+
+	if (!xdr_nfsstat3(xdrs, &res->status))
+		return FALSE;
+	if (res->status != NFS3_OK)
+		return hsi_xdr_post_op_attr(xdrs, &res->readdir3res_u.resfail);
+
+	if (!hsi_xdr_post_op_attr(xdrs, &ok->dir_attributes) ||
+	    !xdr_cookieverf3(xdrs, ok->cookieverf))
+		return FALSE;
+	for (;;) {
+		if (!xdr_bool(xdrs, &more))
+			return FALSE;
+		if (!more)
+			break;
+		entry = hsfs_arena_alloc(sizeof(*entry));
+		if (entry == NULL ||
+		    !xdr_u_int64_t(xdrs, &entry->fileid) ||
+		    !__xdr_arena_name(xdrs, &entry->name) ||
+		    !xdr_u_int64_t(xdrs, &entry->cookie))
+			return FALSE;
+		*tail = entry;
+		tail = &entry->nextentry;
 	}
-	
-	len = strnlen(name, 255);
-	ctx->name = malloc(len + 1);
-	if (ctx->name == NULL){
-		err = ENOMEM;
-		goto out2;
+	*tail = NULL;
+
+	return xdr_bool(xdrs, &ok->reply.eof);
+}
+
+static bool_t __xdr_arena_readdirplus3res(XDR *xdrs, readdirplus3res *res)
+{
+	readdirplus3resok *ok = &res->readdirplus3res_u.resok;
+	entryplus3 **tail = &ok->reply.entries;
+	entryplus3 *entry;
+	bool_t more;
+
+	if (xdrs->x_op == XDR_FREE)
+		return TRUE;
+	if (xdrs->x_op != XDR_DECODE)
+		return FALSE;
+
+	if (!xdr_nfsstat3(xdrs, &res->status))
+		return FALSE;
+	if (res->status != NFS3_OK)
+		return hsi_xdr_post_op_attr(xdrs, &res->readdirplus3res_u.resfail);
+
+	if (!hsi_xdr_post_op_attr(xdrs, &ok->dir_attributes) ||
+	    !xdr_cookieverf3(xdrs, ok->cookieverf))
+		return FALSE;
+	for (;;) {
+		if (!xdr_bool(xdrs, &more))
+			return FALSE;
+		if (!more)
+			break;
+		entry = hsfs_arena_alloc(sizeof(*entry));
+		if (entry == NULL ||
+		    !xdr_u_int64_t(xdrs, &entry->fileid) ||
+		    !__xdr_arena_name(xdrs, &entry->name) ||
+		    !xdr_u_int64_t(xdrs, &entry->cookie) ||
+		    !hsi_xdr_post_op_attr(xdrs, &entry->name_attributes) ||
+		    !__xdr_arena_post_op_fh3(xdrs, &entry->name_handle))
+			return FALSE;
+		*tail = entry;
+		tail = &entry->nextentry;
 	}
+	*tail = NULL;
+
+	return xdr_bool(xdrs, &ok->reply.eof);
+}
+
+static int __alloc_ctx(struct hsfs_readdir_ctx **hrc, filename3 name)
+{
+	struct hsfs_readdir_ctx *ctx;
 
-	ctx->name[len] = '\0';
-	strncpy(ctx->name, name, len);
+	ctx = hsfs_arena_alloc(sizeof(struct hsfs_readdir_ctx));
+	if (!ctx)
+		return ENOMEM;
 
+	/* The name already lives in the arena and is NUL terminated. */
+	ctx->name = name;
 	ctx->next = NULL;
 	ctx->inode = NULL;
 	memset(&ctx->stbuf, 0, sizeof(struct stat));
@@ -62,27 +173,14 @@ static int __alloc_copy_name(struct hsfs_readdir_ctx **hrc, filename3 name)
 	*hrc = ctx;
 	
 	return 0;
-
-out2:
-	free(ctx);
-out1:
-	return err;
 }
 
 static void __free_ctx(struct hsfs_readdir_ctx *ctx)
 {
-	struct hsfs_readdir_ctx *saved;
-	struct hsfs_inode *new;
-
 	while (ctx){
-		if (ctx->name)
-			free(ctx->name);
-		new = ctx->inode;
-		if (new)
-			hsfs_iput(new);
-		saved = ctx->next;
-		free(ctx);
-		ctx = saved;
+		if (ctx->inode)
+			hsfs_iput(ctx->inode);
+		ctx = ctx->next;
 	}
 }
 
@@ -109,21 +207,21 @@ int hsi_nfs3_readdir(struct hsfs_inode *parent, unsigned int count, uint64_t coo
 	
 	err = hsi_nfs3_clnt_call(sb, clntp, NFSPROC3_READDIR,
 				 (xdrproc_t)xdr_readdir3args, (char *)&args,
-				 (xdrproc_t)xdr_readdir3res, (char *)&res);
+				 (xdrproc_t)__xdr_arena_readdir3res, (char *)&res);
 	if (err)
 		goto out1;
 	
 	if (NFS3_OK != res.status) {
 		ERR("Call NFS3 Server failure:(%d).\n", res.status);
 		err = hsi_nfs3_stat_to_errno(res.status);
-		goto out2;
+		goto out1;
 	}
 
 	nfs_init_fattr(&fattr);
 	hsi_nfs3_post2fattr(&res.readdir3res_u.resok.dir_attributes, &fattr);
 	err = nfs_refresh_inode(parent, &fattr);
 	if (err)
-		goto out2;
+		goto out1;
 	__set_cookie_verf(parent, &res.readdir3res_u.resok.cookieverf);
 
 	dlist = &res.readdir3res_u.resok.reply;
@@ -131,7 +229,7 @@ int hsi_nfs3_readdir(struct hsfs_inode *parent, unsigned int count, uint64_t coo
 	*ctx = NULL;
 
 	while(entry) {
-		err = __alloc_copy_name(&temp_hrc, entry->name);
+		err = __alloc_ctx(&temp_hrc, entry->name);
 		if (err)
 			goto out3;
 		if (*ctx == NULL)
@@ -142,15 +240,12 @@ int hsi_nfs3_readdir(struct hsfs_inode *parent, unsigned int count, uint64_t coo
 		ecount++;
 	}
 	/* We ignore dlist->eof here because Fuse don't need it. */
-	clnt_freeres(clntp, (xdrproc_t)xdr_readdir3res, (char *)&res);
 	DEBUG_OUT("Success with %d entries", ecount);
 	return 0;
 
 out3:
 	__free_ctx(*ctx);
-	ctx = NULL;
-out2:
-	clnt_freeres(clntp, (xdrproc_t)xdr_readdir3res, (char *)&res);
+	*ctx = NULL;
 out1:
 	DEBUG_OUT("Failed with error %d", err);
 	return err;
@@ -183,20 +278,20 @@ int hsi_nfs3_readdir_plus(struct hsfs_inode *parent, unsigned int count,
 	
 	err = hsi_nfs3_clnt_call(sb, clntp, NFSPROC3_READDIRPLUS,
 				(xdrproc_t)xdr_readdirplus3args, (char *)&args,
-				(xdrproc_t)xdr_readdirplus3res, (char *)&res);
+				(xdrproc_t)__xdr_arena_readdirplus3res, (char *)&res);
 		if (err)
 			goto out;
 
 		if (NFS3_OK != res.status) {
 			ERR("Call NFS3 Server failure:(%d).\n", res.status);
 			err = hsi_nfs3_stat_to_errno(res.status);
-			goto out2;
+			goto out;
 		}
 	nfs_init_fattr(&fattr);
 	hsi_nfs3_post2fattr(&res.readdirplus3res_u.resok.dir_attributes, &fattr);
 	err = nfs_refresh_inode(parent, &fattr);
 	if (err)
-		goto out2;
+		goto out;
 	__set_cookie_verf(parent, &res.readdirplus3res_u.resok.cookieverf);
 
 	dlist = &res.readdirplus3res_u.resok.reply;
@@ -208,7 +303,7 @@ int hsi_nfs3_readdir_plus(struct hsfs_inode *parent, unsigned int count,
 		struct nfs_fattr fattr;
 		struct hsfs_inode *new;
 
-		err = __alloc_copy_name(&temp_hrc, entry->name);
+		err = __alloc_ctx(&temp_hrc, entry->name);
 		if (err)
 			goto out3;
 		if(*ctx == NULL)
@@ -236,14 +331,11 @@ int hsi_nfs3_readdir_plus(struct hsfs_inode *parent, unsigned int count,
 		entry = entry->nextentry;
 	}
 	/* We ignore dlist->eof here because Fuse don't need it. */
-		clnt_freeres(clntp, (xdrproc_t)xdr_readdirplus3res,(char*)&res);
 	DEBUG_OUT("with %d entries returned.", ecount);
 	return 0;
 out3:
 	__free_ctx(*ctx);
 	*ctx = NULL;
-out2:
-	clnt_freeres(clntp, (xdrproc_t)xdr_readdirplus3res, (char *)&res);
 out:
 	DEBUG_OUT("with error %d.", err);
 	return err;
@@ -79,6 +79,7 @@ out:
 
 #include "nfs3.h"
 #include "hsi_nfs3.h"
+#include "hsfs_arena.h"
 #include "log.h"
 
 
@@ -112,8 +113,9 @@ int hsi_nfs3_readlink(struct hsfs_inode *inode, char **link)
 		goto out1;
 	}
 	len = strlen(res.readlink3res_u.resok.data);
-	*link = (char *)malloc(len+1);
+	*link = hsfs_arena_alloc(len+1);
 	if((*link) == NULL){
+		err = ENOMEM;
 		goto out1;
 	}
 	strcpy(*link, res.readlink3res_u.resok.data);
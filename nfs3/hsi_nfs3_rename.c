@@ -61,16 +61,8 @@ int hsi_nfs3_rename(struct hsfs_inode *parent, const char *name,
 		err = hsi_nfs3_stat_to_errno(ret);
 		goto out2;
 	}
-	/* if(res.rename3res_u.res.fromdir_wcc.after.present) { */
-/* 		memcpy(&(parent->attr), &res.rename3res_u.res.fromdir_wcc. */
-/* 				after.post_op_attr_u.attributes, */
-/* 				sizeof(fattr3)); */
-	/* } */
-	/* if(res.rename3res_u.res.todir_wcc.after.present) { */
-/* 		memcpy(&(newparent->attr), &res.rename3res_u.res.todir_wcc. */
-/* 				after.post_op_attr_u.attributes, */
-/* 				sizeof(fattr3)); */
-	/* } */
+	hsi_nfs3_wcc_update(parent, &res.rename3res_u.res.fromdir_wcc);
+	hsi_nfs3_wcc_update(newparent, &res.rename3res_u.res.todir_wcc);
 out2:
 	clnt_freeres(clntp, (xdrproc_t)xdr_rename3res, (char *)&res);
 out1:
@@ -36,6 +36,8 @@ int hsi_nfs3_rmdir (struct hsfs_inode *parent, const char *name)
 		goto out;
 	
 	err = hsi_nfs3_stat_to_errno(clnt_res.status); 	/*nfs error.*/
+	if (0 == err)
+		hsi_nfs3_wcc_update(parent, &clnt_res.wccstat3_u.wcc);
 	clnt_freeres(sb->clntp, (xdrproc_t)xdr_wccstat3, (char *)&clnt_res);
 out:
 	DEBUG_OUT(" out, errno is(%d)\n", err);
@@ -0,0 +1,160 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Round trip time estimation for the retransmit timer, after the Linux
+ * sunrpc client (net/sunrpc/timer.c) and RFC 6298:
+ *
+ *	SRTT   += (RTT - SRTT) / 8
+ *	RTTVAR += (|RTT - SRTT| - RTTVAR) / 4
+ *	RTO     = SRTT + 4 * RTTVAR
+ *
+ * kept per connection and per class of procedure, so the timer of a slow
+ * WRITE or COMMIT is not tuned by GETATTR. The RTO is doubled per timeout
+ * and clamped to [HSI_RTT_MIN_US, timeo]. Until the first sample the mount
+ * timeo is used as is. Only the intervals get shorter: a call is given up
+ * after timeo * retrans as before (see hsi_nfs3_clnt_call()).
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hsi_nfs3.h"
+
+#define HSI_RTT_MIN_US		(500 * 1000L)
+/* Cap of the shift applied after consecutive timeouts */
+#define HSI_RTT_MAX_BACKOFF	6
+/* EAGAIN backoff: 10ms, doubling, up to 1s */
+#define HSI_BACKOFF_BASE_US	(10 * 1000L)
+#define HSI_BACKOFF_MAX_US	(1000 * 1000L)
+
+struct hsi_nfs3_rtt *hsi_nfs3_rtt_alloc(unsigned int timeo)
+{
+	struct hsi_nfs3_rtt *rtt;
+
+	rtt = calloc(1, sizeof(*rtt));
+	if (rtt == NULL)
+		return NULL;
+
+	pthread_mutex_init(&rtt->lock, NULL);
+	rtt->timeo = (long)timeo * 100 * 1000;
+	if (rtt->timeo < HSI_RTT_MIN_US)
+		rtt->timeo = HSI_RTT_MIN_US;
+
+	return rtt;
+}
+
+void hsi_nfs3_rtt_free(struct hsi_nfs3_rtt *rtt)
+{
+	if (rtt == NULL)
+		return;
+	pthread_mutex_destroy(&rtt->lock);
+	free(rtt);
+}
+
+int hsi_nfs3_rtt_class(unsigned long procnum)
+{
+	switch (procnum) {
+	case NFSPROC3_READ:
+		return HSI_RTT_READ;
+	case NFSPROC3_WRITE:
+	case NFSPROC3_COMMIT:
+		return HSI_RTT_WRITE;
+	default:
+		return HSI_RTT_META;
+	}
+}
+
+void hsi_nfs3_rtt_timeout(struct hsi_nfs3_rtt *rtt, int cls,
+			  unsigned int ntimeo, struct timeval *tv)
+{
+	long rto, max;
+	unsigned int shift;
+
+	pthread_mutex_lock(&rtt->lock);
+	max = rtt->timeo;
+	if (rtt->srtt[cls])
+		rto = rtt->srtt[cls] + 4 * rtt->rttvar[cls];
+	else
+		rto = max;
+	shift = ntimeo + rtt->ntimeouts[cls];
+	pthread_mutex_unlock(&rtt->lock);
+
+	if (shift > HSI_RTT_MAX_BACKOFF)
+		shift = HSI_RTT_MAX_BACKOFF;
+	rto <<= shift;
+	if (rto < HSI_RTT_MIN_US)
+		rto = HSI_RTT_MIN_US;
+	if (rto > max)
+		rto = max;
+
+	tv->tv_sec = rto / 1000000;
+	tv->tv_usec = rto % 1000000;
+}
+
+void hsi_nfs3_rtt_update(struct hsi_nfs3_rtt *rtt, int cls, long us)
+{
+	long err;
+
+	if (us <= 0)
+		us = 1;
+
+	pthread_mutex_lock(&rtt->lock);
+	if (rtt->srtt[cls] == 0) {
+		rtt->srtt[cls] = us;
+		rtt->rttvar[cls] = us / 2;
+	} else {
+		err = us - rtt->srtt[cls];
+		rtt->srtt[cls] += err / 8;
+		if (err < 0)
+			err = -err;
+		rtt->rttvar[cls] += (err - rtt->rttvar[cls]) / 4;
+	}
+	rtt->ntimeouts[cls] = 0;
+	pthread_mutex_unlock(&rtt->lock);
+}
+
+void hsi_nfs3_rtt_timedout(struct hsi_nfs3_rtt *rtt, int cls)
+{
+	pthread_mutex_lock(&rtt->lock);
+	if (rtt->ntimeouts[cls] < HSI_RTT_MAX_BACKOFF)
+		rtt->ntimeouts[cls]++;
+	pthread_mutex_unlock(&rtt->lock);
+}
+
+void hsi_nfs3_backoff(unsigned int attempt)
+{
+	static __thread unsigned int seed;
+	struct timespec ts;
+	long us = HSI_BACKOFF_BASE_US;
+
+	if (seed == 0)
+		seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)&ts;
+
+	while (attempt-- && us < HSI_BACKOFF_MAX_US)
+		us <<= 1;
+	if (us > HSI_BACKOFF_MAX_US)
+		us = HSI_BACKOFF_MAX_US;
+	/* Jitter over [us / 2, us) so waiting threads don't retry in step */
+	us = us / 2 + rand_r(&seed) % (us / 2);
+
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = us % 1000000 * 1000;
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
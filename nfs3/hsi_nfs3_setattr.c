@@ -22,9 +22,28 @@
 
 int hsi_nfs3_wcc2fattr(struct wcc_data *wcc, struct nfs_fattr *fattr)
 {
+	struct wcc_attr *pre = &wcc->before.pre_op_attr_u.attributes;
+
+	if (wcc->before.present) {
+		fattr->pre_size = pre->size;
+		hsi_nfs3_time2spec(&pre->mtime, &fattr->pre_mtime);
+		hsi_nfs3_time2spec(&pre->ctime, &fattr->pre_ctime);
+		fattr->valid |= NFS_ATTR_FATTR_PRESIZE |
+			NFS_ATTR_FATTR_PREMTIME | NFS_ATTR_FATTR_PRECTIME;
+	}
+
 	return hsi_nfs3_post2fattr(&(wcc->after), fattr);
 }
 
+void hsi_nfs3_wcc_update(struct hsfs_inode *inode, struct wcc_data *wcc)
+{
+	struct nfs_fattr fattr;
+
+	nfs_init_fattr(&fattr);
+	if (hsi_nfs3_wcc2fattr(wcc, &fattr))
+		nfs_refresh_inode(inode, &fattr);
+}
+
 int hsi_nfs3_setattr(struct hsfs_inode *inode, struct nfs_fattr *fattr, struct hsfs_iattr *attr)
 {
 	int err = 0;
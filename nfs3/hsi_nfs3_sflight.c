@@ -0,0 +1,255 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Single-flight for idempotent NFSv3 calls.
+ *
+ * A call is identified by the CLIENT, the procedure and its XDR encoded
+ * arguments, which covers the file handle and every other argument. The
+ * first caller (the leader) goes to the server. Identical calls made while
+ * it is outstanding wait for it; the leader then encodes its reply once
+ * and every waiter decodes its own copy, so each caller still owns and
+ * frees its result as if it had done the call itself.
+ *
+ * A flight is unhashed as soon as the reply arrives, so a call made
+ * after that always reaches the server. A call made while it is out may
+ * still find the request already on the wire, answered from a state older
+ * than a change this caller just made (a GETATTR after its own SETATTR).
+ * Every change that completes bumps a generation, and only flights started
+ * in the current generation are joined: their request was sent after the
+ * last change the caller may have seen.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hsi_nfs3.h"
+#include "hsfs_buf.h"
+
+/* Arguments larger than this are never coalesced */
+#define HSI_SFLIGHT_MAX_ARGS	512
+#define HSI_SFLIGHT_BUCKETS	256
+
+struct hsi_sflight {
+	struct hsi_sflight *next;
+	CLIENT *clnt;
+	unsigned long proc;
+	uint32_t hash;
+	unsigned int alen;
+	unsigned long gen;	/* hsi_sflight_gen when started */
+	int waiters;		/* Callers attached, including the leader */
+	int done;
+	int err;
+	char *res;		/* Encoded reply for the waiters */
+	unsigned int rlen;
+	pthread_cond_t cond;
+	char args[];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct hsi_sflight *head;
+} hsi_sflight_table[HSI_SFLIGHT_BUCKETS];
+
+static pthread_once_t hsi_sflight_once = PTHREAD_ONCE_INIT;
+
+/* Changes completed, see hsi_nfs3_sflight_changed() */
+static unsigned long hsi_sflight_gen;
+
+static void hsi_sflight_init(void)
+{
+	int i;
+
+	for (i = 0; i < HSI_SFLIGHT_BUCKETS; i++)
+		pthread_mutex_init(&hsi_sflight_table[i].lock, NULL);
+}
+
+static int hsi_sflight_idempotent(unsigned long proc)
+{
+	switch (proc) {
+	case NFSPROC3_GETATTR:
+	case NFSPROC3_LOOKUP:
+	case NFSPROC3_ACCESS:
+	case NFSPROC3_READLINK:
+	case NFSPROC3_READ:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* FNV-1a */
+static uint32_t hsi_sflight_hash(unsigned long proc, const char *buf,
+				 unsigned int len)
+{
+	uint32_t h = 2166136261u ^ (uint32_t)proc;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)buf[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static void hsi_sflight_put(struct hsi_sflight *fl)
+{
+	/* Called with the bucket lock held */
+	if (--fl->waiters)
+		return;
+	pthread_cond_destroy(&fl->cond);
+	hsfs_buf_put(fl->res, fl->rlen);
+	free(fl);
+}
+
+int hsi_nfs3_sflight_begin(CLIENT *clnt, unsigned long procnum,
+			   xdrproc_t inproc, char *in,
+			   xdrproc_t outproc, char *out,
+			   struct hsi_sflight **flp, int *err)
+{
+	char abuf[HSI_SFLIGHT_MAX_ARGS];
+	struct hsi_sflight *fl;
+	unsigned int alen, b;
+	unsigned long gen;
+	uint32_t hash;
+	XDR xdrs;
+	int ret = 0;
+
+	*flp = NULL;
+	if (!hsi_sflight_idempotent(procnum))
+		return 0;
+
+	xdrmem_create(&xdrs, abuf, sizeof(abuf), XDR_ENCODE);
+	if (!inproc(&xdrs, in)) {
+		xdr_destroy(&xdrs);
+		return 0;
+	}
+	alen = xdr_getpos(&xdrs);
+	xdr_destroy(&xdrs);
+
+	pthread_once(&hsi_sflight_once, hsi_sflight_init);
+	hash = hsi_sflight_hash(procnum, abuf, alen);
+	b = hash % HSI_SFLIGHT_BUCKETS;
+	gen = __sync_add_and_fetch(&hsi_sflight_gen, 0);
+
+	pthread_mutex_lock(&hsi_sflight_table[b].lock);
+	for (fl = hsi_sflight_table[b].head; fl; fl = fl->next) {
+		if (fl->hash == hash && fl->gen == gen && fl->clnt == clnt &&
+		    fl->proc == procnum && fl->alen == alen &&
+		    !memcmp(fl->args, abuf, alen))
+			break;
+	}
+
+	if (fl) {
+		/* Somebody is already asking, wait for the answer. */
+		fl->waiters++;
+		while (!fl->done)
+			pthread_cond_wait(&fl->cond, &hsi_sflight_table[b].lock);
+		/* Our reference keeps fl, and fl->res is final once done. */
+		pthread_mutex_unlock(&hsi_sflight_table[b].lock);
+		if (fl->err) {
+			*err = fl->err;
+			ret = 1;
+		} else if (fl->res) {
+			/*
+			 * Decoding our own encoding only fails on ENOMEM.
+			 * Don't retry on a half decoded result, it may hold
+			 * buffers preset by the caller.
+			 */
+			xdrmem_create(&xdrs, fl->res, fl->rlen, XDR_DECODE);
+			*err = outproc(&xdrs, out) ? 0 : ENOMEM;
+			ret = 1;
+			xdr_destroy(&xdrs);
+		}
+		/* ret == 0: no usable reply, the caller goes on its own. */
+		pthread_mutex_lock(&hsi_sflight_table[b].lock);
+		hsi_sflight_put(fl);
+		pthread_mutex_unlock(&hsi_sflight_table[b].lock);
+		return ret;
+	}
+
+	fl = calloc(1, sizeof(*fl) + alen);
+	if (fl) {
+		fl->clnt = clnt;
+		fl->proc = procnum;
+		fl->hash = hash;
+		fl->alen = alen;
+		fl->gen = gen;
+		fl->waiters = 1;
+		pthread_cond_init(&fl->cond, NULL);
+		memcpy(fl->args, abuf, alen);
+		fl->next = hsi_sflight_table[b].head;
+		hsi_sflight_table[b].head = fl;
+		*flp = fl;
+	}
+	pthread_mutex_unlock(&hsi_sflight_table[b].lock);
+
+	return 0;
+}
+
+void hsi_nfs3_sflight_end(struct hsi_sflight *fl, int err,
+			  xdrproc_t outproc, char *out)
+{
+	struct hsi_sflight **pp;
+	unsigned int b;
+	int waiters;
+	XDR xdrs;
+
+	if (!fl)
+		return;
+
+	b = fl->hash % HSI_SFLIGHT_BUCKETS;
+	pthread_mutex_lock(&hsi_sflight_table[b].lock);
+	for (pp = &hsi_sflight_table[b].head; *pp; pp = &(*pp)->next) {
+		if (*pp == fl) {
+			*pp = fl->next;
+			break;
+		}
+	}
+	/* Unhashed, nobody can join any more. */
+	waiters = fl->waiters;
+	pthread_mutex_unlock(&hsi_sflight_table[b].lock);
+
+	fl->err = err;
+	if (!err && waiters > 1) {
+		fl->rlen = xdr_sizeof(outproc, out);
+		fl->res = hsfs_buf_get(fl->rlen);
+		if (fl->res) {
+			xdrmem_create(&xdrs, fl->res, fl->rlen, XDR_ENCODE);
+			if (!outproc(&xdrs, out)) {
+				hsfs_buf_put(fl->res, fl->rlen);
+				fl->res = NULL;
+			}
+			xdr_destroy(&xdrs);
+		}
+	}
+
+	pthread_mutex_lock(&hsi_sflight_table[b].lock);
+	fl->done = 1;
+	pthread_cond_broadcast(&fl->cond);
+	hsi_sflight_put(fl);
+	pthread_mutex_unlock(&hsi_sflight_table[b].lock);
+}
+
+void hsi_nfs3_sflight_changed(unsigned long procnum)
+{
+	if (!hsi_sflight_idempotent(procnum))
+		__sync_fetch_and_add(&hsi_sflight_gen, 1);
+}
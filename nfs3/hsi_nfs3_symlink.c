@@ -89,12 +89,15 @@ int hsi_nfs3_symlink(struct hsfs_inode *parent, struct hsfs_inode **new,
 	struct hsfs_super *sb = parent->sb;
 	struct symlink3args args;
 	struct diropres3 res;
+	char fhbuf[NFS3_FHSIZE];
 	int st = 0, err = 0;
 
 	DEBUG_IN("%s\n", "hsi_nfs3_symlink");
 
 	memset(&res, 0, sizeof(res));
 	memset(&args, 0, sizeof(args));
+	/* The handle is decoded in place, the reply holds nothing to free. */
+	res.diropres3_u.resok.obj.post_op_fh3_u.handle.data.data_val = fhbuf;
 
 	hsi_nfs3_getfh3(parent, &args.where.dir);
 	args.where.name = (char *)name;
@@ -111,16 +114,15 @@ int hsi_nfs3_symlink(struct hsfs_inode *parent, struct hsfs_inode **new,
 	if(NFS3_OK != st){
 		ERR("the proc of symlink failure:%d\n", st);
 		err = hsi_nfs3_stat_to_errno(st);
-		goto out1;
+		goto out2;
 	}
 
+	hsi_nfs3_wcc_update(parent, &res.diropres3_u.resok.dir_wcc);
 	*new = hsi_nfs3_handle_create(sb, &res.diropres3_u.resok);
 	if(IS_ERR(*new)){
 		*new = NULL;
 		err = PTR_ERR(*new);
 	}
-out1:
-	clnt_freeres(sb->clntp, (xdrproc_t)xdr_diropres3, (char*)&res);
 out2:
 	DEBUG_OUT("with errno %d\n", err);
 	return err;
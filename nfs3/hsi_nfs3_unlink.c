@@ -119,11 +119,7 @@ int hsi_nfs3_unlink(struct hsfs_inode *parent, const char *name)
 		err = hsi_nfs3_stat_to_errno(ret);
 		goto out2;
 	}
-	if (res.wccstat3_u.wcc.after.present) {
-/* 		memcpy(&(parent->attr), &res.wccstat3_u.wcc. */
-/* 				after.post_op_attr_u.attributes, */
-/* 				sizeof(fattr3)); */
-	}
+	hsi_nfs3_wcc_update(parent, &res.wccstat3_u.wcc);
 out2:
 	clnt_freeres(clntp, (xdrproc_t)xdr_wccstat3, (char *)&res);
 out1:
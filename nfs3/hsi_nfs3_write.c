@@ -27,8 +27,8 @@ int hsi_nfs3_write(struct hsfs_rw_info* winfo)
 	args.stable = winfo->stable;
 
 	err = hsi_nfs3_clnt_call(sb, clnt, NFSPROC3_WRITE,
-			(xdrproc_t)xdr_write3args, (char *)&args, 
-			(xdrproc_t)xdr_write3res, (char *)&res);
+			(xdrproc_t)hsi_xdr_write3args, (char *)&args,
+			(xdrproc_t)hsi_xdr_write3res, (char *)&res);
 	if(err)
 		goto out;
 
@@ -43,18 +43,12 @@ int hsi_nfs3_write(struct hsfs_rw_info* winfo)
 		DEBUG("hsi_nfs3_write 0x%x done", resok->count);
 		DEBUG("resok->file_wcc.after.present: %d", 
 			resok->file_wcc.after.present);
-/* 		if(resok->file_wcc.after.present) */
-/* 			memcpy(&winfo->inode->attr, */
-/* 				&resok->file_wcc.after.post_op_attr_u.attributes, */
-/* 				sizeof(fattr3)); */
+		hsi_nfs3_wcc_update(winfo->inode, &resok->file_wcc);
 	}else{
 		ERR("hsi_nfs3_write failure: %d", err);
 		DEBUG("res.write3res_u.resfail.after.present: %d", 
 			res.write3res_u.resfail.after.present);
-/* 		if(res.write3res_u.resfail.after.present) */
-/* 			memcpy(&winfo->inode->attr, */
-/* 				&res.write3res_u.resfail.after.post_op_attr_u.attributes, */
-/* 				sizeof(fattr3)); */
+		hsi_nfs3_wcc_update(winfo->inode, &res.write3res_u.resfail);
 	}
 
 	clnt_freeres(clnt, (xdrproc_t)xdr_write3res, (char *)&res);
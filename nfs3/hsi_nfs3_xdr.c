@@ -0,0 +1,353 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Specialized XDR routines for the hot procedures.
+ *
+ * The rpcgen routines make a call and a bounds check per 4 byte field,
+ * 26 of them for a fattr3. The routines here take the fixed size runs of
+ * a structure (fattr3, wcc_attr, the counts of READ and WRITE) from the
+ * stream with one XDR_INLINE() and convert them in a straight loop the
+ * compiler turns into vector byte swaps. When the stream can't give the
+ * run in one piece they fall back to the rpcgen routines.
+ *
+ * They produce the same structures as the rpcgen routines, which are
+ * used to free them. One addition: hsi_xdr_read3res() decodes the data
+ * into resok.data.data_val when the caller sets it, data_len giving the
+ * room there; such a reply holds nothing to free.
+ */
+#include <endian.h>
+#include <string.h>
+
+#include "hsi_nfs3.h"
+
+#define HSI_XDR_FATTR3_UNITS	21
+#define HSI_XDR_WCC_ATTR_UNITS	6
+
+static inline u_int64_t __get64(const u_int32_t *w)
+{
+	return (u_int64_t)w[0] << 32 | w[1];
+}
+
+static inline void __put64(u_int32_t *w, u_int64_t v)
+{
+	w[0] = v >> 32;
+	w[1] = (u_int32_t)v;
+}
+
+/* A plain loop of fixed length, so it gets vectorized. */
+static inline void __swap_units(u_int32_t *dst, const int32_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = be32toh((u_int32_t)src[i]);
+}
+
+static inline void __unswap_units(int32_t *dst, const u_int32_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = (int32_t)htobe32(src[i]);
+}
+
+bool_t hsi_xdr_fattr3(XDR *xdrs, fattr3 *fa)
+{
+	u_int32_t w[HSI_XDR_FATTR3_UNITS];
+	int32_t *buf;
+
+	if (xdrs->x_op == XDR_FREE)
+		return TRUE;
+
+	buf = XDR_INLINE(xdrs, HSI_XDR_FATTR3_UNITS * BYTES_PER_XDR_UNIT);
+	if (buf == NULL)
+		return xdr_fattr3(xdrs, fa);
+
+	if (xdrs->x_op == XDR_DECODE) {
+		__swap_units(w, buf, HSI_XDR_FATTR3_UNITS);
+		fa->type = (ftype3)w[0];
+		fa->mode = w[1];
+		fa->nlink = w[2];
+		fa->uid = w[3];
+		fa->gid = w[4];
+		fa->size = __get64(&w[5]);
+		fa->used = __get64(&w[7]);
+		fa->rdev.major = w[9];
+		fa->rdev.minor = w[10];
+		fa->fsid = __get64(&w[11]);
+		fa->fileid = __get64(&w[13]);
+		fa->atime.seconds = w[15];
+		fa->atime.nseconds = w[16];
+		fa->mtime.seconds = w[17];
+		fa->mtime.nseconds = w[18];
+		fa->ctime.seconds = w[19];
+		fa->ctime.nseconds = w[20];
+		return TRUE;
+	}
+
+	w[0] = (u_int32_t)fa->type;
+	w[1] = fa->mode;
+	w[2] = fa->nlink;
+	w[3] = fa->uid;
+	w[4] = fa->gid;
+	__put64(&w[5], fa->size);
+	__put64(&w[7], fa->used);
+	w[9] = fa->rdev.major;
+	w[10] = fa->rdev.minor;
+	__put64(&w[11], fa->fsid);
+	__put64(&w[13], fa->fileid);
+	w[15] = fa->atime.seconds;
+	w[16] = fa->atime.nseconds;
+	w[17] = fa->mtime.seconds;
+	w[18] = fa->mtime.nseconds;
+	w[19] = fa->ctime.seconds;
+	w[20] = fa->ctime.nseconds;
+	__unswap_units(buf, w, HSI_XDR_FATTR3_UNITS);
+
+	return TRUE;
+}
+
+bool_t hsi_xdr_post_op_attr(XDR *xdrs, post_op_attr *pa)
+{
+	if (!xdr_bool(xdrs, &pa->present))
+		return FALSE;
+	if (!pa->present)
+		return TRUE;
+
+	return hsi_xdr_fattr3(xdrs, &pa->post_op_attr_u.attributes);
+}
+
+static bool_t __xdr_pre_op_attr(XDR *xdrs, pre_op_attr *pa)
+{
+	wcc_attr *wa = &pa->pre_op_attr_u.attributes;
+	u_int32_t w[HSI_XDR_WCC_ATTR_UNITS];
+	int32_t *buf;
+
+	if (!xdr_bool(xdrs, &pa->present))
+		return FALSE;
+	if (!pa->present || xdrs->x_op == XDR_FREE)
+		return TRUE;
+
+	buf = XDR_INLINE(xdrs, HSI_XDR_WCC_ATTR_UNITS * BYTES_PER_XDR_UNIT);
+	if (buf == NULL)
+		return xdr_wcc_attr(xdrs, wa);
+
+	if (xdrs->x_op == XDR_DECODE) {
+		__swap_units(w, buf, HSI_XDR_WCC_ATTR_UNITS);
+		wa->size = __get64(&w[0]);
+		wa->mtime.seconds = w[2];
+		wa->mtime.nseconds = w[3];
+		wa->ctime.seconds = w[4];
+		wa->ctime.nseconds = w[5];
+		return TRUE;
+	}
+
+	__put64(&w[0], wa->size);
+	w[2] = wa->mtime.seconds;
+	w[3] = wa->mtime.nseconds;
+	w[4] = wa->ctime.seconds;
+	w[5] = wa->ctime.nseconds;
+	__unswap_units(buf, w, HSI_XDR_WCC_ATTR_UNITS);
+
+	return TRUE;
+}
+
+static bool_t __xdr_wcc_data(XDR *xdrs, wcc_data *wcc)
+{
+	return __xdr_pre_op_attr(xdrs, &wcc->before) &&
+	       hsi_xdr_post_op_attr(xdrs, &wcc->after);
+}
+
+bool_t hsi_xdr_getattr3res(XDR *xdrs, getattr3res *res)
+{
+	if (xdrs->x_op == XDR_FREE)
+		return xdr_getattr3res(xdrs, res);
+	if (!xdr_nfsstat3(xdrs, &res->status))
+		return FALSE;
+	if (res->status != NFS3_OK)
+		return TRUE;
+
+	return hsi_xdr_fattr3(xdrs, &res->getattr3res_u.attributes);
+}
+
+bool_t hsi_xdr_lookup3res(XDR *xdrs, lookup3res *res)
+{
+	lookup3resok *ok = &res->lookup3res_u.resok;
+
+	if (xdrs->x_op == XDR_FREE)
+		return xdr_lookup3res(xdrs, res);
+	if (!xdr_nfsstat3(xdrs, &res->status))
+		return FALSE;
+	if (res->status != NFS3_OK)
+		return hsi_xdr_post_op_attr(xdrs, &res->lookup3res_u.resfail);
+
+	return xdr_nfs_fh3(xdrs, &ok->object) &&
+	       hsi_xdr_post_op_attr(xdrs, &ok->obj_attributes) &&
+	       hsi_xdr_post_op_attr(xdrs, &ok->dir_attributes);
+}
+
+bool_t hsi_xdr_access3res(XDR *xdrs, access3res *res)
+{
+	if (xdrs->x_op == XDR_FREE)
+		return xdr_access3res(xdrs, res);
+	if (!xdr_nfsstat3(xdrs, &res->status))
+		return FALSE;
+	if (res->status != NFS3_OK)
+		return hsi_xdr_post_op_attr(xdrs, &res->access3res_u.resfail);
+
+	return hsi_xdr_post_op_attr(xdrs,
+				    &res->access3res_u.resok.obj_attributes) &&
+	       xdr_u_int(xdrs, &res->access3res_u.resok.access);
+}
+
+bool_t hsi_xdr_read3res(XDR *xdrs, read3res *res)
+{
+	read3resok *ok = &res->read3res_u.resok;
+	u_int32_t w[3];
+	int32_t *buf;
+	u_int room;
+	int preset;
+
+	if (xdrs->x_op == XDR_FREE)
+		return xdr_read3res(xdrs, res);
+	/* Taken before the union is written over */
+	preset = (xdrs->x_op == XDR_DECODE && ok->data.data_val != NULL);
+	room = preset ? ok->data.data_len : ~0U;
+	if (!xdr_nfsstat3(xdrs, &res->status))
+		return FALSE;
+	if (res->status != NFS3_OK)
+		return hsi_xdr_post_op_attr(xdrs, &res->read3res_u.resfail);
+	if (!hsi_xdr_post_op_attr(xdrs, &ok->file_attributes))
+		return FALSE;
+
+	buf = xdrs->x_op == XDR_DECODE ?
+		XDR_INLINE(xdrs, 3 * BYTES_PER_XDR_UNIT) : NULL;
+	if (buf == NULL)
+		return xdr_u_int(xdrs, &ok->count) &&
+		       xdr_bool(xdrs, &ok->eof) &&
+		       xdr_bytes(xdrs, &ok->data.data_val,
+				 &ok->data.data_len, room);
+
+	__swap_units(w, buf, 3);
+	ok->count = w[0];
+	ok->eof = (bool_t)w[1];
+	if (w[2] > room)
+		return FALSE;
+	ok->data.data_len = w[2];
+	if (w[2] == 0)
+		return TRUE;
+	if (!preset) {
+		ok->data.data_val = mem_alloc(w[2]);
+		if (ok->data.data_val == NULL)
+			return FALSE;
+	}
+
+	return xdr_opaque(xdrs, ok->data.data_val, w[2]);
+}
+
+bool_t hsi_xdr_write3res(XDR *xdrs, write3res *res)
+{
+	write3resok *ok = &res->write3res_u.resok;
+	int32_t *buf;
+
+	if (xdrs->x_op == XDR_FREE)
+		return xdr_write3res(xdrs, res);
+	if (!xdr_nfsstat3(xdrs, &res->status))
+		return FALSE;
+	if (res->status != NFS3_OK)
+		return __xdr_wcc_data(xdrs, &res->write3res_u.resfail);
+	if (!__xdr_wcc_data(xdrs, &ok->file_wcc))
+		return FALSE;
+
+	buf = XDR_INLINE(xdrs, 2 * BYTES_PER_XDR_UNIT + NFS3_WRITEVERFSIZE);
+	if (buf == NULL)
+		return xdr_u_int(xdrs, &ok->count) &&
+		       xdr_stable_how(xdrs, &ok->committed) &&
+		       xdr_writeverf3(xdrs, ok->verf);
+
+	if (xdrs->x_op == XDR_DECODE) {
+		ok->count = IXDR_GET_U_INT32(buf);
+		ok->committed = (stable_how)IXDR_GET_ENUM(buf, stable_how);
+		memcpy(ok->verf, buf, NFS3_WRITEVERFSIZE);
+	} else {
+		IXDR_PUT_U_INT32(buf, ok->count);
+		IXDR_PUT_ENUM(buf, ok->committed);
+		memcpy(buf, ok->verf, NFS3_WRITEVERFSIZE);
+	}
+
+	return TRUE;
+}
+
+bool_t hsi_xdr_read3args(XDR *xdrs, read3args *args)
+{
+	int32_t *buf;
+
+	if (xdrs->x_op == XDR_FREE)
+		return xdr_read3args(xdrs, args);
+	if (!xdr_nfs_fh3(xdrs, &args->file))
+		return FALSE;
+
+	buf = XDR_INLINE(xdrs, 3 * BYTES_PER_XDR_UNIT);
+	if (buf == NULL)
+		return xdr_u_int64_t(xdrs, &args->offset) &&
+		       xdr_u_int(xdrs, &args->count);
+
+	if (xdrs->x_op == XDR_DECODE) {
+		args->offset = (u_int64_t)IXDR_GET_U_INT32(buf) << 32;
+		args->offset |= IXDR_GET_U_INT32(buf);
+		args->count = IXDR_GET_U_INT32(buf);
+	} else {
+		IXDR_PUT_U_INT32(buf, args->offset >> 32);
+		IXDR_PUT_U_INT32(buf, (u_int32_t)args->offset);
+		IXDR_PUT_U_INT32(buf, args->count);
+	}
+
+	return TRUE;
+}
+
+bool_t hsi_xdr_write3args(XDR *xdrs, write3args *args)
+{
+	int32_t *buf;
+
+	if (xdrs->x_op == XDR_FREE)
+		return xdr_write3args(xdrs, args);
+	if (!xdr_nfs_fh3(xdrs, &args->file))
+		return FALSE;
+
+	/* Offset, count and stable; the data length goes with the data. */
+	buf = XDR_INLINE(xdrs, 4 * BYTES_PER_XDR_UNIT);
+	if (buf == NULL) {
+		if (!xdr_u_int64_t(xdrs, &args->offset) ||
+		    !xdr_u_int(xdrs, &args->count) ||
+		    !xdr_stable_how(xdrs, &args->stable))
+			return FALSE;
+	} else if (xdrs->x_op == XDR_DECODE) {
+		args->offset = (u_int64_t)IXDR_GET_U_INT32(buf) << 32;
+		args->offset |= IXDR_GET_U_INT32(buf);
+		args->count = IXDR_GET_U_INT32(buf);
+		args->stable = (stable_how)IXDR_GET_ENUM(buf, stable_how);
+	} else {
+		IXDR_PUT_U_INT32(buf, args->offset >> 32);
+		IXDR_PUT_U_INT32(buf, (u_int32_t)args->offset);
+		IXDR_PUT_U_INT32(buf, args->count);
+		IXDR_PUT_ENUM(buf, args->stable);
+	}
+
+	return xdr_bytes(xdrs, &args->data.data_val, &args->data.data_len, ~0);
+}
@@ -973,6 +973,19 @@ int nfs_post_op_update_inode_force_wcc(struct inode *inode, struct nfs_fattr *fa
 	return nfs_post_op_update_inode(inode, fattr);
 }
 #endif
+/* Were the attributes before the call the ones cached? */
+static int nfs_wcc_explains(struct hsfs_inode *inode, struct nfs_fattr *fattr)
+{
+	if (!(fattr->valid & NFS_ATTR_FATTR_PREMTIME))
+		return 0;
+
+	return inode->i_mtime.tv_sec == fattr->pre_mtime.tv_sec &&
+	       inode->i_mtime.tv_nsec == fattr->pre_mtime.tv_nsec &&
+	       inode->i_ctime.tv_sec == fattr->pre_ctime.tv_sec &&
+	       inode->i_ctime.tv_nsec == fattr->pre_ctime.tv_nsec &&
+	       inode->i_size == nfs_size_to_off_t(fattr->pre_size);
+}
+
 /*
  * Many nfs protocol calls return the new file attributes after
  * an operation.  Here we update the inode to reflect the state
@@ -1043,6 +1056,18 @@ static int nfs_update_inode(struct hsfs_inode *inode, struct nfs_fattr *fattr)
 		nfsi->cache_change_attribute = jiffies;
 	}
 #endif
+	/*
+	 * The kernel may keep the old attributes, data or listing. Not
+	 * when the wcc data shows the change is the one of the call which
+	 * returned fattr: the kernel made that call and knows about it.
+	 */
+	if (inode->sb->changed && !nfs_wcc_explains(inode, fattr) &&
+	    (inode->i_mtime.tv_sec != fattr->mtime.tv_sec ||
+	     inode->i_mtime.tv_nsec != fattr->mtime.tv_nsec ||
+	     inode->i_ctime.tv_sec != fattr->ctime.tv_sec ||
+	     inode->i_ctime.tv_nsec != fattr->ctime.tv_nsec ||
+	     inode->i_size != nfs_size_to_off_t(fattr->size)))
+		inode->sb->changed(inode);
 	/* Check if our cached file size is stale */
  	new_isize = nfs_size_to_off_t(fattr->size);
 #if 0
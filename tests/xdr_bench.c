@@ -0,0 +1,218 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compare the specialized XDR routines of nfs3/hsi_nfs3_xdr.c with the
+ * rpcgen ones: check they decode the same, then time both.
+ *
+ * Build with "make xdr_bench" in tests/, run as ./xdr_bench [loops].
+ * With 0 loops it only checks, which is what xdr_check does for "make
+ * check".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hsi_nfs3.h"
+
+#ifdef BENCH_CHECK_ONLY
+# define BENCH_LOOPS	0
+#else
+# define BENCH_LOOPS	1000000
+#endif
+
+#define BENCH_BUF	(64 * 1024)
+#define BENCH_READ	4096
+
+struct bench_case {
+	const char *name;
+	xdrproc_t rpcgen, hsi;
+	size_t size;		/* Of the decoded structure */
+	char *wire;
+	unsigned int len;
+};
+
+static void bench_fattr3(fattr3 *fa, unsigned int i)
+{
+	fa->type = NF3REG;
+	fa->mode = 0644;
+	fa->nlink = 1;
+	fa->uid = 1000 + i;
+	fa->gid = 100;
+	fa->size = 0x123456789ULL * i;
+	fa->used = 0x1000;
+	fa->rdev.major = 8;
+	fa->rdev.minor = i;
+	fa->fsid = 0xfeedfaceULL;
+	fa->fileid = 0x100000000ULL + i;
+	fa->atime.seconds = 1700000000 + i;
+	fa->atime.nseconds = 1;
+	fa->mtime.seconds = 1700000001 + i;
+	fa->mtime.nseconds = 2;
+	fa->ctime.seconds = 1700000002 + i;
+	fa->ctime.nseconds = 3;
+}
+
+static void bench_post_op(post_op_attr *pa, unsigned int i)
+{
+	pa->present = TRUE;
+	bench_fattr3(&pa->post_op_attr_u.attributes, i);
+}
+
+static void bench_encode(struct bench_case *bc, void *res)
+{
+	XDR xdrs;
+
+	bc->wire = malloc(BENCH_BUF);
+	xdrmem_create(&xdrs, bc->wire, BENCH_BUF, XDR_ENCODE);
+	if (!bc->rpcgen(&xdrs, res)) {
+		fprintf(stderr, "%s: encoding failed\n", bc->name);
+		exit(1);
+	}
+	bc->len = xdr_getpos(&xdrs);
+	xdr_destroy(&xdrs);
+}
+
+static double bench_run(struct bench_case *bc, xdrproc_t proc, long loops)
+{
+	struct timespec t0, t1;
+	char res[1024];
+	XDR xdrs;
+	long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < loops; i++) {
+		memset(res, 0, bc->size);
+		xdrmem_create(&xdrs, bc->wire, bc->len, XDR_DECODE);
+		if (!proc(&xdrs, res)) {
+			fprintf(stderr, "%s: decoding failed\n", bc->name);
+			exit(1);
+		}
+		xdr_destroy(&xdrs);
+		xdr_free(bc->rpcgen, res);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) /
+		loops;
+}
+
+/* Both decodings, encoded again with rpcgen, must give the same bytes. */
+static void bench_check(struct bench_case *bc)
+{
+	char res[1024], *again;
+	xdrproc_t procs[2] = { bc->rpcgen, bc->hsi };
+	XDR xdrs;
+	int i;
+
+	again = malloc(BENCH_BUF);
+	for (i = 0; i < 2; i++) {
+		memset(res, 0, bc->size);
+		xdrmem_create(&xdrs, bc->wire, bc->len, XDR_DECODE);
+		if (!procs[i](&xdrs, res))
+			goto bad;
+		xdr_destroy(&xdrs);
+		xdrmem_create(&xdrs, again, BENCH_BUF, XDR_ENCODE);
+		if (!bc->rpcgen(&xdrs, res) || xdr_getpos(&xdrs) != bc->len ||
+		    memcmp(again, bc->wire, bc->len))
+			goto bad;
+		xdr_destroy(&xdrs);
+		xdr_free(bc->rpcgen, res);
+	}
+	free(again);
+	return;
+bad:
+	fprintf(stderr, "%s: decodings differ\n", bc->name);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	long loops = argc > 1 ? atol(argv[1]) : BENCH_LOOPS;
+	struct bench_case cases[5];
+	static char data[BENCH_READ], fh[32] = "file handle";
+	getattr3res gres;
+	lookup3res lres;
+	access3res ares;
+	read3res rres;
+	write3res wres;
+	double a, b;
+	int i, n = 0;
+
+	memset(&gres, 0, sizeof(gres));
+	bench_fattr3(&gres.getattr3res_u.attributes, 1);
+	cases[n] = (struct bench_case){ "GETATTR", (xdrproc_t)xdr_getattr3res,
+		(xdrproc_t)hsi_xdr_getattr3res, sizeof(gres), NULL, 0 };
+	bench_encode(&cases[n++], &gres);
+
+	memset(&lres, 0, sizeof(lres));
+	lres.lookup3res_u.resok.object.data.data_len = sizeof(fh);
+	lres.lookup3res_u.resok.object.data.data_val = fh;
+	bench_post_op(&lres.lookup3res_u.resok.obj_attributes, 2);
+	bench_post_op(&lres.lookup3res_u.resok.dir_attributes, 3);
+	cases[n] = (struct bench_case){ "LOOKUP", (xdrproc_t)xdr_lookup3res,
+		(xdrproc_t)hsi_xdr_lookup3res, sizeof(lres), NULL, 0 };
+	bench_encode(&cases[n++], &lres);
+
+	memset(&ares, 0, sizeof(ares));
+	bench_post_op(&ares.access3res_u.resok.obj_attributes, 4);
+	ares.access3res_u.resok.access = 0x3f;
+	cases[n] = (struct bench_case){ "ACCESS", (xdrproc_t)xdr_access3res,
+		(xdrproc_t)hsi_xdr_access3res, sizeof(ares), NULL, 0 };
+	bench_encode(&cases[n++], &ares);
+
+	memset(&rres, 0, sizeof(rres));
+	bench_post_op(&rres.read3res_u.resok.file_attributes, 5);
+	rres.read3res_u.resok.count = BENCH_READ;
+	rres.read3res_u.resok.data.data_len = BENCH_READ;
+	rres.read3res_u.resok.data.data_val = data;
+	cases[n] = (struct bench_case){ "READ", (xdrproc_t)xdr_read3res,
+		(xdrproc_t)hsi_xdr_read3res, sizeof(rres), NULL, 0 };
+	bench_encode(&cases[n++], &rres);
+
+	memset(&wres, 0, sizeof(wres));
+	wres.write3res_u.resok.file_wcc.before.present = TRUE;
+	wres.write3res_u.resok.file_wcc.before.pre_op_attr_u.attributes.size = 7;
+	bench_post_op(&wres.write3res_u.resok.file_wcc.after, 6);
+	wres.write3res_u.resok.count = BENCH_READ;
+	wres.write3res_u.resok.committed = FILE_SYNC;
+	memcpy(wres.write3res_u.resok.verf, "verifier", NFS3_WRITEVERFSIZE);
+	cases[n] = (struct bench_case){ "WRITE", (xdrproc_t)xdr_write3res,
+		(xdrproc_t)hsi_xdr_write3res, sizeof(wres), NULL, 0 };
+	bench_encode(&cases[n++], &wres);
+
+	if (loops > 0)
+		printf("%-8s %10s %10s %8s\n", "reply", "rpcgen ns",
+		       "hsi ns", "speedup");
+	for (i = 0; i < n; i++) {
+		bench_check(&cases[i]);
+		if (loops <= 0) {
+			printf("%s: decodings agree\n", cases[i].name);
+			free(cases[i].wire);
+			continue;
+		}
+		a = bench_run(&cases[i], cases[i].rpcgen, loops);
+		b = bench_run(&cases[i], cases[i].hsi, loops);
+		printf("%-8s %10.1f %10.1f %7.2fx\n", cases[i].name, a, b,
+		       a / b);
+		free(cases[i].wire);
+	}
+
+	return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * This file is part of nfs-fuse, the FUSE implementation of NFS Client.
+ * Copyright (C) 2024 by Feng Shuo <steve.shuo.feng@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * nfs-fuse-ctl: drive the ioctls of a mounted nfs-fuse (hsfs_ioctl.h).
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hsfs_ioctl.h"
+
+static const char *progname = "nfs-fuse-ctl";
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: %s bstat DIR [PATH...]\n"
+		"  Stat each PATH, relative to DIR on an nfs-fuse mount, or\n"
+		"  each line of the standard input without PATHs.\n"
+		"       %s prefetch [-d DEPTH] [-o OFF] [-l LEN] [-w] [PATH...]\n"
+		"  Read each file, or the files of each directory and of its\n"
+		"  subdirectories down to DEPTH, into the page cache in the\n"
+		"  background. -w waits, showing progress.\n"
+		"       %s status PATH [ID]\n"
+		"       %s cancel PATH [ID]\n"
+		"  Show or cancel the prefetch jobs of the mount of PATH.\n",
+		progname, progname, progname, progname);
+	exit(2);
+}
+
+struct bstat_batch {
+	int fd;
+	struct hsfs_bstat_args args;
+	char *name[HSFS_BSTAT_MAX];	/* For printing, copies */
+	size_t used;			/* Of args.u.in.names */
+	int failed;
+};
+
+static int bstat_flush(struct bstat_batch *b)
+{
+	struct hsfs_bstat *st;
+	unsigned int i, count = b->args.count;
+
+	if (count == 0)
+		return 0;
+	if (ioctl(b->fd, HSFS_IOC_BSTAT, &b->args) < 0) {
+		fprintf(stderr, "%s: HSFS_IOC_BSTAT: %s\n", progname,
+			strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		st = &b->args.u.out[i];
+		if (st->err) {
+			fprintf(stderr, "%s: %s: %s\n", progname, b->name[i],
+				strerror(st->err));
+			b->failed = 1;
+		} else {
+			printf("%s\t%llu\t%o\t%llu\t%u\t%u\t%lld\n", b->name[i],
+			       (unsigned long long)st->ino, st->mode,
+			       (unsigned long long)st->size, st->uid, st->gid,
+			       (long long)st->mtime);
+		}
+		free(b->name[i]);
+	}
+	memset(&b->args, 0, sizeof(b->args));
+	b->used = 0;
+
+	return 0;
+}
+
+static int bstat_add(struct bstat_batch *b, const char *path)
+{
+	size_t len = strlen(path) + 1;
+
+	if (len > sizeof(b->args.u.in.names)) {
+		fprintf(stderr, "%s: %s: %s\n", progname, path,
+			strerror(ENAMETOOLONG));
+		b->failed = 1;
+		return 0;
+	}
+	if (b->args.count == HSFS_BSTAT_MAX ||
+	    b->used + len > sizeof(b->args.u.in.names))
+		if (bstat_flush(b))
+			return -1;
+	b->name[b->args.count] = strdup(path);
+	if (b->name[b->args.count] == NULL)
+		return -1;
+	memcpy(b->args.u.in.names + b->used, path, len);
+	b->used += len;
+	b->args.u.in.parent[b->args.count++] = 0;
+
+	return 0;
+}
+
+static int do_bstat(int argc, char *argv[])
+{
+	struct bstat_batch *b;
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	int i, err = 0;
+
+	if (argc < 1)
+		usage();
+	b = calloc(1, sizeof(*b));
+	if (b == NULL)
+		return 1;
+	b->fd = open(argv[0], O_RDONLY | O_DIRECTORY);
+	if (b->fd < 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, argv[0],
+			strerror(errno));
+		free(b);
+		return 1;
+	}
+
+	if (argc > 1) {
+		for (i = 1; i < argc && !err; i++)
+			err = bstat_add(b, argv[i]);
+	} else {
+		while (!err && (len = getline(&line, &cap, stdin)) > 0) {
+			if (line[len - 1] == '\n')
+				line[--len] = '\0';
+			if (len)
+				err = bstat_add(b, line);
+		}
+		free(line);
+	}
+	if (!err)
+		err = bstat_flush(b);
+
+	close(b->fd);
+	err = err || b->failed;
+	free(b);
+
+	return err ? 1 : 0;
+}
+
+struct prefetch_opts {
+	int depth;
+	unsigned long long off;
+	unsigned long long len;
+	int fd;			/* On the mount, kept for -w */
+	uint64_t *ids;		/* Jobs queued, for -w */
+	size_t nids, capids;
+	int failed;
+};
+
+static volatile sig_atomic_t interrupted;
+
+static void on_interrupt(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+static int prefetch_file(struct prefetch_opts *o, int fd, const char *path)
+{
+	struct hsfs_prefetch_args args;
+	uint64_t *ids;
+
+	memset(&args, 0, sizeof(args));
+	args.off = o->off;
+	args.len = o->len;
+	if (ioctl(fd, HSFS_IOC_PREFETCH, &args) < 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+		o->failed = 1;
+		return 0;
+	}
+	if (!args.id)
+		return 0;
+	if (o->nids == o->capids) {
+		o->capids = o->capids ? 2 * o->capids : 64;
+		ids = realloc(o->ids, o->capids * sizeof(*ids));
+		if (ids == NULL)
+			return -1;
+		o->ids = ids;
+	}
+	o->ids[o->nids++] = args.id;
+
+	return 0;
+}
+
+/*
+ * Directories are listed through the kernel: the daemon can only store
+ * pages of the files the kernel knows, and listing them makes it know
+ * them, attributes included.
+ */
+static int prefetch_path(struct prefetch_opts *o, int at, const char *name,
+			 const char *path, int depth)
+{
+	char sub[4096];
+	struct dirent *de;
+	struct stat st;
+	DIR *dir;
+	int fd, err = 0;
+
+	fd = openat(at, name, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "%s: %s: %s\n", progname, path, strerror(errno));
+		o->failed = 1;
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	if (o->fd < 0)
+		o->fd = dup(fd);
+
+	if (S_ISREG(st.st_mode)) {
+		err = prefetch_file(o, fd, path);
+		close(fd);
+		return err;
+	}
+	if (!S_ISDIR(st.st_mode) || depth < 0) {
+		close(fd);
+		return 0;
+	}
+
+	dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+		return -1;
+	}
+	while (!err && !interrupted && (de = readdir(dir))) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		if (de->d_type == DT_DIR && depth == 0)
+			continue;
+		snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+		err = prefetch_path(o, dirfd(dir), de->d_name, sub, depth - 1);
+	}
+	closedir(dir);
+
+	return err;
+}
+
+/* Until every job queued is over, or cancel them on ^C. */
+static int prefetch_wait(struct prefetch_opts *o)
+{
+	struct hsfs_prefetch_status st;
+	unsigned long long done, total;
+	size_t i, left;
+
+	for (;;) {
+		done = total = 0;
+		for (i = 0, left = 0; i < o->nids; i++) {
+			if (!o->ids[i])
+				continue;
+			memset(&st, 0, sizeof(st));
+			st.id = o->ids[i];
+			if (ioctl(o->fd, HSFS_IOC_PREFETCH_STATUS, &st) < 0) {
+				o->ids[i] = 0;
+				continue;
+			}
+			if (interrupted) {
+				ioctl(o->fd, HSFS_IOC_PREFETCH_CANCEL, &o->ids[i]);
+				continue;
+			}
+			done += st.done;
+			total += st.total;
+			left++;
+		}
+		if (interrupted) {
+			fprintf(stderr, "\n%s: cancelled\n", progname);
+			return -1;
+		}
+		fprintf(stderr, "\r%zu of %zu files left, %llu of %llu MiB",
+			left, o->nids, done >> 20, total >> 20);
+		if (!left)
+			break;
+		sleep(1);
+	}
+	fprintf(stderr, "\n");
+
+	return 0;
+}
+
+static int do_prefetch(int argc, char *argv[])
+{
+	struct prefetch_opts o;
+	char *line = NULL;
+	size_t cap = 0;
+	ssize_t len;
+	int c, wait = 0, err = 0;
+
+	memset(&o, 0, sizeof(o));
+	o.fd = -1;
+	optind = 0;
+	while ((c = getopt(argc, argv, "d:o:l:w")) != -1) {
+		switch (c) {
+		case 'd':
+			o.depth = atoi(optarg);
+			break;
+		case 'o':
+			o.off = strtoull(optarg, NULL, 0);
+			break;
+		case 'l':
+			o.len = strtoull(optarg, NULL, 0);
+			break;
+		case 'w':
+			wait = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	signal(SIGINT, on_interrupt);
+
+	if (optind < argc) {
+		for (; optind < argc && !err && !interrupted; optind++)
+			err = prefetch_path(&o, AT_FDCWD, argv[optind],
+					    argv[optind], o.depth);
+	} else {
+		while (!err && !interrupted &&
+		       (len = getline(&line, &cap, stdin)) > 0) {
+			if (line[len - 1] == '\n')
+				line[--len] = '\0';
+			if (len)
+				err = prefetch_path(&o, AT_FDCWD, line, line,
+						    o.depth);
+		}
+		free(line);
+	}
+	if (!err && wait && o.fd >= 0)
+		err = prefetch_wait(&o);
+	else if (!err)
+		printf("%zu files queued\n", o.nids);
+
+	if (o.fd >= 0)
+		close(o.fd);
+	free(o.ids);
+
+	return err || o.failed || interrupted ? 1 : 0;
+}
+
+static int do_jobs(int argc, char *argv[], int cancel)
+{
+	struct hsfs_prefetch_status st;
+	uint64_t id;
+	int fd, res;
+
+	if (argc < 1 || argc > 2)
+		usage();
+	id = argc > 1 ? strtoull(argv[1], NULL, 0) : 0;
+	fd = open(argv[0], O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, argv[0],
+			strerror(errno));
+		return 1;
+	}
+	if (cancel) {
+		res = ioctl(fd, HSFS_IOC_PREFETCH_CANCEL, &id);
+	} else {
+		memset(&st, 0, sizeof(st));
+		st.id = id;
+		res = ioctl(fd, HSFS_IOC_PREFETCH_STATUS, &st);
+		if (!res)
+			printf("%u jobs, %llu of %llu bytes\n", st.jobs,
+			       (unsigned long long)st.done,
+			       (unsigned long long)st.total);
+	}
+	if (res < 0)
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+	close(fd);
+
+	return res < 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+		usage();
+	if (!strcmp(argv[1], "bstat"))
+		return do_bstat(argc - 2, argv + 2);
+	if (!strcmp(argv[1], "prefetch"))
+		return do_prefetch(argc - 1, argv + 1);
+	if (!strcmp(argv[1], "status"))
+		return do_jobs(argc - 2, argv + 2, 0);
+	if (!strcmp(argv[1], "cancel"))
+		return do_jobs(argc - 2, argv + 2, 1);
+	usage();
+
+	return 2;
+}